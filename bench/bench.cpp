@@ -0,0 +1,524 @@
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QCommandLineParser>
+#include <QCommandLineOption>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QLoggingCategory>
+#include <QScopedPointer>
+#include <QStringBuilder>
+#include <QTextStream>
+#include <QThread>
+
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "compile.h"
+#include "metrics.h"
+#include "packs.h"
+#include "spread.h"
+
+namespace {
+//! Fills files with incompressible bytes from a seeded splitmix64, so every run
+//! generates the same trees
+class Generator
+{
+public:
+    explicit Generator(quint64 seed) : m_state(seed) {}
+
+    quint64 next()
+    {
+        auto z = (m_state += 0x9E3779B97F4A7C15ull);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        return z ^ (z >> 31);
+    }
+
+    QByteArray bytes(int length)
+    {
+        QByteArray buffer(length, Qt::Uninitialized);
+        for(int i = 0; i < length; i += 8)
+        {
+            const auto value = next();
+            std::memcpy(buffer.data() + i, &value, qMin(8, length - i));
+        }
+        return buffer;
+    }
+
+    bool writeFile(const QString &path, qint64 size)
+    {
+        QFile file(path);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "could not open file" << file.errorString();
+            return false;
+        }
+
+        for(qint64 pos = 0; pos < size; )
+        {
+            const auto buffer = bytes(qMin<qint64>(size - pos, 4 * 1024 * 1024));
+            if(file.write(buffer) != buffer.size())
+            {
+                qWarning() << "could not write file" << file.errorString();
+                return false;
+            }
+            pos += buffer.size();
+        }
+
+        return true;
+    }
+
+    //! size bytes of holes with a dataSize block of data every stride bytes
+    bool writeSparseFile(const QString &path, qint64 size, qint64 stride, int dataSize)
+    {
+        QFile file(path);
+        if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "could not open file" << file.errorString();
+            return false;
+        }
+
+        if(!file.resize(size))
+        {
+            qWarning() << "could not resize file" << file.errorString();
+            return false;
+        }
+
+        for(qint64 pos = 0; pos + dataSize <= size; pos += stride)
+        {
+            const auto buffer = bytes(dataSize);
+            if(!file.seek(pos) || file.write(buffer) != buffer.size())
+            {
+                qWarning() << "could not write file" << file.errorString();
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+private:
+    quint64 m_state;
+};
+
+struct Tree
+{
+    qint64 bytes { 0 };
+    qint64 files { 0 };
+};
+
+//! Many tiny files, 500 per directory
+bool generateTiny(const QDir &dir, double scale, Tree &tree)
+{
+    Generator generator(1);
+
+    const int count = qMax(1, int(20000 * scale));
+    for(int i = 0; i < count; i++)
+    {
+        const QDir subDir(dir.absoluteFilePath(QString::number(i / 500)));
+        if(i % 500 == 0 && !subDir.mkpath(subDir.absolutePath()))
+        {
+            qWarning() << "could not create dir" << subDir.absolutePath();
+            return false;
+        }
+
+        const auto size = 64 + qint64(generator.next() % 8129);
+        if(!generator.writeFile(subDir.absoluteFilePath(QString::number(i) % ".bin"), size))
+            return false;
+
+        tree.bytes += size;
+        tree.files++;
+    }
+
+    return true;
+}
+
+//! A few huge files
+bool generateHuge(const QDir &dir, double scale, Tree &tree)
+{
+    Generator generator(2);
+
+    const auto size = qMax<qint64>(1024 * 1024, 512 * 1024 * 1024 * scale);
+    for(int i = 0; i < 2; i++)
+    {
+        if(!generator.writeFile(dir.absoluteFilePath(QString::number(i) % ".bin"), size))
+            return false;
+
+        tree.bytes += size;
+        tree.files++;
+    }
+
+    return true;
+}
+
+//! 100 levels of nesting with a few small files on every level
+bool generateDeep(const QDir &dir, double scale, Tree &tree)
+{
+    Generator generator(3);
+
+    const int depth = qMax(1, int(100 * scale));
+    QDir level(dir);
+    for(int i = 0; i < depth; i++)
+    {
+        level = QDir(level.absoluteFilePath(QStringLiteral("level") % QString::number(i)));
+        if(!level.mkpath(level.absolutePath()))
+        {
+            qWarning() << "could not create dir" << level.absolutePath();
+            return false;
+        }
+
+        for(int j = 0; j < 10; j++)
+        {
+            if(!generator.writeFile(level.absoluteFilePath(QString::number(j) % ".bin"), 16 * 1024))
+                return false;
+
+            tree.bytes += 16 * 1024;
+            tree.files++;
+        }
+    }
+
+    return true;
+}
+
+//! One mostly empty file, 1 MiB of data every 64 MiB
+bool generateSparse(const QDir &dir, double scale, Tree &tree)
+{
+    Generator generator(4);
+
+    const auto size = qMax<qint64>(64 * 1024 * 1024, 1024ll * 1024 * 1024 * scale);
+    if(!generator.writeSparseFile(dir.absoluteFilePath(QStringLiteral("sparse.bin")), size, 64 * 1024 * 1024, 1024 * 1024))
+        return false;
+
+    tree.bytes += size;
+    tree.files++;
+
+    return true;
+}
+
+qint64 peakRssKiB()
+{
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == -1)
+        return -1;
+    return usage.ru_maxrss;
+}
+
+class Report
+{
+public:
+    void add(const QString &scenario, const QString &operation, qint64 bytes, qint64 files, qint64 nsecs)
+    {
+        const auto seconds = nsecs / 1000000000.;
+
+        QJsonObject result;
+        result[QStringLiteral("scenario")] = scenario;
+        result[QStringLiteral("operation")] = operation;
+        result[QStringLiteral("bytes")] = bytes;
+        result[QStringLiteral("files")] = files;
+        result[QStringLiteral("seconds")] = seconds;
+        result[QStringLiteral("mbPerSecond")] = seconds > 0 ? bytes / seconds / 1000000. : 0.;
+        result[QStringLiteral("filesPerSecond")] = seconds > 0 ? files / seconds : 0.;
+        //getrusage() only knows the peak of the whole process so far
+        result[QStringLiteral("peakRssKiB")] = peakRssKiB();
+        result[QStringLiteral("counters")] = metrics.toJson();
+        m_results.append(result);
+
+        QTextStream(stderr) << QStringLiteral("%0 %1: %2s, %3 MB/s, %4 files/s, peak rss %5 KiB\n")
+                               .arg(scenario, -8)
+                               .arg(operation, -12)
+                               .arg(seconds, 0, 'f', 3)
+                               .arg(result.value(QStringLiteral("mbPerSecond")).toDouble(), 0, 'f', 1)
+                               .arg(result.value(QStringLiteral("filesPerSecond")).toDouble(), 0, 'f', 1)
+                               .arg(result.value(QStringLiteral("peakRssKiB")).toDouble(), 0, 'f', 0);
+    }
+
+    const QJsonArray &results() const { return m_results; }
+
+private:
+    QJsonArray m_results;
+};
+
+//! Also starts the counters of the measurement from zero
+template<typename Func>
+bool timed(qint64 &nsecs, Func func)
+{
+    metrics.reset();
+
+    QElapsedTimer timer;
+    timer.start();
+    const auto result = func();
+    nsecs = timer.nsecsElapsed();
+    return result;
+}
+
+bool benchTree(const QDir &dir, const QString &scenario, const Tree &tree, const SpreadOptions &baseOptions, bool pack, Report &report)
+{
+    const auto sourcePath = dir.absoluteFilePath(QStringLiteral("source"));
+    const auto targetPath = dir.absoluteFilePath(QStringLiteral("target"));
+    const auto restoredPath = dir.absoluteFilePath(QStringLiteral("restored"));
+
+    auto options = baseOptions;
+
+    QScopedPointer<PackWriter> packWriter;
+    if(pack)
+    {
+        packWriter.reset(new PackWriter(QDir(targetPath).absoluteFilePath(QStringLiteral("__packs")), options.maxChunkSize));
+        if(!packWriter->open())
+            return false;
+        options.packWriter = packWriter.data();
+    }
+
+    const auto runSpread = [&](){
+        if(!(options.jobs > 1 ? spreadParallel(sourcePath, targetPath, options) : spread(sourcePath, targetPath, options)))
+            return false;
+        return !packWriter || (packWriter->flush() && packWriter->removeUnreferenced());
+    };
+
+    qint64 nsecs;
+
+    if(!timed(nsecs, runSpread))
+        return false;
+    report.add(scenario, QStringLiteral("spread"), tree.bytes, tree.files, nsecs);
+
+    //nothing changed, measures how fast an up to date target is recognized
+    if(!timed(nsecs, runSpread))
+        return false;
+    report.add(scenario, QStringLiteral("respread"), tree.bytes, tree.files, nsecs);
+
+    PackReader packReader(QDir(targetPath).absoluteFilePath(QStringLiteral("__packs")));
+    CompileOptions compileOptions;
+    compileOptions.packReader = &packReader;
+    compileOptions.hashThreads = baseOptions.hashThreads * baseOptions.jobs;
+
+    if(!timed(nsecs, [&](){ return compile(targetPath, restoredPath, compileOptions); }))
+        return false;
+    report.add(scenario, QStringLiteral("compile"), tree.bytes, tree.files, nsecs);
+
+    return true;
+}
+
+bool benchBitmaps(const QDir &dir, double scale, Report &report)
+{
+    Generator generator(5);
+
+    for(const int size : { 4 * 1024, 1024 * 1024, 16 * 1024 * 1024 })
+    {
+        const auto scenario = QStringLiteral("bitmap-%0k").arg(size / 1024);
+        const int count = qMax<qint64>(16, 256 * 1024 * 1024 * scale / size);
+        const auto content = generator.bytes(size);
+
+        std::vector<QString> filenames;
+        for(int i = 0; i < count; i++)
+            filenames.push_back(dir.absoluteFilePath(scenario % '-' % QString::number(i) % ".bmp"));
+
+        qint64 nsecs;
+
+        if(!timed(nsecs, [&](){
+            for(const auto &filename : filenames)
+                if(!writeBitmap(filename, content))
+                    return false;
+            return true;
+        }))
+            return false;
+        report.add(scenario, QStringLiteral("writeBitmap"), qint64(size) * count, count, nsecs);
+
+        if(!timed(nsecs, [&](){
+            QByteArray buffer;
+            for(const auto &filename : filenames)
+                if(!readBitmap(filename, buffer) || buffer.size() != size)
+                    return false;
+            return true;
+        }))
+            return false;
+        report.add(scenario, QStringLiteral("readBitmap"), qint64(size) * count, count, nsecs);
+    }
+
+    return true;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("picsync_bench");
+    QCoreApplication::setApplicationVersion("1.0");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QCoreApplication::translate("main", "Measures spread, compile and bitmap throughput on generated trees. Prints the results as json to stdout."));
+    parser.addHelpOption();
+    parser.addVersionOption();
+
+    QCommandLineOption dirOption("dir", QCoreApplication::translate("main", "Scratch directory, gets wiped"), QCoreApplication::translate("main", "some_directory"),
+                                 QDir::temp().absoluteFilePath(QStringLiteral("picsync_bench")));
+    parser.addOption(dirOption);
+
+    QCommandLineOption scenariosOption("scenarios", QCoreApplication::translate("main", "Comma separated list of tiny, huge, deep, sparse and bitmap"), QCoreApplication::translate("main", "scenarios"),
+                                       QStringLiteral("tiny,huge,deep,sparse,bitmap"));
+    parser.addOption(scenariosOption);
+
+    QCommandLineOption scaleOption("scale", QCoreApplication::translate("main", "Scales the size of the generated trees"), QCoreApplication::translate("main", "factor"), QStringLiteral("1"));
+    parser.addOption(scaleOption);
+
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs", QCoreApplication::translate("main", "Number of parallel jobs for spread (0 for one per core)"), QCoreApplication::translate("main", "jobs"), QStringLiteral("1"));
+    parser.addOption(jobsOption);
+
+    QCommandLineOption hashOption("hash", QCoreApplication::translate("main", "Digest, sha512 or blake3"), QCoreApplication::translate("main", "algorithm"), QStringLiteral("sha512"));
+    parser.addOption(hashOption);
+
+    QCommandLineOption cdcOption("cdc", QCoreApplication::translate("main", "Cut files at content defined boundaries"));
+    parser.addOption(cdcOption);
+
+    QCommandLineOption chunkSizesOption("chunk-sizes", QCoreApplication::translate("main", "Minimum, average and maximum part size in KiB for --cdc"), QCoreApplication::translate("main", "min:avg:max"), QStringLiteral("1024:4096:16384"));
+    parser.addOption(chunkSizesOption);
+
+    QCommandLineOption packOption("pack", QCoreApplication::translate("main", "Pack small files"));
+    parser.addOption(packOption);
+
+    QCommandLineOption verboseOption("verbose", QCoreApplication::translate("main", "Keep the debug and info output of spread and compile"));
+    parser.addOption(verboseOption);
+
+    parser.process(app);
+
+    //logging every bitmap would be measured as well otherwise
+    if(!parser.isSet(verboseOption))
+        QLoggingCategory::setFilterRules(QStringLiteral("default.debug=false\ndefault.info=false"));
+
+    bool scaleOk;
+    const auto scale = parser.value(scaleOption).toDouble(&scaleOk);
+    if(!scaleOk || scale <= 0)
+    {
+        qCritical() << "invalid scale" << parser.value(scaleOption);
+        return -1;
+    }
+
+    bool jobsOk;
+    auto jobs = parser.value(jobsOption).toInt(&jobsOk);
+    if(!jobsOk || jobs < 0)
+    {
+        qCritical() << "invalid jobs" << parser.value(jobsOption);
+        return -1;
+    }
+    if(jobs == 0)
+        jobs = QThread::idealThreadCount();
+
+    SpreadOptions options;
+    options.jobs = jobs;
+    options.hashThreads = qMax(1, QThread::idealThreadCount() / jobs);
+    options.contentDefinedChunking = parser.isSet(cdcOption);
+
+    if(!parseDigestAlgorithm(parser.value(hashOption), options.digestAlgorithm))
+    {
+        qCritical() << "invalid hash" << parser.value(hashOption);
+        return -1;
+    }
+
+    {
+        const auto chunkSizes = parser.value(chunkSizesOption).split(QLatin1Char(':'));
+        bool minOk = false, averageOk = false, maxOk = false;
+        if(chunkSizes.size() == 3)
+        {
+            options.minChunkSize = chunkSizes.at(0).toInt(&minOk) * 1024;
+            options.averageChunkSize = chunkSizes.at(1).toInt(&averageOk) * 1024;
+            options.maxChunkSize = chunkSizes.at(2).toInt(&maxOk) * 1024;
+        }
+        if(!minOk || !averageOk || !maxOk || options.minChunkSize < 64 * 1024 ||
+           options.minChunkSize > options.averageChunkSize || options.averageChunkSize > options.maxChunkSize ||
+           options.maxChunkSize > 256 * 1024 * 1024)
+        {
+            qCritical() << "invalid chunk sizes" << parser.value(chunkSizesOption);
+            return -1;
+        }
+    }
+
+    QDir dir(parser.value(dirOption));
+    if(dir.exists() && !dir.removeRecursively())
+    {
+        qCritical() << "could not wipe" << dir.absolutePath();
+        return -2;
+    }
+
+    const std::vector<std::pair<QString, std::function<bool(const QDir &, double, Tree &)>>> generators {
+        { QStringLiteral("tiny"), generateTiny },
+        { QStringLiteral("huge"), generateHuge },
+        { QStringLiteral("deep"), generateDeep },
+        { QStringLiteral("sparse"), generateSparse },
+    };
+
+    const auto scenarios = parser.value(scenariosOption).split(QLatin1Char(','), QString::SkipEmptyParts);
+
+    Report report;
+
+    for(const auto &generator : generators)
+    {
+        if(!scenarios.contains(generator.first))
+            continue;
+
+        const QDir scenarioDir(dir.absoluteFilePath(generator.first));
+        const QDir sourceDir(scenarioDir.absoluteFilePath(QStringLiteral("source")));
+        if(!sourceDir.mkpath(sourceDir.absolutePath()))
+        {
+            qCritical() << "could not create dir" << sourceDir.absolutePath();
+            return -2;
+        }
+
+        Tree tree;
+        if(!generator.second(sourceDir, scale, tree))
+        {
+            qCritical() << "could not generate" << generator.first;
+            return -2;
+        }
+
+        if(!benchTree(scenarioDir, generator.first, tree, options, parser.isSet(packOption), report))
+        {
+            qCritical() << "benchmark failed" << generator.first;
+            return -3;
+        }
+
+        //keeps the scratch directory from growing with every scenario
+        QDir(scenarioDir).removeRecursively();
+    }
+
+    if(scenarios.contains(QStringLiteral("bitmap")))
+    {
+        const QDir bitmapDir(dir.absoluteFilePath(QStringLiteral("bitmap")));
+        if(!bitmapDir.mkpath(bitmapDir.absolutePath()))
+        {
+            qCritical() << "could not create dir" << bitmapDir.absolutePath();
+            return -2;
+        }
+
+        if(!benchBitmaps(bitmapDir, scale, report))
+        {
+            qCritical() << "benchmark failed" << "bitmap";
+            return -3;
+        }
+
+        QDir(bitmapDir).removeRecursively();
+    }
+
+    QJsonObject result;
+    result[QStringLiteral("jobs")] = options.jobs;
+    result[QStringLiteral("hash")] = digestName(options.digestAlgorithm);
+    result[QStringLiteral("contentDefinedChunking")] = options.contentDefinedChunking;
+    result[QStringLiteral("minChunkSize")] = options.minChunkSize;
+    result[QStringLiteral("averageChunkSize")] = options.averageChunkSize;
+    result[QStringLiteral("maxChunkSize")] = options.maxChunkSize;
+    result[QStringLiteral("pack")] = parser.isSet(packOption);
+    result[QStringLiteral("scale")] = scale;
+    result[QStringLiteral("results")] = report.results();
+
+    QTextStream(stdout) << QJsonDocument(result).toJson();
+
+    return 0;
+}
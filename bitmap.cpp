@@ -0,0 +1,298 @@
+#include "bitmap.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QFileInfo>
+#include <QDataStream>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringBuilder>
+#include <QUuid>
+#include <QtEndian>
+#include <QtGlobal>
+
+#include <qmath.h>
+
+#include "metrics.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace {
+const int headerSize { bitmapHeaderSize };
+
+//! Every field that does not depend on the content, the rest is patched in by writeBitmap()
+const unsigned char headerTemplate[headerSize] {
+    'B', 'M',               //BM-Header
+    0, 0, 0, 0,             //File size
+    0, 0, 0, 0,             //Unused (and abused for content length)
+    headerSize, 0, 0, 0,    //Offset to bitmap data
+
+    40, 0, 0, 0,            //DIP Header size
+    0, 0, 0, 0,             //width
+    0, 0, 0, 0,             //height
+    1, 0,                   //Number of color planes
+    32, 0,                  //Bits per pixel
+    0, 0, 0, 0,             //No compression
+    0, 0, 0, 0,             //Size of bitmap data
+    0x13, 0x0B, 0, 0,       //Horizontal print resolution (2835)
+    0x13, 0x0B, 0, 0,       //Vertical print resolution (2835)
+    0, 0, 0, 0,             //Number of colors in palette
+    0, 0, 0, 0              //Important colors
+};
+
+//! The padding is less than one row, all its iovecs point into this page
+const char zeroPage[4096] {};
+
+bool writeAll(int fd, struct iovec *iov, int iovcnt)
+{
+    while(iovcnt)
+    {
+        const auto written = writev(fd, iov, qMin(iovcnt, IOV_MAX));
+        if(written == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            qWarning() << "could not write" << strerror(errno);
+            return false;
+        }
+
+        //skip what was written, a short write can end in the middle of an iovec
+        auto remaining = size_t(written);
+        while(iovcnt && remaining >= iov->iov_len)
+        {
+            remaining -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt)
+        {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + remaining;
+            iov->iov_len -= remaining;
+        }
+    }
+
+    return true;
+}
+}
+
+quint32 bitmapHeader(int length, unsigned char *header)
+{
+    const quint64 pixels = std::ceil(length / 4.0);
+    const quint32 width = std::sqrt(pixels);
+    const quint32 height = pixels ? quint32(std::ceil(pixels / (qreal)width)) : 0;
+
+    const quint32 bitmapSize = width * height * 4;
+
+    std::memcpy(header, headerTemplate, headerSize);
+    qToLittleEndian<quint32>(headerSize + bitmapSize, header + 2);
+    qToLittleEndian<quint32>(length, header + 6);
+    qToLittleEndian<quint32>(width, header + 18);
+    qToLittleEndian<quint32>(height, header + 22);
+    qToLittleEndian<quint32>(bitmapSize, header + 34);
+
+    return bitmapSize - length;
+}
+
+bool writeBitmap(const QString &filename, const QByteArray &content, bool sync)
+{
+    qCDebug(picsyncTrace) << "writeBitmap" << filename;
+
+    MetricsTimer timer(metrics.writeNsecs);
+
+    unsigned char header[headerSize];
+    const auto paddingSize = bitmapHeader(content.length(), header);
+    const quint32 bitmapSize = content.length() + paddingSize;
+
+    const int fd = ::open(QFile::encodeName(filename).constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+    if(fd == -1)
+    {
+        qWarning() << "could not open file" << filename << strerror(errno);
+        return false;
+    }
+
+    //one extent for the whole bitmap, filesystems without fallocate() just skip this
+    if(fallocate(fd, 0, 0, headerSize + bitmapSize) == -1 && errno != EOPNOTSUPP && errno != ENOSYS)
+    {
+        qWarning() << "could not preallocate file" << filename << strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    //content is an int, so width stays below 65536 and the padding below 4 * 65536 bytes
+    struct iovec iov[2 + 4 * 65536 / sizeof(zeroPage)];
+    int iovcnt = 0;
+
+    iov[iovcnt++] = { header, headerSize };
+    if(content.length())
+        iov[iovcnt++] = { const_cast<char *>(content.constData()), size_t(content.length()) };
+
+    for(auto remaining = paddingSize; remaining; )
+    {
+        const auto length = qMin<quint32>(remaining, sizeof(zeroPage));
+        iov[iovcnt++] = { const_cast<char *>(zeroPage), length };
+        remaining -= length;
+    }
+
+    auto written = writeAll(fd, iov, iovcnt);
+    if(written && sync && fdatasync(fd) == -1)
+    {
+        qWarning() << "could not sync file" << filename << strerror(errno);
+        written = false;
+    }
+
+    if(written)
+    {
+        metrics.bitmapsWritten++;
+        metrics.bytesWritten += headerSize + bitmapSize;
+    }
+
+    if(::close(fd) == -1 && written)
+    {
+        qWarning() << "could not close file" << filename << strerror(errno);
+        return false;
+    }
+
+    return written;
+}
+
+bool replaceBitmap(const QString &filename, const QByteArray &content, bool sync)
+{
+    const auto tempFilename = filename % ".tmp";
+    if(!writeBitmap(tempFilename, content, sync))
+        return false;
+
+    return commitBitmap(tempFilename, filename, sync);
+}
+
+QString tempBitmapPath(const QString &filename)
+{
+    return filename % '.' % QUuid::createUuid().toString().remove(QLatin1Char('{')).remove(QLatin1Char('}')) % ".tmp";
+}
+
+bool commitBitmap(const QString &tempFilename, const QString &filename, bool sync)
+{
+    if(::rename(QFile::encodeName(tempFilename).constData(), QFile::encodeName(filename).constData()) == -1)
+    {
+        qWarning() << "could not replace" << filename << strerror(errno);
+        QFile::remove(tempFilename);
+        return false;
+    }
+
+    //the rename itself is only durable once the directory is
+    if(sync)
+    {
+        const auto dirFd = ::open(QFile::encodeName(QFileInfo(filename).absolutePath()).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(dirFd != -1)
+        {
+            fsync(dirFd);
+            ::close(dirFd);
+        }
+    }
+
+    return true;
+}
+
+bool readBitmap(const QString &filename, QByteArray &content)
+{
+    qCDebug(picsyncTrace) << "readBitmap" << filename;
+
+    MetricsTimer timer(metrics.readNsecs);
+
+    QFile file(filename);
+    if(!file.exists())
+    {
+        qWarning() << "file does not exist";
+        return false;
+    }
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "could not open file" << file.errorString();
+        return false;
+    }
+
+    if(file.size() < 14)
+    {
+        qWarning() << "not enough bytes";
+        return false;
+    }
+
+    QDataStream dataStream(&file);
+    dataStream.setByteOrder(QDataStream::LittleEndian);
+
+    {
+        quint16 bmHeader;
+        dataStream >> bmHeader;
+        if(bmHeader != 0x4D42)
+        {
+            qWarning() << "no BM header";
+            return false;
+        }
+    }
+
+    {
+        quint32 filesize;
+        dataStream >> filesize;
+        if(filesize != file.size())
+        {
+            qWarning() << "file size does not match!";
+            return false;
+        }
+    }
+
+    quint32 usedSize;
+    dataStream >> usedSize;
+
+    quint32 offsetBitmapData;
+    dataStream >> offsetBitmapData;
+
+    if(!file.seek(offsetBitmapData))
+    {
+        qWarning() << "could not seek";
+        return false;
+    }
+
+    content = file.read(usedSize);
+
+    if(content.length() != usedSize)
+    {
+        qWarning() << "could not read enough for usedSize";
+        return false;
+    }
+
+    metrics.bitmapsRead++;
+    metrics.bytesRead += usedSize;
+
+    return true;
+}
+
+bool readIndex(const QString &filename, QJsonObject &jsonObject)
+{
+    QByteArray content;
+    if(!readBitmap(filename, content))
+        return false;
+
+    QJsonParseError error;
+    const auto document = measure(metrics.jsonNsecs, [&](){ return QJsonDocument::fromJson(content, &error); });
+    metrics.indexParses++;
+    if(error.error != QJsonParseError::NoError)
+    {
+        qWarning() << "index is invalid: error parsing json" << error.errorString();
+        return false;
+    }
+    if(!document.isObject())
+    {
+        qWarning() << "index is invalid: json is not an object";
+        return false;
+    }
+
+    jsonObject = document.object();
+    return true;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QtGlobal>
+
+class QString;
+class QByteArray;
+class QJsonObject;
+
+//! Stores content as the pixels of a 32 bit uncompressed bitmap, as square as
+//! possible. The unused "reserved" header field holds the content length.
+//! With sync the content is on disk once this returns.
+bool writeBitmap(const QString &filename, const QByteArray &content, bool sync = false);
+//! Writes a temporary file and renames it over filename, so readers and
+//! interrupted runs see either the old or the new content. With sync that
+//! also holds after a power loss.
+bool replaceBitmap(const QString &filename, const QByteArray &content, bool sync = false);
+//! A path next to filename nobody else writes to, for a bitmap that is written
+//! there and then moved into place with commitBitmap()
+QString tempBitmapPath(const QString &filename);
+//! Renames tempFilename over filename, removes it if that fails. With sync
+//! the rename is on disk once this returns.
+bool commitBitmap(const QString &tempFilename, const QString &filename, bool sync = false);
+bool readBitmap(const QString &filename, QByteArray &content);
+
+//! Size of the header in front of the pixels
+const int bitmapHeaderSize { 54 };
+//! Fills in the header writeBitmap() writes for content of length bytes,
+//! returns the size of the zero padding behind the content
+quint32 bitmapHeader(int length, unsigned char *header);
+
+//! readBitmap() of an __index.bmp, parsed
+bool readIndex(const QString &filename, QJsonObject &jsonObject);
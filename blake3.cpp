@@ -0,0 +1,497 @@
+#include "blake3.h"
+#include "blake3_p.h"
+
+#include <QtEndian>
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+namespace blake3 {
+const std::uint32_t iv[8] {
+    0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19
+};
+
+const std::uint8_t messageSchedule[7][16] {
+    { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },
+    { 2, 6, 3, 10, 7, 0, 4, 13, 1, 11, 12, 5, 9, 14, 15, 8 },
+    { 3, 4, 10, 12, 13, 2, 7, 14, 6, 5, 9, 0, 11, 15, 8, 1 },
+    { 10, 7, 12, 9, 14, 3, 13, 15, 4, 0, 11, 2, 5, 8, 1, 6 },
+    { 12, 13, 9, 11, 15, 10, 14, 8, 7, 2, 5, 3, 0, 1, 6, 4 },
+    { 9, 14, 11, 5, 8, 12, 15, 1, 13, 3, 0, 10, 2, 6, 4, 7 },
+    { 11, 15, 5, 0, 1, 9, 8, 6, 14, 10, 2, 12, 3, 4, 7, 13 }
+};
+}
+
+using namespace blake3;
+
+namespace {
+//! below this a subtree is not worth another thread
+const std::size_t minThreadedSubtree { 64 * ChunkLength };
+
+inline std::uint32_t rotr32(std::uint32_t w, std::uint32_t c)
+{
+    return (w >> c) | (w << (32 - c));
+}
+
+inline void g(std::uint32_t *state, std::size_t a, std::size_t b, std::size_t c, std::size_t d, std::uint32_t x, std::uint32_t y)
+{
+    state[a] = state[a] + state[b] + x;
+    state[d] = rotr32(state[d] ^ state[a], 16);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 12);
+    state[a] = state[a] + state[b] + y;
+    state[d] = rotr32(state[d] ^ state[a], 8);
+    state[c] = state[c] + state[d];
+    state[b] = rotr32(state[b] ^ state[c], 7);
+}
+
+inline void roundFn(std::uint32_t state[16], const std::uint32_t *msg, std::size_t round)
+{
+    const auto *schedule = messageSchedule[round];
+
+    g(state, 0, 4, 8, 12, msg[schedule[0]], msg[schedule[1]]);
+    g(state, 1, 5, 9, 13, msg[schedule[2]], msg[schedule[3]]);
+    g(state, 2, 6, 10, 14, msg[schedule[4]], msg[schedule[5]]);
+    g(state, 3, 7, 11, 15, msg[schedule[6]], msg[schedule[7]]);
+
+    g(state, 0, 5, 10, 15, msg[schedule[8]], msg[schedule[9]]);
+    g(state, 1, 6, 11, 12, msg[schedule[10]], msg[schedule[11]]);
+    g(state, 2, 7, 8, 13, msg[schedule[12]], msg[schedule[13]]);
+    g(state, 3, 4, 9, 14, msg[schedule[14]], msg[schedule[15]]);
+}
+
+void compressInPlace(std::uint32_t cv[8], const std::uint8_t block[BlockLength], std::uint8_t blockLength,
+                     std::uint64_t counter, std::uint8_t flags)
+{
+    std::uint32_t msg[16];
+    for(int i = 0; i < 16; i++)
+        msg[i] = qFromLittleEndian<quint32>(block + 4 * i);
+
+    std::uint32_t state[16] {
+        cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+        iv[0], iv[1], iv[2], iv[3],
+        std::uint32_t(counter), std::uint32_t(counter >> 32), blockLength, flags
+    };
+
+    for(std::size_t round = 0; round < 7; round++)
+        roundFn(state, msg, round);
+
+    for(int i = 0; i < 8; i++)
+        cv[i] = state[i] ^ state[i + 8];
+}
+
+void storeCv(const std::uint32_t cv[8], std::uint8_t out[OutLength])
+{
+    for(int i = 0; i < 8; i++)
+        qToLittleEndian<quint32>(cv[i], out + 4 * i);
+}
+
+void hashOne(const std::uint8_t *input, std::size_t blocks, const std::uint32_t key[8], std::uint64_t counter,
+             std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t out[OutLength])
+{
+    std::uint32_t cv[8];
+    std::copy(key, key + 8, cv);
+
+    auto blockFlags = std::uint8_t(flags | flagsStart);
+    for(; blocks > 0; blocks--, input += BlockLength)
+    {
+        if(blocks == 1)
+            blockFlags |= flagsEnd;
+        compressInPlace(cv, input, BlockLength, counter, blockFlags);
+        blockFlags = flags;
+    }
+
+    storeCv(cv, out);
+}
+
+struct CpuKernel
+{
+    HashMany hashMany;
+    std::size_t degree;
+};
+
+CpuKernel detectKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return { hashManyAvx2, 8 };
+    if(__builtin_cpu_supports("sse4.1"))
+        return { hashManySse41, 4 };
+#endif
+    return { hashManyPortable, 1 };
+}
+
+CpuKernel &kernel()
+{
+    static CpuKernel cpuKernel = detectKernel();
+    return cpuKernel;
+}
+
+//! The chaining value or root of a node that was not compressed yet
+struct Output
+{
+    std::uint32_t cv[8];
+    std::uint8_t block[BlockLength];
+    std::uint8_t blockLength;
+    std::uint64_t counter;
+    std::uint8_t flags;
+
+    void chainingValue(std::uint8_t out[OutLength]) const
+    {
+        std::uint32_t result[8];
+        std::copy(cv, cv + 8, result);
+        compressInPlace(result, block, blockLength, counter, flags);
+        storeCv(result, out);
+    }
+
+    void rootBytes(std::uint8_t out[OutLength]) const
+    {
+        std::uint32_t result[8];
+        std::copy(cv, cv + 8, result);
+        compressInPlace(result, block, blockLength, 0, flags | Root);
+        storeCv(result, out);
+    }
+};
+
+Output parentOutput(const std::uint8_t block[BlockLength])
+{
+    Output output;
+    std::copy(iv, iv + 8, output.cv);
+    std::memcpy(output.block, block, BlockLength);
+    output.blockLength = BlockLength;
+    output.counter = 0;
+    output.flags = Parent;
+    return output;
+}
+
+std::size_t roundDownToPowerOf2(std::uint64_t x)
+{
+    return std::size_t(1) << (63 - __builtin_clzll(x | 1));
+}
+
+//! The left subtree of a node always holds the largest power of 2 full chunks that leaves something for the right
+std::size_t leftLength(std::size_t contentLength)
+{
+    const auto fullChunks = (contentLength - 1) / ChunkLength;
+    return roundDownToPowerOf2(fullChunks) * ChunkLength;
+}
+}
+
+void blake3::setKernel(HashMany hashMany, std::size_t degree)
+{
+    kernel() = { hashMany, degree };
+}
+
+void blake3::hashManyPortable(const std::uint8_t *const *inputs, std::size_t numInputs, std::size_t blocks,
+                              const std::uint32_t key[8], std::uint64_t counter, bool incrementCounter,
+                              std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out)
+{
+    for(std::size_t i = 0; i < numInputs; i++, out += OutLength)
+    {
+        hashOne(inputs[i], blocks, key, counter, flags, flagsStart, flagsEnd, out);
+        if(incrementCounter)
+            counter++;
+    }
+}
+
+namespace {
+void chunkReset(ChunkState &state, std::uint64_t chunkCounter)
+{
+    std::copy(iv, iv + 8, state.cv);
+    state.chunkCounter = chunkCounter;
+    std::memset(state.buf, 0, BlockLength);
+    state.bufLen = 0;
+    state.blocksCompressed = 0;
+}
+
+std::size_t chunkLength(const ChunkState &state)
+{
+    return BlockLength * std::size_t(state.blocksCompressed) + state.bufLen;
+}
+
+std::uint8_t chunkStartFlag(const ChunkState &state)
+{
+    return state.blocksCompressed == 0 ? ChunkStart : 0;
+}
+
+std::size_t chunkFillBuf(ChunkState &state, const std::uint8_t *input, std::size_t length)
+{
+    const auto take = std::min(BlockLength - state.bufLen, length);
+    std::memcpy(state.buf + state.bufLen, input, take);
+    state.bufLen += take;
+    return take;
+}
+
+void chunkUpdate(ChunkState &state, const std::uint8_t *input, std::size_t length)
+{
+    if(state.bufLen > 0)
+    {
+        const auto take = chunkFillBuf(state, input, length);
+        input += take;
+        length -= take;
+
+        if(length > 0)
+        {
+            compressInPlace(state.cv, state.buf, BlockLength, state.chunkCounter, chunkStartFlag(state));
+            state.blocksCompressed++;
+            state.bufLen = 0;
+            std::memset(state.buf, 0, BlockLength);
+        }
+    }
+
+    //the last block of a chunk gets the ChunkEnd flag, so it always stays buffered
+    while(length > BlockLength)
+    {
+        compressInPlace(state.cv, input, BlockLength, state.chunkCounter, chunkStartFlag(state));
+        state.blocksCompressed++;
+        input += BlockLength;
+        length -= BlockLength;
+    }
+
+    chunkFillBuf(state, input, length);
+}
+
+Output chunkOutput(const ChunkState &state)
+{
+    Output output;
+    std::copy(state.cv, state.cv + 8, output.cv);
+    std::memcpy(output.block, state.buf, BlockLength);
+    output.blockLength = state.bufLen;
+    output.counter = state.chunkCounter;
+    output.flags = chunkStartFlag(state) | ChunkEnd;
+    return output;
+}
+
+//! Hashes up to the simd degree of chunks at once, the last one may be partial
+std::size_t compressChunksParallel(const std::uint8_t *input, std::size_t length, std::uint64_t chunkCounter, std::uint8_t *out)
+{
+    const std::uint8_t *chunks[MaxSimdDegree];
+    std::size_t chunkCount = 0;
+    std::size_t position = 0;
+    for(; length - position >= ChunkLength; position += ChunkLength)
+        chunks[chunkCount++] = input + position;
+
+    kernel().hashMany(chunks, chunkCount, ChunkLength / BlockLength, iv, chunkCounter, true, 0, ChunkStart, ChunkEnd, out);
+
+    if(length == position)
+        return chunkCount;
+
+    ChunkState state;
+    chunkReset(state, chunkCounter + chunkCount);
+    chunkUpdate(state, input + position, length - position);
+    chunkOutput(state).chainingValue(out + chunkCount * OutLength);
+    return chunkCount + 1;
+}
+
+//! Hashes pairs of chaining values into parents, an odd one out is passed through
+std::size_t compressParentsParallel(const std::uint8_t *cvs, std::size_t cvCount, std::uint8_t *out)
+{
+    const std::uint8_t *parents[MaxSimdDegree];
+    std::size_t parentCount = 0;
+    for(; cvCount - 2 * parentCount >= 2; parentCount++)
+        parents[parentCount] = cvs + 2 * parentCount * OutLength;
+
+    kernel().hashMany(parents, parentCount, 1, iv, 0, false, Parent, 0, 0, out);
+
+    if(cvCount == 2 * parentCount)
+        return parentCount;
+
+    std::memcpy(out + parentCount * OutLength, cvs + 2 * parentCount * OutLength, OutLength);
+    return parentCount + 1;
+}
+
+//! Hashes a subtree of whole chunks down to at most the simd degree of chaining
+//! values (2 if the degree is 1), so the next level can be hashed wide again.
+//! Both halves of a big enough subtree are hashed at the same time.
+std::size_t compressSubtreeWide(const std::uint8_t *input, std::size_t length, std::uint64_t chunkCounter, std::uint8_t *out, int threads)
+{
+    const auto degree = kernel().degree;
+    if(length <= degree * ChunkLength)
+        return compressChunksParallel(input, length, chunkCounter, out);
+
+    const auto leftInputLength = leftLength(length);
+    const auto rightInputLength = length - leftInputLength;
+    const auto rightChunkCounter = chunkCounter + leftInputLength / ChunkLength;
+
+    std::uint8_t cvs[2 * MaxSimdDegree * OutLength];
+    //a degree of 1 would otherwise give a single chaining value on the left
+    const auto leftCvsSize = (leftInputLength > ChunkLength && degree == 1) ? 2 : degree;
+    auto *rightCvs = cvs + leftCvsSize * OutLength;
+
+    std::size_t leftCount;
+    std::size_t rightCount;
+    if(threads > 1 && rightInputLength >= minThreadedSubtree)
+    {
+        const auto leftThreads = threads / 2;
+        std::thread left([&](){ leftCount = compressSubtreeWide(input, leftInputLength, chunkCounter, cvs, leftThreads); });
+        rightCount = compressSubtreeWide(input + leftInputLength, rightInputLength, rightChunkCounter, rightCvs, threads - leftThreads);
+        left.join();
+    }
+    else
+    {
+        leftCount = compressSubtreeWide(input, leftInputLength, chunkCounter, cvs, 1);
+        rightCount = compressSubtreeWide(input + leftInputLength, rightInputLength, rightChunkCounter, rightCvs, 1);
+    }
+
+    //only possible with a degree of 1, the two children already are the result
+    if(leftCount == 1)
+    {
+        std::memcpy(out, cvs, 2 * OutLength);
+        return 2;
+    }
+
+    return compressParentsParallel(cvs, leftCount + rightCount, out);
+}
+
+//! Hashes a subtree of at least 2 chunks into the two chaining values of its root
+void compressSubtreeToParentNode(const std::uint8_t *input, std::size_t length, std::uint64_t chunkCounter, std::uint8_t out[2 * OutLength], int threads)
+{
+    std::uint8_t cvs[MaxSimdDegree * OutLength];
+    auto cvCount = compressSubtreeWide(input, length, chunkCounter, cvs, threads);
+
+    std::uint8_t parents[MaxSimdDegree * OutLength / 2];
+    while(cvCount > 2)
+    {
+        cvCount = compressParentsParallel(cvs, cvCount, parents);
+        std::memcpy(cvs, parents, cvCount * OutLength);
+    }
+
+    std::memcpy(out, cvs, 2 * OutLength);
+}
+}
+
+Blake3::Blake3(int threads) :
+    m_threads(std::max(1, threads))
+{
+    chunkReset(m_chunk, 0);
+}
+
+void Blake3::addData(const char *data, std::size_t length)
+{
+    auto input = reinterpret_cast<const std::uint8_t *>(data);
+
+    //finish the chunk a previous call started
+    if(chunkLength(m_chunk) > 0)
+    {
+        const auto take = std::min(ChunkLength - chunkLength(m_chunk), length);
+        chunkUpdate(m_chunk, input, take);
+        input += take;
+        length -= take;
+
+        if(!length)
+            return;
+
+        std::uint8_t cv[OutLength];
+        chunkOutput(m_chunk).chainingValue(cv);
+        pushCv(cv, m_chunk.chunkCounter);
+        chunkReset(m_chunk, m_chunk.chunkCounter + 1);
+    }
+
+    //hash the largest complete subtrees that fit, the last chunk is kept back
+    //because it could be the root
+    while(length > ChunkLength)
+    {
+        auto subtreeLength = roundDownToPowerOf2(length);
+        const auto countSoFar = m_chunk.chunkCounter * ChunkLength;
+        while((std::uint64_t(subtreeLength - 1) & countSoFar) != 0)
+            subtreeLength /= 2;
+
+        const auto subtreeChunks = subtreeLength / ChunkLength;
+        if(subtreeLength <= ChunkLength)
+        {
+            ChunkState state;
+            chunkReset(state, m_chunk.chunkCounter);
+            chunkUpdate(state, input, subtreeLength);
+
+            std::uint8_t cv[OutLength];
+            chunkOutput(state).chainingValue(cv);
+            pushCv(cv, state.chunkCounter);
+        }
+        else
+        {
+            std::uint8_t cvPair[2 * OutLength];
+            compressSubtreeToParentNode(input, subtreeLength, m_chunk.chunkCounter, cvPair, m_threads);
+            pushCv(cvPair, m_chunk.chunkCounter);
+            pushCv(cvPair + OutLength, m_chunk.chunkCounter + subtreeChunks / 2);
+        }
+
+        m_chunk.chunkCounter += subtreeChunks;
+        input += subtreeLength;
+        length -= subtreeLength;
+    }
+
+    if(length > 0)
+    {
+        chunkUpdate(m_chunk, input, length);
+        mergeCvStack(m_chunk.chunkCounter);
+    }
+}
+
+QByteArray Blake3::result() const
+{
+    QByteArray result(OutLength, Qt::Uninitialized);
+    auto out = reinterpret_cast<std::uint8_t *>(result.data());
+
+    if(!m_cvStackLen)
+    {
+        chunkOutput(m_chunk).rootBytes(out);
+        return result;
+    }
+
+    //fold the stack from the right, the current chunk (if any) is the rightmost node
+    Output output;
+    std::size_t cvsRemaining;
+    if(chunkLength(m_chunk) > 0)
+    {
+        cvsRemaining = m_cvStackLen;
+        output = chunkOutput(m_chunk);
+    }
+    else
+    {
+        cvsRemaining = m_cvStackLen - 2;
+        output = parentOutput(m_cvStack + cvsRemaining * OutLength);
+    }
+
+    while(cvsRemaining > 0)
+    {
+        cvsRemaining--;
+
+        std::uint8_t parentBlock[BlockLength];
+        std::memcpy(parentBlock, m_cvStack + cvsRemaining * OutLength, OutLength);
+        output.chainingValue(parentBlock + OutLength);
+        output = parentOutput(parentBlock);
+    }
+
+    output.rootBytes(out);
+    return result;
+}
+
+QByteArray Blake3::hash(const char *data, std::size_t length, int threads)
+{
+    Blake3 hasher(threads);
+    hasher.addData(data, length);
+    return hasher.result();
+}
+
+void Blake3::pushCv(const std::uint8_t cv[OutLength], std::uint64_t chunkCounter)
+{
+    mergeCvStack(chunkCounter);
+    std::memcpy(m_cvStack + m_cvStackLen * OutLength, cv, OutLength);
+    m_cvStackLen++;
+}
+
+//! Every completed subtree sits on the stack, one per set bit of the number of
+//! chunks so far. Merging lazily keeps the last chaining value on the stack
+//! until it is clear whether it is the root.
+void Blake3::mergeCvStack(std::uint64_t totalLength)
+{
+    const auto postMergeStackLen = std::size_t(__builtin_popcountll(totalLength));
+    while(m_cvStackLen > postMergeStackLen)
+    {
+        auto *parentNode = m_cvStack + (m_cvStackLen - 2) * OutLength;
+        parentOutput(parentNode).chainingValue(parentNode);
+        m_cvStackLen--;
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QByteArray>
+#include <QtGlobal>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace blake3 {
+//! the chunk currently being hashed, its last block stays buffered until it is clear whether it is the root
+struct ChunkState
+{
+    std::uint32_t cv[8];
+    std::uint64_t chunkCounter;
+    std::uint8_t buf[64];
+    std::uint8_t bufLen;
+    std::uint8_t blocksCompressed;
+};
+}
+
+//! BLAKE3 with 256 bit output, see https://github.com/BLAKE3-team/BLAKE3-specs
+//!
+//! Full 1 KiB chunks are compressed 8 (AVX2) or 4 (SSE4.1) at a time, whichever
+//! the cpu supports. BLAKE3 is a tree, so big updates are also split into
+//! subtrees hashed on up to threads cores and only their roots get combined.
+class Blake3
+{
+public:
+    explicit Blake3(int threads = 1);
+
+    void addData(const char *data, std::size_t length);
+    void addData(const QByteArray &data) { addData(data.constData(), data.size()); }
+
+    QByteArray result() const;
+
+    static QByteArray hash(const char *data, std::size_t length, int threads = 1);
+    static QByteArray hash(const QByteArray &data, int threads = 1) { return hash(data.constData(), data.size(), threads); }
+
+private:
+    void pushCv(const std::uint8_t cv[32], std::uint64_t chunkCounter);
+    void mergeCvStack(std::uint64_t totalLength);
+
+    int m_threads;
+    blake3::ChunkState m_chunk;
+    //! one chaining value per level of the tree, 2^54 chunks are more than enough
+    std::uint8_t m_cvStack[55 * 32];
+    std::uint8_t m_cvStackLen { 0 };
+};
@@ -0,0 +1,227 @@
+// Compresses 8 inputs at once, one per 32 bit lane. Built with -mavx2 and
+// only called after checking the cpu supports it.
+
+#include "blake3_p.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+using namespace blake3;
+
+namespace {
+using Vec = __m256i;
+
+inline Vec loadu(const std::uint8_t *src) { return _mm256_loadu_si256(reinterpret_cast<const Vec *>(src)); }
+inline void storeu(Vec src, std::uint8_t *dest) { _mm256_storeu_si256(reinterpret_cast<Vec *>(dest), src); }
+inline Vec set1(std::uint32_t x) { return _mm256_set1_epi32(std::int32_t(x)); }
+inline Vec add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+inline Vec xorv(Vec a, Vec b) { return _mm256_xor_si256(a, b); }
+inline Vec rot16(Vec x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2,
+                                                  13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2));
+}
+inline Vec rot12(Vec x) { return _mm256_or_si256(_mm256_srli_epi32(x, 12), _mm256_slli_epi32(x, 32 - 12)); }
+inline Vec rot8(Vec x)
+{
+    return _mm256_shuffle_epi8(x, _mm256_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1,
+                                                  12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1));
+}
+inline Vec rot7(Vec x) { return _mm256_or_si256(_mm256_srli_epi32(x, 7), _mm256_slli_epi32(x, 32 - 7)); }
+
+inline void roundFn(Vec v[16], const Vec m[16], std::size_t r)
+{
+    const auto *s = messageSchedule[r];
+
+    //columns
+    v[0] = add(v[0], m[s[0]]);
+    v[1] = add(v[1], m[s[2]]);
+    v[2] = add(v[2], m[s[4]]);
+    v[3] = add(v[3], m[s[6]]);
+    v[0] = add(v[0], v[4]);
+    v[1] = add(v[1], v[5]);
+    v[2] = add(v[2], v[6]);
+    v[3] = add(v[3], v[7]);
+    v[12] = rot16(xorv(v[12], v[0]));
+    v[13] = rot16(xorv(v[13], v[1]));
+    v[14] = rot16(xorv(v[14], v[2]));
+    v[15] = rot16(xorv(v[15], v[3]));
+    v[8] = add(v[8], v[12]);
+    v[9] = add(v[9], v[13]);
+    v[10] = add(v[10], v[14]);
+    v[11] = add(v[11], v[15]);
+    v[4] = rot12(xorv(v[4], v[8]));
+    v[5] = rot12(xorv(v[5], v[9]));
+    v[6] = rot12(xorv(v[6], v[10]));
+    v[7] = rot12(xorv(v[7], v[11]));
+    v[0] = add(v[0], m[s[1]]);
+    v[1] = add(v[1], m[s[3]]);
+    v[2] = add(v[2], m[s[5]]);
+    v[3] = add(v[3], m[s[7]]);
+    v[0] = add(v[0], v[4]);
+    v[1] = add(v[1], v[5]);
+    v[2] = add(v[2], v[6]);
+    v[3] = add(v[3], v[7]);
+    v[12] = rot8(xorv(v[12], v[0]));
+    v[13] = rot8(xorv(v[13], v[1]));
+    v[14] = rot8(xorv(v[14], v[2]));
+    v[15] = rot8(xorv(v[15], v[3]));
+    v[8] = add(v[8], v[12]);
+    v[9] = add(v[9], v[13]);
+    v[10] = add(v[10], v[14]);
+    v[11] = add(v[11], v[15]);
+    v[4] = rot7(xorv(v[4], v[8]));
+    v[5] = rot7(xorv(v[5], v[9]));
+    v[6] = rot7(xorv(v[6], v[10]));
+    v[7] = rot7(xorv(v[7], v[11]));
+
+    //diagonals
+    v[0] = add(v[0], m[s[8]]);
+    v[1] = add(v[1], m[s[10]]);
+    v[2] = add(v[2], m[s[12]]);
+    v[3] = add(v[3], m[s[14]]);
+    v[0] = add(v[0], v[5]);
+    v[1] = add(v[1], v[6]);
+    v[2] = add(v[2], v[7]);
+    v[3] = add(v[3], v[4]);
+    v[15] = rot16(xorv(v[15], v[0]));
+    v[12] = rot16(xorv(v[12], v[1]));
+    v[13] = rot16(xorv(v[13], v[2]));
+    v[14] = rot16(xorv(v[14], v[3]));
+    v[10] = add(v[10], v[15]);
+    v[11] = add(v[11], v[12]);
+    v[8] = add(v[8], v[13]);
+    v[9] = add(v[9], v[14]);
+    v[5] = rot12(xorv(v[5], v[10]));
+    v[6] = rot12(xorv(v[6], v[11]));
+    v[7] = rot12(xorv(v[7], v[8]));
+    v[4] = rot12(xorv(v[4], v[9]));
+    v[0] = add(v[0], m[s[9]]);
+    v[1] = add(v[1], m[s[11]]);
+    v[2] = add(v[2], m[s[13]]);
+    v[3] = add(v[3], m[s[15]]);
+    v[0] = add(v[0], v[5]);
+    v[1] = add(v[1], v[6]);
+    v[2] = add(v[2], v[7]);
+    v[3] = add(v[3], v[4]);
+    v[15] = rot8(xorv(v[15], v[0]));
+    v[12] = rot8(xorv(v[12], v[1]));
+    v[13] = rot8(xorv(v[13], v[2]));
+    v[14] = rot8(xorv(v[14], v[3]));
+    v[10] = add(v[10], v[15]);
+    v[11] = add(v[11], v[12]);
+    v[8] = add(v[8], v[13]);
+    v[9] = add(v[9], v[14]);
+    v[5] = rot7(xorv(v[5], v[10]));
+    v[6] = rot7(xorv(v[6], v[11]));
+    v[7] = rot7(xorv(v[7], v[8]));
+    v[4] = rot7(xorv(v[4], v[9]));
+}
+
+inline void transposeVecs(Vec vecs[8])
+{
+    const auto ab0145 = _mm256_unpacklo_epi32(vecs[0], vecs[1]);
+    const auto ab2367 = _mm256_unpackhi_epi32(vecs[0], vecs[1]);
+    const auto cd0145 = _mm256_unpacklo_epi32(vecs[2], vecs[3]);
+    const auto cd2367 = _mm256_unpackhi_epi32(vecs[2], vecs[3]);
+    const auto ef0145 = _mm256_unpacklo_epi32(vecs[4], vecs[5]);
+    const auto ef2367 = _mm256_unpackhi_epi32(vecs[4], vecs[5]);
+    const auto gh0145 = _mm256_unpacklo_epi32(vecs[6], vecs[7]);
+    const auto gh2367 = _mm256_unpackhi_epi32(vecs[6], vecs[7]);
+
+    const auto abcd04 = _mm256_unpacklo_epi64(ab0145, cd0145);
+    const auto abcd15 = _mm256_unpackhi_epi64(ab0145, cd0145);
+    const auto abcd26 = _mm256_unpacklo_epi64(ab2367, cd2367);
+    const auto abcd37 = _mm256_unpackhi_epi64(ab2367, cd2367);
+    const auto efgh04 = _mm256_unpacklo_epi64(ef0145, gh0145);
+    const auto efgh15 = _mm256_unpackhi_epi64(ef0145, gh0145);
+    const auto efgh26 = _mm256_unpacklo_epi64(ef2367, gh2367);
+    const auto efgh37 = _mm256_unpackhi_epi64(ef2367, gh2367);
+
+    vecs[0] = _mm256_permute2x128_si256(abcd04, efgh04, 0x20);
+    vecs[1] = _mm256_permute2x128_si256(abcd15, efgh15, 0x20);
+    vecs[2] = _mm256_permute2x128_si256(abcd26, efgh26, 0x20);
+    vecs[3] = _mm256_permute2x128_si256(abcd37, efgh37, 0x20);
+    vecs[4] = _mm256_permute2x128_si256(abcd04, efgh04, 0x31);
+    vecs[5] = _mm256_permute2x128_si256(abcd15, efgh15, 0x31);
+    vecs[6] = _mm256_permute2x128_si256(abcd26, efgh26, 0x31);
+    vecs[7] = _mm256_permute2x128_si256(abcd37, efgh37, 0x31);
+}
+
+//! m[i] gets message word i of all 8 inputs
+inline void transposeMessage(const std::uint8_t *const *inputs, std::size_t blockOffset, Vec m[16])
+{
+    for(int i = 0; i < 2; i++)
+        for(int input = 0; input < 8; input++)
+            m[8 * i + input] = loadu(inputs[input] + blockOffset + 32 * i);
+
+    transposeVecs(m);
+    transposeVecs(m + 8);
+}
+
+void hash8(const std::uint8_t *const *inputs, std::size_t blocks, const std::uint32_t key[8], std::uint64_t counter,
+           bool incrementCounter, std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out)
+{
+    Vec h[8];
+    for(int i = 0; i < 8; i++)
+        h[i] = set1(key[i]);
+
+    alignas(32) std::uint32_t counterLow[8];
+    alignas(32) std::uint32_t counterHigh[8];
+    for(int i = 0; i < 8; i++)
+    {
+        const auto inputCounter = counter + (incrementCounter ? i : 0);
+        counterLow[i] = std::uint32_t(inputCounter);
+        counterHigh[i] = std::uint32_t(inputCounter >> 32);
+    }
+    const auto counterLowVec = _mm256_load_si256(reinterpret_cast<const Vec *>(counterLow));
+    const auto counterHighVec = _mm256_load_si256(reinterpret_cast<const Vec *>(counterHigh));
+
+    auto blockFlags = std::uint8_t(flags | flagsStart);
+    for(std::size_t block = 0; block < blocks; block++)
+    {
+        if(block + 1 == blocks)
+            blockFlags |= flagsEnd;
+
+        Vec m[16];
+        transposeMessage(inputs, block * BlockLength, m);
+
+        Vec v[16] {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            set1(iv[0]), set1(iv[1]), set1(iv[2]), set1(iv[3]),
+            counterLowVec, counterHighVec, set1(BlockLength), set1(blockFlags)
+        };
+
+        for(std::size_t r = 0; r < 7; r++)
+            roundFn(v, m, r);
+
+        for(int i = 0; i < 8; i++)
+            h[i] = xorv(v[i], v[i + 8]);
+
+        blockFlags = flags;
+    }
+
+    //h[i] now holds the whole output of input i
+    transposeVecs(h);
+    for(int input = 0; input < 8; input++)
+        storeu(h[input], out + input * OutLength);
+}
+}
+
+void blake3::hashManyAvx2(const std::uint8_t *const *inputs, std::size_t numInputs, std::size_t blocks,
+                          const std::uint32_t key[8], std::uint64_t counter, bool incrementCounter,
+                          std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out)
+{
+    for(; numInputs >= 8; numInputs -= 8, inputs += 8, out += 8 * OutLength)
+    {
+        hash8(inputs, blocks, key, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+        if(incrementCounter)
+            counter += 8;
+    }
+
+    //the rest still gets 4 lanes, the avx2 check implies sse4.1
+    hashManySse41(inputs, numInputs, blocks, key, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+}
+
+#endif
@@ -0,0 +1,45 @@
+#pragma once
+
+// Shared between the portable and the SIMD BLAKE3 code, not part of the api.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace blake3 {
+enum : std::size_t { BlockLength = 64, ChunkLength = 1024, OutLength = 32, MaxSimdDegree = 8 };
+
+enum Flags : std::uint8_t {
+    ChunkStart = 1,
+    ChunkEnd = 2,
+    Parent = 4,
+    Root = 8
+};
+
+extern const std::uint32_t iv[8];
+extern const std::uint8_t messageSchedule[7][16];
+
+//! Hashes numInputs inputs of blocks full blocks each and writes one chaining value per input to out.
+//! Chunks pass incrementCounter so input i is hashed with counter + i, parents always use counter 0.
+using HashMany = void (*)(const std::uint8_t *const *inputs, std::size_t numInputs, std::size_t blocks,
+                          const std::uint32_t key[8], std::uint64_t counter, bool incrementCounter,
+                          std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out);
+
+//! Replaces the kernel picked for the cpu, so the tests can run every kernel
+//! the cpu has through the whole hasher. degree is how many inputs it hashes
+//! at once. Not while anything is hashing.
+void setKernel(HashMany hashMany, std::size_t degree);
+
+void hashManyPortable(const std::uint8_t *const *inputs, std::size_t numInputs, std::size_t blocks,
+                      const std::uint32_t key[8], std::uint64_t counter, bool incrementCounter,
+                      std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out);
+
+#if defined(__x86_64__) || defined(__i386__)
+void hashManySse41(const std::uint8_t *const *inputs, std::size_t numInputs, std::size_t blocks,
+                   const std::uint32_t key[8], std::uint64_t counter, bool incrementCounter,
+                   std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out);
+
+void hashManyAvx2(const std::uint8_t *const *inputs, std::size_t numInputs, std::size_t blocks,
+                  const std::uint32_t key[8], std::uint64_t counter, bool incrementCounter,
+                  std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out);
+#endif
+}
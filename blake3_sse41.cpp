@@ -0,0 +1,205 @@
+// Compresses 4 inputs at once, one per 32 bit lane. Built with -msse4.1 and
+// only called after checking the cpu supports it.
+
+#include "blake3_p.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+using namespace blake3;
+
+namespace {
+using Vec = __m128i;
+
+inline Vec loadu(const std::uint8_t *src) { return _mm_loadu_si128(reinterpret_cast<const Vec *>(src)); }
+inline void storeu(Vec src, std::uint8_t *dest) { _mm_storeu_si128(reinterpret_cast<Vec *>(dest), src); }
+inline Vec set1(std::uint32_t x) { return _mm_set1_epi32(std::int32_t(x)); }
+inline Vec add(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+inline Vec xorv(Vec a, Vec b) { return _mm_xor_si128(a, b); }
+inline Vec rot16(Vec x) { return _mm_shuffle_epi8(x, _mm_set_epi8(13, 12, 15, 14, 9, 8, 11, 10, 5, 4, 7, 6, 1, 0, 3, 2)); }
+inline Vec rot12(Vec x) { return _mm_or_si128(_mm_srli_epi32(x, 12), _mm_slli_epi32(x, 32 - 12)); }
+inline Vec rot8(Vec x) { return _mm_shuffle_epi8(x, _mm_set_epi8(12, 15, 14, 13, 8, 11, 10, 9, 4, 7, 6, 5, 0, 3, 2, 1)); }
+inline Vec rot7(Vec x) { return _mm_or_si128(_mm_srli_epi32(x, 7), _mm_slli_epi32(x, 32 - 7)); }
+
+inline void roundFn(Vec v[16], const Vec m[16], std::size_t r)
+{
+    const auto *s = messageSchedule[r];
+
+    //columns
+    v[0] = add(v[0], m[s[0]]);
+    v[1] = add(v[1], m[s[2]]);
+    v[2] = add(v[2], m[s[4]]);
+    v[3] = add(v[3], m[s[6]]);
+    v[0] = add(v[0], v[4]);
+    v[1] = add(v[1], v[5]);
+    v[2] = add(v[2], v[6]);
+    v[3] = add(v[3], v[7]);
+    v[12] = rot16(xorv(v[12], v[0]));
+    v[13] = rot16(xorv(v[13], v[1]));
+    v[14] = rot16(xorv(v[14], v[2]));
+    v[15] = rot16(xorv(v[15], v[3]));
+    v[8] = add(v[8], v[12]);
+    v[9] = add(v[9], v[13]);
+    v[10] = add(v[10], v[14]);
+    v[11] = add(v[11], v[15]);
+    v[4] = rot12(xorv(v[4], v[8]));
+    v[5] = rot12(xorv(v[5], v[9]));
+    v[6] = rot12(xorv(v[6], v[10]));
+    v[7] = rot12(xorv(v[7], v[11]));
+    v[0] = add(v[0], m[s[1]]);
+    v[1] = add(v[1], m[s[3]]);
+    v[2] = add(v[2], m[s[5]]);
+    v[3] = add(v[3], m[s[7]]);
+    v[0] = add(v[0], v[4]);
+    v[1] = add(v[1], v[5]);
+    v[2] = add(v[2], v[6]);
+    v[3] = add(v[3], v[7]);
+    v[12] = rot8(xorv(v[12], v[0]));
+    v[13] = rot8(xorv(v[13], v[1]));
+    v[14] = rot8(xorv(v[14], v[2]));
+    v[15] = rot8(xorv(v[15], v[3]));
+    v[8] = add(v[8], v[12]);
+    v[9] = add(v[9], v[13]);
+    v[10] = add(v[10], v[14]);
+    v[11] = add(v[11], v[15]);
+    v[4] = rot7(xorv(v[4], v[8]));
+    v[5] = rot7(xorv(v[5], v[9]));
+    v[6] = rot7(xorv(v[6], v[10]));
+    v[7] = rot7(xorv(v[7], v[11]));
+
+    //diagonals
+    v[0] = add(v[0], m[s[8]]);
+    v[1] = add(v[1], m[s[10]]);
+    v[2] = add(v[2], m[s[12]]);
+    v[3] = add(v[3], m[s[14]]);
+    v[0] = add(v[0], v[5]);
+    v[1] = add(v[1], v[6]);
+    v[2] = add(v[2], v[7]);
+    v[3] = add(v[3], v[4]);
+    v[15] = rot16(xorv(v[15], v[0]));
+    v[12] = rot16(xorv(v[12], v[1]));
+    v[13] = rot16(xorv(v[13], v[2]));
+    v[14] = rot16(xorv(v[14], v[3]));
+    v[10] = add(v[10], v[15]);
+    v[11] = add(v[11], v[12]);
+    v[8] = add(v[8], v[13]);
+    v[9] = add(v[9], v[14]);
+    v[5] = rot12(xorv(v[5], v[10]));
+    v[6] = rot12(xorv(v[6], v[11]));
+    v[7] = rot12(xorv(v[7], v[8]));
+    v[4] = rot12(xorv(v[4], v[9]));
+    v[0] = add(v[0], m[s[9]]);
+    v[1] = add(v[1], m[s[11]]);
+    v[2] = add(v[2], m[s[13]]);
+    v[3] = add(v[3], m[s[15]]);
+    v[0] = add(v[0], v[5]);
+    v[1] = add(v[1], v[6]);
+    v[2] = add(v[2], v[7]);
+    v[3] = add(v[3], v[4]);
+    v[15] = rot8(xorv(v[15], v[0]));
+    v[12] = rot8(xorv(v[12], v[1]));
+    v[13] = rot8(xorv(v[13], v[2]));
+    v[14] = rot8(xorv(v[14], v[3]));
+    v[10] = add(v[10], v[15]);
+    v[11] = add(v[11], v[12]);
+    v[8] = add(v[8], v[13]);
+    v[9] = add(v[9], v[14]);
+    v[5] = rot7(xorv(v[5], v[10]));
+    v[6] = rot7(xorv(v[6], v[11]));
+    v[7] = rot7(xorv(v[7], v[8]));
+    v[4] = rot7(xorv(v[4], v[9]));
+}
+
+inline void transposeVecs(Vec vecs[4])
+{
+    const auto ab01 = _mm_unpacklo_epi32(vecs[0], vecs[1]);
+    const auto ab23 = _mm_unpackhi_epi32(vecs[0], vecs[1]);
+    const auto cd01 = _mm_unpacklo_epi32(vecs[2], vecs[3]);
+    const auto cd23 = _mm_unpackhi_epi32(vecs[2], vecs[3]);
+
+    vecs[0] = _mm_unpacklo_epi64(ab01, cd01);
+    vecs[1] = _mm_unpackhi_epi64(ab01, cd01);
+    vecs[2] = _mm_unpacklo_epi64(ab23, cd23);
+    vecs[3] = _mm_unpackhi_epi64(ab23, cd23);
+}
+
+//! m[i] gets message word i of all 4 inputs
+inline void transposeMessage(const std::uint8_t *const *inputs, std::size_t blockOffset, Vec m[16])
+{
+    for(int i = 0; i < 4; i++)
+        for(int input = 0; input < 4; input++)
+            m[4 * i + input] = loadu(inputs[input] + blockOffset + 16 * i);
+
+    for(int i = 0; i < 4; i++)
+        transposeVecs(m + 4 * i);
+}
+
+void hash4(const std::uint8_t *const *inputs, std::size_t blocks, const std::uint32_t key[8], std::uint64_t counter,
+           bool incrementCounter, std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out)
+{
+    Vec h[8];
+    for(int i = 0; i < 8; i++)
+        h[i] = set1(key[i]);
+
+    alignas(16) std::uint32_t counterLow[4];
+    alignas(16) std::uint32_t counterHigh[4];
+    for(int i = 0; i < 4; i++)
+    {
+        const auto inputCounter = counter + (incrementCounter ? i : 0);
+        counterLow[i] = std::uint32_t(inputCounter);
+        counterHigh[i] = std::uint32_t(inputCounter >> 32);
+    }
+    const auto counterLowVec = _mm_load_si128(reinterpret_cast<const Vec *>(counterLow));
+    const auto counterHighVec = _mm_load_si128(reinterpret_cast<const Vec *>(counterHigh));
+
+    auto blockFlags = std::uint8_t(flags | flagsStart);
+    for(std::size_t block = 0; block < blocks; block++)
+    {
+        if(block + 1 == blocks)
+            blockFlags |= flagsEnd;
+
+        Vec m[16];
+        transposeMessage(inputs, block * BlockLength, m);
+
+        Vec v[16] {
+            h[0], h[1], h[2], h[3], h[4], h[5], h[6], h[7],
+            set1(iv[0]), set1(iv[1]), set1(iv[2]), set1(iv[3]),
+            counterLowVec, counterHighVec, set1(BlockLength), set1(blockFlags)
+        };
+
+        for(std::size_t r = 0; r < 7; r++)
+            roundFn(v, m, r);
+
+        for(int i = 0; i < 8; i++)
+            h[i] = xorv(v[i], v[i + 8]);
+
+        blockFlags = flags;
+    }
+
+    //h[0..3] now hold the first and h[4..7] the second half of every output
+    transposeVecs(h);
+    transposeVecs(h + 4);
+    for(int input = 0; input < 4; input++)
+    {
+        storeu(h[input], out + input * OutLength);
+        storeu(h[input + 4], out + input * OutLength + 16);
+    }
+}
+}
+
+void blake3::hashManySse41(const std::uint8_t *const *inputs, std::size_t numInputs, std::size_t blocks,
+                           const std::uint32_t key[8], std::uint64_t counter, bool incrementCounter,
+                           std::uint8_t flags, std::uint8_t flagsStart, std::uint8_t flagsEnd, std::uint8_t *out)
+{
+    for(; numInputs >= 4; numInputs -= 4, inputs += 4, out += 4 * OutLength)
+    {
+        hash4(inputs, blocks, key, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+        if(incrementCounter)
+            counter += 4;
+    }
+
+    hashManyPortable(inputs, numInputs, blocks, key, counter, incrementCounter, flags, flagsStart, flagsEnd, out);
+}
+
+#endif
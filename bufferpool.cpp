@@ -0,0 +1,68 @@
+#include "bufferpool.h"
+
+#include <QDebug>
+
+#include <cstdlib>
+
+namespace {
+const qint64 alignment { 4096 };
+}
+
+BufferPool::BufferPool(qint64 blockSize, qint64 budget) :
+    m_blockSize((blockSize + alignment - 1) / alignment * alignment),
+    m_maxBlocks(budget ? int(qMax<qint64>(1, budget / m_blockSize)) : 0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    //every lease has to be gone by now, they point back here
+    Q_ASSERT(int(m_free.size()) == m_allocated);
+
+    for(const auto block : m_free)
+        std::free(block);
+}
+
+BufferPool::Lease BufferPool::acquire()
+{
+    char *block = nullptr;
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_released.wait(lock, [this](){ return !m_free.empty() || !m_maxBlocks || m_allocated < m_maxBlocks; });
+
+        if(!m_free.empty())
+        {
+            block = m_free.back();
+            m_free.pop_back();
+        }
+        else
+            m_allocated++;
+    }
+
+    if(!block)
+    {
+        block = static_cast<char *>(std::aligned_alloc(alignment, m_blockSize));
+        if(!block)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_allocated--;
+            }
+            m_released.notify_one();
+            qWarning() << "could not allocate buffer of" << m_blockSize << "bytes";
+            return Lease();
+        }
+    }
+
+    return Lease(block, [this](char *block){ release(block); });
+}
+
+void BufferPool::release(char *block)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_free.push_back(block);
+    }
+    m_released.notify_one();
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QtGlobal>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+//! Recycles the chunk buffers of spreadParts() within a fixed memory budget,
+//! shared by every job. Blocks are page aligned (good for O_DIRECT) and all
+//! of one size, so a returned block fits the next request as is. Once the
+//! budget is handed out acquire() waits for a block to come back instead of
+//! allocating, which makes the peak of what the pipelines hold predictable.
+//!
+//! Only the chunks count against the budget. What the chunker still holds
+//! for content defined chunking and compressed copies come on top.
+class BufferPool
+{
+    Q_DISABLE_COPY(BufferPool)
+
+public:
+    //! Goes back to the pool with its last copy
+    using Lease = std::shared_ptr<char>;
+
+    //! budget 0 is unlimited, blocks are still recycled. Anything below one
+    //! block gets one block, less would never let a pipeline move.
+    BufferPool(qint64 blockSize, qint64 budget);
+    ~BufferPool();
+
+    qint64 blockSize() const { return m_blockSize; }
+
+    //! Waits while the budget is used up. Empty if the system is out of memory
+    //! even though the budget is not, pipeline threads have nobody to catch
+    //! an exception.
+    Lease acquire();
+
+private:
+    void release(char *block);
+
+    const qint64 m_blockSize;
+    //! 0 is unlimited
+    const int m_maxBlocks;
+
+    int m_allocated { 0 };
+    std::vector<char *> m_free;
+    std::mutex m_mutex;
+    std::condition_variable m_released;
+};
@@ -0,0 +1,148 @@
+#include "changelog.h"
+
+#include <QDateTime>
+#include <QDebug>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+ChangeLog::ChangeLog(const QString &rootPath, const QString &logPath, const QString &outboxPath) :
+    m_root(rootPath),
+    m_file(logPath),
+    m_outboxPath(outboxPath)
+{
+}
+
+bool ChangeLog::open()
+{
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qWarning() << "could not open change log" << m_file.errorString();
+        return false;
+    }
+
+    if(!m_outboxPath.isEmpty() && !QDir().mkpath(m_outboxPath))
+    {
+        qWarning() << "could not create outbox" << m_outboxPath;
+        return false;
+    }
+
+    QJsonObject line;
+    line[QStringLiteral("op")] = QStringLiteral("started");
+    line[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    return append(line);
+}
+
+bool ChangeLog::finish()
+{
+    QJsonObject line;
+    line[QStringLiteral("op")] = QStringLiteral("finished");
+    line[QStringLiteral("time")] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    if(!append(line))
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(fdatasync(m_file.handle()) == -1)
+    {
+        qWarning() << "could not sync change log" << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+bool ChangeLog::created(const QString &path)
+{
+    const auto relative = relativePath(path);
+
+    //linked before it is logged, whoever follows the log finds it in the outbox
+    if(!m_outboxPath.isEmpty() && !QDir::isAbsolutePath(relative))
+    {
+        const auto outboxFile = QDir(m_outboxPath).absoluteFilePath(relative);
+        if(!QDir().mkpath(QFileInfo(outboxFile).absolutePath()))
+        {
+            qWarning() << "could not create outbox dir" << QFileInfo(outboxFile).absolutePath();
+            return false;
+        }
+
+        //replaced in place, the outbox has to point to the new file
+        if(::unlink(QFile::encodeName(outboxFile).constData()) == -1 && errno != ENOENT)
+        {
+            qWarning() << "could not unlink from outbox" << outboxFile << strerror(errno);
+            return false;
+        }
+
+        if(::link(QFile::encodeName(path).constData(), QFile::encodeName(outboxFile).constData()) == -1)
+        {
+            qWarning() << "could not link into outbox" << outboxFile << strerror(errno);
+            return false;
+        }
+    }
+
+    QJsonObject line;
+    line[QStringLiteral("op")] = QStringLiteral("created");
+    line[QStringLiteral("path")] = relative;
+    return append(line);
+}
+
+bool ChangeLog::removed(const QString &path)
+{
+    const auto relative = relativePath(path);
+
+    if(!m_outboxPath.isEmpty() && !QDir::isAbsolutePath(relative))
+    {
+        const auto outboxFile = QDir(m_outboxPath).absoluteFilePath(relative);
+        if(::unlink(QFile::encodeName(outboxFile).constData()) == -1 && errno != ENOENT)
+        {
+            qWarning() << "could not unlink from outbox" << outboxFile << strerror(errno);
+            return false;
+        }
+    }
+
+    QJsonObject line;
+    line[QStringLiteral("op")] = QStringLiteral("removed");
+    line[QStringLiteral("path")] = relative;
+    return append(line);
+}
+
+bool ChangeLog::removedTree(const QString &path)
+{
+    const auto relative = relativePath(path);
+
+    if(!m_outboxPath.isEmpty() && !QDir::isAbsolutePath(relative) &&
+       !QDir(QDir(m_outboxPath).absoluteFilePath(relative)).removeRecursively())
+    {
+        qWarning() << "could not remove from outbox" << QDir(m_outboxPath).absoluteFilePath(relative);
+        return false;
+    }
+
+    QJsonObject line;
+    line[QStringLiteral("op")] = QStringLiteral("removedTree");
+    line[QStringLiteral("path")] = relative;
+    return append(line);
+}
+
+QString ChangeLog::relativePath(const QString &path) const
+{
+    const auto relative = m_root.relativeFilePath(path);
+    return relative == QStringLiteral("..") || relative.startsWith(QStringLiteral("../")) ? QDir::cleanPath(path) : relative;
+}
+
+bool ChangeLog::append(const QJsonObject &line)
+{
+    const auto content = QJsonDocument(line).toJson(QJsonDocument::Compact) + '\n';
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if(m_file.write(content) != content.size() || !m_file.flush())
+    {
+        qWarning() << "could not write change log" << m_file.errorString();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QDir>
+#include <QFile>
+#include <QString>
+
+#include <mutex>
+
+class QJsonObject;
+
+//! Streams what a spread created and removed below the target, so an uploader
+//! only has to look at what changed instead of diffing the whole target. One
+//! compact json object per line, appended and flushed as the run decides:
+//!
+//!     {"op":"created","path":"a/__index.bmp"}
+//!     {"op":"removed","path":"a/1b2c.bmp"}
+//!     {"op":"removedTree","path":"a/b"}
+//!
+//! Paths are relative to the target root, or absolute if they are outside of
+//! it (an object store elsewhere). created also covers a bitmap replaced in
+//! place. A run starts with a "started" line and ends with "finished" if it
+//! succeeded.
+//!
+//! With an outbox every created bitmap below the root is also hardlinked into
+//! it under the same relative path, and unlinked again if the run removes it.
+//! The uploader empties it as it goes, so it only ever holds what is new. It
+//! has to be on the same filesystem as the target.
+class ChangeLog
+{
+    Q_DISABLE_COPY(ChangeLog)
+
+public:
+    ChangeLog(const QString &rootPath, const QString &logPath, const QString &outboxPath = QString());
+
+    bool open();
+    //! Marks the run complete and syncs the log
+    bool finish();
+
+    bool created(const QString &path);
+    bool removed(const QString &path);
+    //! A whole node directory, with everything below it
+    bool removedTree(const QString &path);
+
+private:
+    QString relativePath(const QString &path) const;
+    bool append(const QJsonObject &line);
+
+    const QDir m_root;
+    QFile m_file;
+    const QString m_outboxPath;
+    std::mutex m_mutex;
+};
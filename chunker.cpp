@@ -0,0 +1,77 @@
+#include "chunker.h"
+
+#include <array>
+#include <cmath>
+
+namespace {
+//! The table must never change, otherwise existing trees get cut differently
+//! and every part would be written again.
+std::array<quint64, 256> makeGear()
+{
+    std::array<quint64, 256> gear;
+
+    //splitmix64
+    quint64 state = 0x50494353594E43ull;
+    for(auto &value : gear)
+    {
+        state += 0x9E3779B97F4A7C15ull;
+        auto z = state;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+        value = z ^ (z >> 31);
+    }
+
+    return gear;
+}
+
+const std::array<quint64, 256> gear = makeGear();
+
+//! The gear hash shifts left, so only the top bits have seen the last 64 bytes
+quint64 topBits(int bits)
+{
+    return bits <= 0 ? 0 : ~0ull << (64 - qMin(bits, 64));
+}
+}
+
+Chunker::Chunker(int minSize, int averageSize, int maxSize) :
+    m_minSize(minSize),
+    m_averageSize(averageSize),
+    m_maxSize(maxSize)
+{
+    const int bits = std::lround(std::log2(averageSize));
+    m_maskSmall = topBits(bits + 2);
+    m_maskLarge = topBits(bits - 2);
+}
+
+int Chunker::cut(const char *data, int length) const
+{
+    if(length <= m_minSize)
+        return length;
+
+    const auto bytes = reinterpret_cast<const uchar *>(data);
+
+    //prime the hash with the 64 bytes in front of the minimum size so every cut
+    //point depends on the same window no matter where the chunk started
+    int i = qMax(0, m_minSize - 64);
+    quint64 hash = 0;
+    for(; i < m_minSize; i++)
+        hash = (hash << 1) + gear[bytes[i]];
+
+    const int normalSize = qMin(m_averageSize, length);
+    for(; i < normalSize; i++)
+    {
+        hash = (hash << 1) + gear[bytes[i]];
+        if(!(hash & m_maskSmall))
+            return i + 1;
+    }
+
+    const int end = qMin(m_maxSize, length);
+    for(; i < end; i++)
+    {
+        hash = (hash << 1) + gear[bytes[i]];
+        if(!(hash & m_maskLarge))
+            return i + 1;
+    }
+
+    return end;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QtGlobal>
+
+//! Content-defined chunking with a gear rolling hash (FastCDC style). Cut points
+//! only depend on the bytes right in front of them, so inserting or removing
+//! data shifts the boundaries around the edit but leaves the rest of the file
+//! cut exactly as before.
+class Chunker
+{
+public:
+    Chunker(int minSize, int averageSize, int maxSize);
+
+    int minSize() const { return m_minSize; }
+    int averageSize() const { return m_averageSize; }
+    int maxSize() const { return m_maxSize; }
+
+    //! Returns the length of the chunk starting at data. length has to be at
+    //! least maxSize() unless the file ends before that.
+    int cut(const char *data, int length) const;
+
+private:
+    int m_minSize;
+    int m_averageSize;
+    int m_maxSize;
+
+    //! stricter mask below the average size, looser one above, which keeps the
+    //! chunk sizes close to the average
+    quint64 m_maskSmall;
+    quint64 m_maskLarge;
+};
@@ -0,0 +1,1053 @@
+#include "compile.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "compression.h"
+#include "digest.h"
+#include "manifest.h"
+#include "mappedbitmap.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "packs.h"
+#include "parity.h"
+#include "pipeline.h"
+#include "spreadfile.h"
+#include "workstealingpool.h"
+
+namespace {
+//! Sockets and the like buffer what they cannot send yet, they are not allowed more than this
+const qint64 maxBuffered { 4 * 1024 * 1024 };
+
+bool writeStream(QIODevice &target, const char *data, qint64 length)
+{
+    MetricsTimer timer(metrics.writeNsecs);
+
+    while(length)
+    {
+        const auto written = target.write(data, length);
+        if(written == -1)
+        {
+            qWarning() << "could not write" << target.errorString();
+            return false;
+        }
+
+        data += written;
+        length -= written;
+        metrics.bytesWritten += written;
+
+        while(target.bytesToWrite() > maxBuffered)
+        {
+            if(!target.waitForBytesWritten(-1))
+            {
+                qWarning() << "could not write" << target.errorString();
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+//! What the hash thread of restoreFile() gets, in file order
+struct HashItem
+{
+    QByteArray content;
+    qint64 zeroLength { 0 };
+    //! content points into it for raw parts
+    std::shared_ptr<const MappedBitmap> mapping;
+};
+
+bool writeAt(int fd, const QByteArray &content, qint64 offset)
+{
+    MetricsTimer timer(metrics.writeNsecs);
+
+    for(int pos = 0; pos < content.size(); )
+    {
+        const auto written = pwrite(fd, content.constData() + pos, content.size() - pos, offset + pos);
+        if(written == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            qWarning() << "could not write" << strerror(errno);
+            return false;
+        }
+
+        pos += written;
+    }
+
+    metrics.bytesWritten += content.size();
+    return true;
+}
+}
+
+//! The whole content of a part, checked against its digest if the index has one
+bool readPartContent(const RestorePart &part, DigestAlgorithm algorithm, const CompileOptions &options, QByteArray &content)
+{
+    const auto bitmap = openPart(part, options);
+    if(!bitmap)
+        return false;
+
+    if(!part.codec.isEmpty())
+    {
+        if(!measure(metrics.compressNsecs, [&](){ return decompressPart(part.codec, bitmap->content(), bitmap->contentLength(), part.length, content); }))
+        {
+            qWarning() << "could not decompress part" << part.path;
+            return false;
+        }
+    }
+    else
+        content = QByteArray(bitmap->content() + part.offset, int(part.length));
+
+    metrics.bytesRead += part.codec.isEmpty() ? part.length : bitmap->contentLength();
+
+    if(!part.digest.isEmpty() && measure(metrics.hashNsecs, [&](){ return partDigest(algorithm, content); }) != part.digest)
+    {
+        qWarning() << partDigestName(algorithm) << "mismatch" << part.path;
+        return false;
+    }
+
+    return true;
+}
+
+std::shared_ptr<const MappedBitmap> openPart(const RestorePart &part, const CompileOptions &options)
+{
+    if(part.packed)
+    {
+        if(!options.packReader)
+        {
+            qWarning() << "part is packed but there is no pack reader";
+            return nullptr;
+        }
+
+        const auto bitmap = options.packReader->open(part.path);
+        if(!bitmap)
+            return nullptr;
+
+        if(quint64(part.offset) + part.length > bitmap->contentLength())
+        {
+            qWarning() << "part is out of its pack" << part.path;
+            return nullptr;
+        }
+
+        return bitmap;
+    }
+
+    const auto bitmap = std::make_shared<MappedBitmap>();
+    if(!bitmap->open(part.path))
+        return nullptr;
+
+    //a compressed part is as long as the codec made it, decompressing checks the length
+    if(part.codec.isEmpty() && bitmap->contentLength() != part.length)
+    {
+        qWarning() << "part length does not match" << part.path;
+        return nullptr;
+    }
+
+    return bitmap;
+}
+
+bool checkPart(const FileParts &file, const RestorePart &part, const char *content)
+{
+    if(file.parity.isEmpty() || part.digest.isEmpty())
+        return true;
+
+    const auto data = QByteArray::fromRawData(content, int(part.length));
+    if(measure(metrics.hashNsecs, [&](){ return partDigest(file.algorithm, data); }) == part.digest)
+        return true;
+
+    qWarning() << partDigestName(file.algorithm) << "mismatch" << part.path;
+    return false;
+}
+
+bool rebuildPart(const FileParts &file, int index, const CompileOptions &options, QByteArray &content)
+{
+    const auto &part = file.parts.at(index);
+
+    for(const auto &stripe : file.parity)
+    {
+        const auto position = stripe.parts.indexOf(index);
+        if(position == -1)
+            continue;
+
+        const auto dataShards = stripe.parts.size();
+        QVector<QByteArray> shards(dataShards + stripe.shardPaths.size());
+
+        //whatever else of the stripe is damaged counts as lost as well
+        for(int i = 0; i < dataShards; i++)
+        {
+            if(i == position)
+                continue;
+
+            auto &shard = shards[i];
+            if(!readPartContent(file.parts.at(stripe.parts.at(i)), file.algorithm, options, shard) || shard.size() > stripe.shardLength)
+            {
+                shard.clear();
+                continue;
+            }
+
+            shard.append(QByteArray(int(stripe.shardLength) - shard.size(), '\0'));
+        }
+
+        for(int j = 0; j < stripe.shardPaths.size(); j++)
+        {
+            MappedBitmap bitmap;
+            if(!bitmap.open(stripe.shardPaths.at(j)) || bitmap.contentLength() != stripe.shardLength)
+                continue;
+
+            QByteArray shard(bitmap.content(), int(stripe.shardLength));
+            metrics.bytesRead += shard.size();
+
+            if(measure(metrics.hashNsecs, [&](){ return partDigest(file.algorithm, shard); }) != stripe.shardDigests.at(j))
+            {
+                qWarning() << partDigestName(file.algorithm) << "mismatch" << stripe.shardPaths.at(j);
+                continue;
+            }
+
+            shards[dataShards + j] = shard;
+        }
+
+        if(!measure(metrics.parityNsecs, [&](){ return parity::reconstruct(shards, dataShards); }))
+        {
+            qWarning() << "too much of its stripe is lost to rebuild part" << part.path;
+            return false;
+        }
+
+        content = shards.at(position).left(int(part.length));
+
+        if(!part.digest.isEmpty() && measure(metrics.hashNsecs, [&](){ return partDigest(file.algorithm, content); }) != part.digest)
+        {
+            qWarning() << "rebuilt part does not match its digest" << part.path;
+            return false;
+        }
+
+        qInfo() << "rebuilt part from parity" << part.path;
+        metrics.rebuiltParts++;
+        return true;
+    }
+
+    return false;
+}
+
+//! Reassembles a file from its part bitmaps. The digest is computed on a
+//! thread of its own while the parts are written, raw parts keep their
+//! mapping until it got to them. A lost or damaged part is rebuilt from the
+//! parity of the file if it has any, with parity every part is checked
+//! against its digest before it is written.
+bool restoreFile(const QString &targetPath, const FileParts &file, const CompileOptions &options)
+{
+    const auto filesize = file.filesize;
+    const auto algorithm = file.algorithm;
+    const auto &parts = file.parts;
+
+    QFile targetFile(targetPath);
+
+    if(!targetFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "could not open file" << targetFile.errorString();
+        return false;
+    }
+
+    //the file was truncated, so everything not allocated below is a hole
+    if(filesize > 0 && ftruncate(targetFile.handle(), filesize) == -1)
+    {
+        qWarning() << "could not resize file" << strerror(errno);
+        return false;
+    }
+
+    //allocate the data up front so the parts land in contiguous extents, only
+    //an optimization if the filesystem cannot do it
+    for(const auto &part : parts)
+        if(!part.zero && part.length > 0)
+            fallocate(targetFile.handle(), 0, part.startPos, part.length);
+
+    FileDigest hash(algorithm, options.hashThreads);
+    BoundedQueue<HashItem> hashQueue(4);
+
+    std::thread hashThread([&](){
+        HashItem item;
+        while(hashQueue.pop(item))
+        {
+            measure(metrics.hashNsecs, [&](){
+                if(item.zeroLength)
+                    hash.addZeros(item.zeroLength);
+                else
+                    hash.addData(item.content);
+            });
+            item = HashItem();
+        }
+    });
+
+    qint64 pos = 0;
+
+    const auto restored = [&](){
+        for(int index = 0; index < parts.size(); index++)
+        {
+            const auto &part = parts.at(index);
+
+            //the digest is only meaningful if the parts are hashed in file order
+            if(part.startPos != pos)
+            {
+                qWarning() << "parts are not contiguous";
+                return false;
+            }
+
+            if(part.zero)
+            {
+                hashQueue.push(HashItem { QByteArray(), part.length });
+                pos += part.length;
+                continue;
+            }
+
+            auto bitmap = openPart(part, options);
+
+            if(bitmap && part.codec.isEmpty() && !checkPart(file, part, bitmap->content() + part.offset))
+                bitmap.reset();
+
+            if(!bitmap || !part.codec.isEmpty())
+            {
+                QByteArray content;
+                if(bitmap)
+                {
+                    if(!measure(metrics.compressNsecs, [&](){ return decompressPart(part.codec, bitmap->content(), bitmap->contentLength(), part.length, content); }))
+                    {
+                        qWarning() << "could not decompress part" << part.path;
+                        bitmap.reset();
+                    }
+                    else
+                    {
+                        metrics.bytesRead += bitmap->contentLength();
+                        if(!checkPart(file, part, content.constData()))
+                            bitmap.reset();
+                    }
+                }
+
+                if(!bitmap && !rebuildPart(file, index, options, content))
+                    return false;
+
+                if(!writeAt(targetFile.handle(), content, pos))
+                    return false;
+
+                hashQueue.push(HashItem { content });
+                pos += part.length;
+                continue;
+            }
+
+            if(!bitmap->copyTo(targetFile.handle(), pos, part.offset, part.length))
+                return false;
+
+            hashQueue.push(HashItem { QByteArray::fromRawData(bitmap->content() + part.offset, part.length), 0, bitmap });
+            pos += part.length;
+        }
+
+        if(pos != filesize)
+        {
+            qWarning() << "parts do not add up to filesize";
+            return false;
+        }
+
+        return true;
+    }();
+
+    hashQueue.close();
+    hashThread.join();
+
+    if(!restored)
+        return false;
+
+    if(QString(hash.result().toHex()) != file.digest)
+    {
+        qWarning() << digestName(algorithm) << "mismatch" << targetPath;
+        return false;
+    }
+
+    return true;
+}
+
+bool manifestFileParts(const Manifest &manifest, const ManifestNode &node, const QDir &sourceDir, const CompileOptions &options, FileParts &file)
+{
+    if(node.flags & ManifestNode::HasParity)
+    {
+        QJsonObject jsonObject;
+        if(!readIndex(sourceDir.absoluteFilePath(QStringLiteral("__index.bmp")), jsonObject))
+            return false;
+
+        return parseFileIndex(jsonObject, sourceDir, options, file);
+    }
+
+    file.parts.clear();
+    file.parts.reserve(node.partCount);
+
+    const auto parts = manifest.parts(node);
+    for(quint32 i = 0; i < node.partCount; i++)
+    {
+        const auto &part = parts[i];
+
+        RestorePart restorePart { QString(), part.startPos, part.length };
+        if(part.flags & ManifestPart::IsZero)
+            restorePart.zero = true;
+        else if(part.flags & ManifestPart::IsObject)
+        {
+            if(!options.objectStore)
+            {
+                qWarning() << "part references an object but there is no object store";
+                return false;
+            }
+            restorePart.path = options.objectStore->filePath(manifest.name(part));
+        }
+        else if(part.flags & ManifestPart::IsPacked)
+        {
+            restorePart.path = manifest.name(part);
+            restorePart.packed = true;
+            restorePart.offset = part.offset;
+        }
+        else
+            restorePart.path = sourceDir.absoluteFilePath(manifest.name(part));
+
+        if(part.flags & ManifestPart::IsCompressed)
+            restorePart.codec = zlibCodec();
+
+        file.parts.append(restorePart);
+    }
+
+    file.filesize = node.filesize;
+    file.algorithm = node.flags & ManifestNode::Blake3Digest ? DigestAlgorithm::Blake3 : DigestAlgorithm::Sha512;
+    const auto digestSize = file.algorithm == DigestAlgorithm::Blake3 ? 32 : int(sizeof(node.digest));
+    file.digest = QString(QByteArray::fromRawData(reinterpret_cast<const char *>(node.digest), digestSize).toHex());
+
+    return true;
+}
+
+bool parseFileIndex(const QJsonObject &jsonObject, const QDir &sourceDir, const CompileOptions &options, FileParts &file)
+{
+    if(!jsonObject.contains(QStringLiteral("filesize")))
+    {
+        qWarning() << "json does not contain filesize";
+        return false;
+    }
+    const auto filesizeValue = jsonObject.value(QStringLiteral("filesize"));
+    if(filesizeValue.type() != QJsonValue::Double)
+    {
+        qWarning() << "json filesize is not a number";
+        return false;
+    }
+    file.filesize = qint64(filesizeValue.toDouble());
+
+    const auto digestValue = jsonObject.value(QStringLiteral("digest"));
+    file.algorithm = DigestAlgorithm::Sha512;
+    if(!digestValue.isUndefined() && !parseDigestAlgorithm(digestValue.toString(), file.algorithm))
+    {
+        qWarning() << "json digest is unknown" << digestValue.toString();
+        return false;
+    }
+
+    const auto algorithmName = digestName(file.algorithm);
+    if(!jsonObject.contains(algorithmName))
+    {
+        qWarning() << "json does not contain" << algorithmName;
+        return false;
+    }
+    const auto fileDigestValue = jsonObject.value(algorithmName);
+    if(fileDigestValue.type() != QJsonValue::String)
+    {
+        qWarning() << "json" << algorithmName << "is not a string";
+        return false;
+    }
+    file.digest = fileDigestValue.toString();
+
+    if(!jsonObject.contains(QStringLiteral("parts")))
+    {
+        qWarning() << "json does not contain parts";
+        return false;
+    }
+    const auto partsValue = jsonObject.value(QStringLiteral("parts"));
+    if(partsValue.type() != QJsonValue::Array)
+    {
+        qWarning() << "json parts is not an array";
+        return false;
+    }
+    const auto parts = partsValue.toArray();
+
+    file.parts.clear();
+    file.parts.reserve(parts.size());
+
+    for(const auto &partValue : parts)
+    {
+        if(partValue.type() != QJsonValue::Object)
+        {
+            qWarning() << "json part is not an object";
+            return false;
+        }
+        const auto part = partValue.toObject();
+
+        RestorePart restorePart;
+        if(part.value(QStringLiteral("zero")).toBool())
+            restorePart.zero = true;
+        else if(part.contains(QStringLiteral("object")))
+        {
+            const auto objectValue = part.value(QStringLiteral("object"));
+            if(objectValue.type() != QJsonValue::String)
+            {
+                qWarning() << "json part object is not a string";
+                return false;
+            }
+            if(!options.objectStore)
+            {
+                qWarning() << "part references an object but there is no object store";
+                return false;
+            }
+            restorePart.path = options.objectStore->filePath(objectValue.toString());
+        }
+        else if(part.contains(QStringLiteral("pack")))
+        {
+            const auto packValue = part.value(QStringLiteral("pack"));
+            if(packValue.type() != QJsonValue::String)
+            {
+                qWarning() << "json part pack is not a string";
+                return false;
+            }
+            const auto offsetValue = part.value(QStringLiteral("offset"));
+            if(offsetValue.type() != QJsonValue::Double)
+            {
+                qWarning() << "json part offset is not a number";
+                return false;
+            }
+            restorePart.path = packValue.toString();
+            restorePart.packed = true;
+            restorePart.offset = offsetValue.toDouble();
+        }
+        else
+        {
+            const auto filenameValue = part.value(QStringLiteral("filename"));
+            if(filenameValue.type() != QJsonValue::String)
+            {
+                qWarning() << "json part filename is not a string";
+                return false;
+            }
+            restorePart.path = sourceDir.absoluteFilePath(filenameValue.toString());
+        }
+
+        //packs are never compressed, their parts are read straight from the pack
+        if(!restorePart.packed && part.contains(QStringLiteral("codec")))
+        {
+            const auto codecValue = part.value(QStringLiteral("codec"));
+            if(codecValue.type() != QJsonValue::String)
+            {
+                qWarning() << "json part codec is not a string";
+                return false;
+            }
+            restorePart.codec = codecValue.toString();
+        }
+
+        const auto startPosValue = part.value(QStringLiteral("startPos"));
+        if(startPosValue.type() != QJsonValue::Double)
+        {
+            qWarning() << "json part startPos is not a number";
+            return false;
+        }
+
+        const auto lengthValue = part.value(QStringLiteral("length"));
+        if(lengthValue.type() != QJsonValue::Double)
+        {
+            qWarning() << "json part length is not a number";
+            return false;
+        }
+
+        restorePart.startPos = startPosValue.toDouble();
+        restorePart.length = lengthValue.toDouble();
+
+        const auto partDigestValue = part.value(partDigestName(file.algorithm));
+        if(partDigestValue.type() == QJsonValue::String)
+            restorePart.digest = QByteArray::fromHex(partDigestValue.toString().toLatin1());
+
+        file.parts.append(restorePart);
+    }
+
+    file.parity.clear();
+
+    const auto parityValue = jsonObject.value(QStringLiteral("parity"));
+    if(parityValue.isUndefined())
+        return true;
+    if(parityValue.type() != QJsonValue::Array)
+    {
+        qWarning() << "json parity is not an array";
+        return false;
+    }
+
+    //parity is only ever a fallback, a stripe that cannot be used must not keep the file from compiling
+    for(const auto &stripeValue : parityValue.toArray())
+    {
+        const auto stripeObject = stripeValue.toObject();
+
+        const auto code = stripeObject.value(QStringLiteral("code")).toString();
+        if(code != QLatin1String(parity::codeName))
+        {
+            qWarning() << "json parity code is unknown" << code;
+            continue;
+        }
+
+        ParityStripe stripe;
+        stripe.shardLength = qint64(stripeObject.value(QStringLiteral("shardLength")).toDouble());
+        bool valid = stripe.shardLength > 0;
+
+        for(const auto &indexValue : stripeObject.value(QStringLiteral("parts")).toArray())
+        {
+            const auto index = indexValue.toInt(-1);
+            if(index < 0 || index >= file.parts.size() || file.parts.at(index).zero || file.parts.at(index).length > stripe.shardLength)
+                valid = false;
+            stripe.parts.append(index);
+        }
+
+        for(const auto &shardValue : stripeObject.value(QStringLiteral("shards")).toArray())
+        {
+            const auto shard = shardValue.toObject();
+            const auto filenameValue = shard.value(QStringLiteral("filename"));
+            const auto shardDigestValue = shard.value(partDigestName(file.algorithm));
+            if(filenameValue.type() != QJsonValue::String || shardDigestValue.type() != QJsonValue::String)
+                valid = false;
+            stripe.shardPaths.append(sourceDir.absoluteFilePath(filenameValue.toString()));
+            stripe.shardDigests.append(QByteArray::fromHex(shardDigestValue.toString().toLatin1()));
+        }
+
+        if(!valid || stripe.parts.isEmpty() || stripe.parts.size() > parity::maxDataShards ||
+           stripe.shardPaths.isEmpty() || stripe.shardPaths.size() > parity::maxParityShards)
+        {
+            qWarning() << "json parity stripe is invalid";
+            continue;
+        }
+
+        file.parity.append(stripe);
+    }
+
+    return true;
+}
+
+namespace {
+//! Times are set this many files per task
+const int timesBatchSize { 1024 };
+
+//! A file the first pass found, its parts are dropped once it is restored
+struct FileJob
+{
+    QString targetPath;
+    FileParts file;
+    //! msecs since the epoch like in the index, not every index has them
+    bool hasTimes { false };
+    qint64 lastModified { 0 };
+    qint64 lastRead { 0 };
+};
+
+//! mkdir(), with the missing parents only where there are any (the root)
+bool makeDirectory(const QString &path)
+{
+    if(::mkdir(QFile::encodeName(path).constData(), 0777) == 0)
+        return true;
+
+    const auto error = errno;
+    if(error == EEXIST && QFileInfo(path).isDir())
+        return true;
+    if(error == ENOENT && QDir().mkpath(path))
+        return true;
+
+    qWarning() << "could not create dir" << path << strerror(error);
+    return false;
+}
+
+//! Floored, times before 1970 are negative
+timespec toTimespec(qint64 msecs)
+{
+    auto secs = msecs / 1000;
+    auto rest = msecs % 1000;
+    if(rest < 0)
+    {
+        secs--;
+        rest += 1000;
+    }
+
+    timespec time;
+    time.tv_sec = secs;
+    time.tv_nsec = rest * 1000000;
+    return time;
+}
+
+//! Reads and checks the index of a node
+bool readNodeIndex(const QDir &sourceDir, QJsonObject &jsonObject, QString &type)
+{
+    {
+        QByteArray content;
+        if(!readBitmap(sourceDir.absoluteFilePath(QStringLiteral("__index.bmp")), content))
+            return false;
+
+        QJsonParseError error;
+        auto document = measure(metrics.jsonNsecs, [&](){ return QJsonDocument::fromJson(content, &error); });
+        metrics.indexParses++;
+        if(error.error != QJsonParseError::NoError)
+        {
+            qWarning() << "error parsing json" << error.errorString();
+            return false;
+        }
+        if(!document.isObject())
+        {
+            qWarning() << "json is not an object";
+            return false;
+        }
+        jsonObject = document.object();
+    }
+
+    if(!jsonObject.contains(QStringLiteral("type")))
+    {
+        qWarning() << "json does not contain type";
+        return false;
+    }
+    const auto typeValue = jsonObject.value(QStringLiteral("type"));
+    if(typeValue.type() != QJsonValue::String)
+    {
+        qWarning() << "json type is not a string";
+        return false;
+    }
+    type = typeValue.toString();
+
+    return true;
+}
+
+//! The passes of compile() and compileManifest() on one work stealing pool.
+//! Every pass is done before the next starts: a file finds its directory in
+//! place and its times are set after nothing writes to it anymore, batched so
+//! the restores do not wait for them. The first pass reads the indexes on the
+//! pool as well, a big tree has as many of them as nodes.
+class TreeCompiler
+{
+public:
+    explicit TreeCompiler(const CompileOptions &options) :
+        m_options(options),
+        m_pool(qMax(1, options.jobs))
+    {
+    }
+
+    void collectIndex(const QString &sourcePath, const QString &targetPath)
+    {
+        m_pool.start([this, sourcePath, targetPath](){ collectNode(sourcePath, targetPath); });
+        m_pool.waitForDone();
+    }
+
+    //! The manifest is in memory already, it is walked right here
+    void collectManifest(const Manifest &manifest, const ManifestNode &node, const QDir &sourceDir, const QString &targetPath)
+    {
+        if(m_failed)
+            return;
+
+        if(node.type == ManifestNode::File)
+        {
+            FileJob job { targetPath, FileParts(), true, node.lastModified, node.lastRead };
+            if(!manifestFileParts(manifest, node, sourceDir, m_options, job.file))
+            {
+                m_failed = true;
+                return;
+            }
+
+            addFile(std::move(job));
+            return;
+        }
+
+        if(!makeDirectory(targetPath))
+        {
+            m_failed = true;
+            return;
+        }
+
+        const auto children = manifest.children(node);
+        for(quint32 i = 0; i < node.childCount; i++)
+        {
+            const auto name = manifest.name(children[i]);
+            collectManifest(manifest, children[i], QDir(sourceDir.absoluteFilePath(name)), QDir(targetPath).absoluteFilePath(name));
+        }
+    }
+
+    bool run()
+    {
+        if(m_failed)
+            return false;
+
+        //big files first so none of them starts last, the packed ones after
+        //them by pack so every pack is mapped once
+        const auto packedPart = [](const FileJob &job) -> const RestorePart * {
+            const auto &parts = job.file.parts;
+            return parts.size() == 1 && parts.first().packed ? &parts.first() : nullptr;
+        };
+        std::sort(m_files.begin(), m_files.end(), [&](const FileJob &a, const FileJob &b){
+            const auto packedA = packedPart(a);
+            const auto packedB = packedPart(b);
+            if(packedA && packedB)
+                return packedA->path != packedB->path ? packedA->path < packedB->path : packedA->offset < packedB->offset;
+            if(packedA || packedB)
+                return !packedA;
+            return a.file.filesize > b.file.filesize;
+        });
+
+        for(auto &job : m_files)
+            m_pool.start([this, &job](){ restore(job); });
+        m_pool.waitForDone();
+
+        if(m_failed)
+            return false;
+
+        for(std::size_t first = 0; first < m_files.size(); first += timesBatchSize)
+            m_pool.start([this, first](){ applyTimes(first, qMin(first + timesBatchSize, m_files.size())); });
+        m_pool.waitForDone();
+
+        return !m_failed;
+    }
+
+private:
+    void collectNode(const QString &sourcePath, const QString &targetPath)
+    {
+        if(m_failed)
+            return;
+
+        qCDebug(picsyncTrace) << "compile" << sourcePath << targetPath;
+
+        const QDir sourceDir(sourcePath);
+
+        QJsonObject jsonObject;
+        QString type;
+        if(!readNodeIndex(sourceDir, jsonObject, type))
+        {
+            m_failed = true;
+            return;
+        }
+
+        if(type == QStringLiteral("file"))
+        {
+            FileJob job { targetPath };
+            if(!parseFileIndex(jsonObject, sourceDir, m_options, job.file))
+            {
+                m_failed = true;
+                return;
+            }
+
+            const auto lastModifiedValue = jsonObject.value(QStringLiteral("lastModified"));
+            const auto lastReadValue = jsonObject.value(QStringLiteral("lastRead"));
+            if(lastModifiedValue.type() == QJsonValue::Double && lastReadValue.type() == QJsonValue::Double)
+            {
+                job.hasTimes = true;
+                job.lastModified = qint64(lastModifiedValue.toDouble());
+                job.lastRead = qint64(lastReadValue.toDouble());
+            }
+
+            addFile(std::move(job));
+        }
+        else if(type == QStringLiteral("directory"))
+        {
+            //its entries are only looked at once it exists
+            if(!makeDirectory(targetPath))
+            {
+                m_failed = true;
+                return;
+            }
+
+            if(!jsonObject.contains(QStringLiteral("entries")))
+            {
+                qWarning() << "json does not contain entries";
+                m_failed = true;
+                return;
+            }
+            const auto entriesValue = jsonObject.value(QStringLiteral("entries"));
+            if(entriesValue.type() != QJsonValue::Array)
+            {
+                qWarning() << "json entries is not an array";
+                m_failed = true;
+                return;
+            }
+
+            const QDir targetDir(targetPath);
+            for(const auto &entryValue : entriesValue.toArray())
+            {
+                if(entryValue.type() != QJsonValue::String)
+                {
+                    qWarning() << "json entry is not a string";
+                    m_failed = true;
+                    return;
+                }
+                const auto entry = entryValue.toString();
+
+                const auto entrySourcePath = sourceDir.absoluteFilePath(entry);
+                const auto entryTargetPath = targetDir.absoluteFilePath(entry);
+                m_pool.start([this, entrySourcePath, entryTargetPath](){ collectNode(entrySourcePath, entryTargetPath); });
+            }
+        }
+        else
+        {
+            qWarning() << "unknown type" << type;
+            m_failed = true;
+        }
+    }
+
+    void addFile(FileJob &&job)
+    {
+        metrics.filesTotal++;
+        metrics.bytesTotal += job.file.filesize;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_files.push_back(std::move(job));
+    }
+
+    void restore(FileJob &job)
+    {
+        if(m_failed)
+            return;
+
+        if(!restoreFile(job.targetPath, job.file, m_options))
+        {
+            m_failed = true;
+            return;
+        }
+
+        metrics.filesDone++;
+        metrics.bytesDone += job.file.filesize;
+
+        //only the times are needed from here on
+        job.file = FileParts();
+    }
+
+    void applyTimes(std::size_t first, std::size_t last)
+    {
+        for(auto i = first; i < last; i++)
+        {
+            const auto &job = m_files[i];
+            if(!job.hasTimes)
+                continue;
+
+            //there is no setting the birth time, it stays when the file was restored
+            const timespec times[2] { toTimespec(job.lastRead), toTimespec(job.lastModified) };
+            if(utimensat(AT_FDCWD, QFile::encodeName(job.targetPath).constData(), times, 0) == -1)
+            {
+                qWarning() << "could not set times" << job.targetPath << strerror(errno);
+                m_failed = true;
+            }
+        }
+    }
+
+    const CompileOptions &m_options;
+    WorkStealingPool m_pool;
+
+    std::vector<FileJob> m_files;
+    std::mutex m_mutex;
+    std::atomic<bool> m_failed { false };
+};
+}
+
+bool compile(const QString &sourcePath, const QString &targetPath, const CompileOptions &options)
+{
+    QFileInfo sourceFileInfo(sourcePath);
+    if(!sourceFileInfo.exists())
+    {
+        qWarning() << "source does not exist";
+        return false;
+    }
+    if(!sourceFileInfo.isDir())
+    {
+        qWarning() << "source is not a dir";
+        return false;
+    }
+
+    TreeCompiler compiler(options);
+    compiler.collectIndex(sourcePath, targetPath);
+    return compiler.run();
+}
+
+bool compileManifest(const Manifest &manifest, const ManifestNode &node, const QDir &sourceDir, const QString &targetPath, const CompileOptions &options)
+{
+    TreeCompiler compiler(options);
+    compiler.collectManifest(manifest, node, sourceDir, targetPath);
+    return compiler.run();
+}
+
+bool compileStream(const QString &sourcePath, QIODevice &target, const CompileOptions &options)
+{
+    qCDebug(picsyncTrace) << "compileStream" << sourcePath;
+
+    SpreadFile file(options);
+    if(!file.open(sourcePath, QString()))
+        return false;
+
+    metrics.filesTotal++;
+    metrics.bytesTotal += file.size();
+
+    FileDigest hash(file.algorithm(), options.hashThreads);
+    const auto written = file.read(0, file.size(), [&](const char *data, qint64 length){
+        measure(metrics.hashNsecs, [&](){ hash.addData(QByteArray::fromRawData(data, length)); });
+        return writeStream(target, data, length);
+    });
+    if(!written)
+        return false;
+
+    if(QString(hash.result().toHex()) != file.digest())
+    {
+        qWarning() << digestName(file.algorithm()) << "mismatch" << sourcePath;
+        return false;
+    }
+
+    metrics.filesDone++;
+    metrics.bytesDone += file.size();
+
+    return true;
+}
+
+Compiler::Compiler(const CompileOptions &options) :
+    m_options(options)
+{
+}
+
+bool Compiler::compile(const QString &sourcePath, const QString &targetPath) const
+{
+    const QDir sourceDir(sourcePath);
+    const auto manifestPath = sourceDir.absoluteFilePath(QStringLiteral("__manifest.bmp"));
+    if(QFile::exists(manifestPath))
+    {
+        Manifest manifest;
+        if(manifest.open(manifestPath))
+            return compileManifest(manifest, manifest.root(), sourceDir, targetPath, m_options);
+
+        qWarning() << "falling back to the indexes";
+    }
+
+    return ::compile(sourcePath, targetPath, m_options);
+}
+
+bool Compiler::compile(const QString &sourcePath, QIODevice *target) const
+{
+    return compileStream(sourcePath, *target, m_options);
+}
+
+bool Compiler::compile(const QString &sourcePath, int fd) const
+{
+    QFile target;
+    if(!target.open(fd, QIODevice::WriteOnly | QIODevice::Unbuffered, QFileDevice::DontCloseHandle))
+    {
+        qWarning() << "could not open target" << target.errorString();
+        return false;
+    }
+
+    return compileStream(sourcePath, target, m_options);
+}
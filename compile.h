@@ -0,0 +1,121 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QtGlobal>
+
+#include <memory>
+
+#include "digest.h"
+
+class QDir;
+class QIODevice;
+class QJsonObject;
+
+class Manifest;
+class MappedBitmap;
+class ObjectStore;
+class PackReader;
+struct ManifestNode;
+
+struct CompileOptions
+{
+    const ObjectStore *objectStore { nullptr };
+    PackReader *packReader { nullptr };
+    //! files of a tree restored at once
+    int jobs { 1 };
+    //! cores one file digest may use, blake3 only
+    int hashThreads { 1 };
+};
+
+struct RestorePart
+{
+    //! part bitmap, or pack id if the part is packed
+    QString path;
+    qint64 startPos;
+    qint64 length;
+    bool packed { false };
+    quint32 offset { 0 };
+    //! a hole, nothing to copy
+    bool zero { false };
+    //! empty if the part is stored raw
+    QString codec;
+    //! of the content, empty if the index did not record one
+    QByteArray digest;
+};
+
+//! Parity of a run of data parts, see parity.h
+struct ParityStripe
+{
+    //! indexes into FileParts::parts
+    QVector<int> parts;
+    qint64 shardLength { 0 };
+    //! the parity bitmaps in order and their digests
+    QStringList shardPaths;
+    QVector<QByteArray> shardDigests;
+};
+
+//! Everything needed to reassemble one file, the parts in file order
+struct FileParts
+{
+    qint64 filesize { 0 };
+    DigestAlgorithm algorithm { DigestAlgorithm::Sha512 };
+    QString digest;
+    QVector<RestorePart> parts;
+    //! empty unless the file was spread with parity
+    QVector<ParityStripe> parity;
+};
+
+//! Checks a file index and resolves its parts, sourceDir is the file's own directory
+bool parseFileIndex(const QJsonObject &jsonObject, const QDir &sourceDir, const CompileOptions &options, FileParts &file);
+
+//! Same for a file node of a __manifest.bmp. A file with parity is read from
+//! its __index.bmp, the manifest does not carry the stripes.
+bool manifestFileParts(const Manifest &manifest, const ManifestNode &node, const QDir &sourceDir, const CompileOptions &options, FileParts &file);
+
+//! Maps the bitmap holding part, its own or a pack of options.packReader.
+//! nullptr if it is lost or does not fit the part.
+std::shared_ptr<const MappedBitmap> openPart(const RestorePart &part, const CompileOptions &options);
+
+//! Checks the content of part read from its bitmap against its digest, but
+//! only if file has parity to rebuild it from. Without there is nothing
+//! better to restore anyway and the file digest catches it.
+bool checkPart(const FileParts &file, const RestorePart &part, const char *content);
+
+//! Rebuilds the content of a lost or damaged part from the rest of its parity
+//! stripe and checks it against the part's digest. False if the file has no
+//! parity for it or too much of the stripe is lost as well.
+bool rebuildPart(const FileParts &file, int index, const CompileOptions &options, QByteArray &content);
+
+//! Restores the tree spread to sourcePath into targetPath in three passes. The
+//! first walks the indexes and creates every directory, the second restores
+//! the files options.jobs at a time, each checked against its digest while it
+//! is written, and the last sets their modification and access times.
+bool compile(const QString &sourcePath, const QString &targetPath, const CompileOptions &options);
+
+//! compile() driven by a __manifest.bmp instead of the per node indexes
+bool compileManifest(const Manifest &manifest, const ManifestNode &node, const QDir &sourceDir, const QString &targetPath, const CompileOptions &options);
+
+//! Writes the file spread to sourcePath to target, part by part in file order,
+//! so target may be stdout or a pipe. The digest can only be checked once
+//! everything was written, a mismatch still fails.
+bool compileStream(const QString &sourcePath, QIODevice &target, const CompileOptions &options);
+
+//! Entry point for library users, a directory on disk is just one kind of target
+class Compiler
+{
+public:
+    explicit Compiler(const CompileOptions &options);
+
+    //! compileManifest() if sourcePath has a usable __manifest.bmp, compile() otherwise
+    bool compile(const QString &sourcePath, const QString &targetPath) const;
+
+    bool compile(const QString &sourcePath, QIODevice *target) const;
+    //! fd stays open
+    bool compile(const QString &sourcePath, int fd) const;
+
+private:
+    const CompileOptions m_options;
+};
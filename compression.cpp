@@ -0,0 +1,85 @@
+#include "compression.h"
+
+#include <QDebug>
+
+#include <array>
+#include <cmath>
+
+namespace {
+const int sampleCount { 16 };
+const int sampleSize { 4096 };
+
+//! above this the content is taken as already compressed
+const double maxEntropy { 7.5 };
+
+//! compressed parts have to be at least this much smaller to be worth decompressing
+const double minSaving { 0.1 };
+}
+
+QString zlibCodec()
+{
+    return QStringLiteral("zlib");
+}
+
+double sampleEntropy(const QByteArray &content)
+{
+    const auto data = reinterpret_cast<const uchar *>(content.constData());
+    const auto length = content.size();
+    if(!length)
+        return 0;
+
+    std::array<int, 256> histogram {};
+    int sampled = 0;
+
+    //evenly spread samples, a small part is sampled completely
+    const auto stride = qMax(sampleSize, length / sampleCount);
+    for(int start = 0; start < length; start += stride)
+    {
+        const auto end = qMin(start + sampleSize, length);
+        for(int i = start; i < end; i++)
+            histogram[data[i]]++;
+        sampled += end - start;
+    }
+
+    double entropy = 0;
+    for(const auto count : histogram)
+    {
+        if(!count)
+            continue;
+
+        const auto p = double(count) / sampled;
+        entropy -= p * std::log2(p);
+    }
+
+    return entropy;
+}
+
+QByteArray compressPart(const QByteArray &content, int level)
+{
+    if(sampleEntropy(content) > maxEntropy)
+        return QByteArray();
+
+    auto compressed = qCompress(content, level);
+    if(compressed.size() > content.size() * (1 - minSaving))
+        return QByteArray();
+
+    return compressed;
+}
+
+bool decompressPart(const QString &codec, const char *data, int storedLength, qint64 length, QByteArray &content)
+{
+    if(codec != zlibCodec())
+    {
+        qWarning() << "unknown codec" << codec;
+        return false;
+    }
+
+    content = qUncompress(reinterpret_cast<const uchar *>(data), storedLength);
+    if(content.size() != length)
+    {
+        qWarning() << "could not decompress part, got" << content.size() << "bytes instead of" << length;
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+
+//! Optional per part compression. Parts record "codec" and "storedLength",
+//! "length" always stays the uncompressed length in the file and the digests
+//! cover the uncompressed content.
+//!
+//! Only zlib through qCompress() for now, it ships with Qt and needs nothing
+//! else on the machines doing the compile.
+
+//! The only codec so far, the name recorded in "codec"
+QString zlibCodec();
+
+//! Bits per byte of a few samples spread over content, 8 means random
+double sampleEntropy(const QByteArray &content);
+
+//! Compresses content unless the samples say it already is (jpeg, zip, ...)
+//! or compressing does not save enough. Returns an empty array in that case.
+QByteArray compressPart(const QByteArray &content, int level);
+
+bool decompressPart(const QString &codec, const char *data, int storedLength, qint64 length, QByteArray &content);
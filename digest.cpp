@@ -0,0 +1,106 @@
+#include "digest.h"
+
+#include <QIODevice>
+#include <QJsonObject>
+
+QString digestName(DigestAlgorithm algorithm)
+{
+    switch(algorithm)
+    {
+    case DigestAlgorithm::Sha512: return QStringLiteral("sha512");
+    case DigestAlgorithm::Blake3: return QStringLiteral("blake3");
+    }
+
+    Q_UNREACHABLE();
+}
+
+bool parseDigestAlgorithm(const QString &name, DigestAlgorithm &algorithm)
+{
+    if(name == QStringLiteral("sha512"))
+        algorithm = DigestAlgorithm::Sha512;
+    else if(name == QStringLiteral("blake3"))
+        algorithm = DigestAlgorithm::Blake3;
+    else
+        return false;
+
+    return true;
+}
+
+QString partDigestName(DigestAlgorithm algorithm)
+{
+    switch(algorithm)
+    {
+    case DigestAlgorithm::Sha512: return QStringLiteral("sha256");
+    case DigestAlgorithm::Blake3: return QStringLiteral("blake3");
+    }
+
+    Q_UNREACHABLE();
+}
+
+DigestAlgorithm indexDigestAlgorithm(const QJsonObject &index)
+{
+    auto algorithm = DigestAlgorithm::Sha512;
+    parseDigestAlgorithm(index.value(QStringLiteral("digest")).toString(), algorithm);
+    return algorithm;
+}
+
+QByteArray partDigest(DigestAlgorithm algorithm, const QByteArray &content)
+{
+    switch(algorithm)
+    {
+    case DigestAlgorithm::Sha512: return QCryptographicHash::hash(content, QCryptographicHash::Sha256);
+    case DigestAlgorithm::Blake3: return Blake3::hash(content);
+    }
+
+    Q_UNREACHABLE();
+}
+
+FileDigest::FileDigest(DigestAlgorithm algorithm, int threads) :
+    m_algorithm(algorithm),
+    m_sha512(QCryptographicHash::Sha512),
+    m_blake3(threads)
+{
+}
+
+void FileDigest::addData(const QByteArray &data)
+{
+    if(m_algorithm == DigestAlgorithm::Blake3)
+        m_blake3.addData(data);
+    else
+        m_sha512.addData(data);
+}
+
+bool FileDigest::addData(QIODevice *device)
+{
+    if(m_algorithm == DigestAlgorithm::Sha512)
+        return m_sha512.addData(device);
+
+    //big reads so the tree hashing has something to spread over the threads
+    QByteArray buffer(4 * 1024 * 1024, Qt::Uninitialized);
+    while(!device->atEnd())
+    {
+        const auto length = device->read(buffer.data(), buffer.size());
+        if(length < 0)
+            return false;
+
+        m_blake3.addData(buffer.constData(), length);
+    }
+
+    return true;
+}
+
+void FileDigest::addZeros(qint64 length)
+{
+    static const QByteArray zeros(4 * 1024 * 1024, '\0');
+
+    for(; length > 0; length -= zeros.size())
+        addData(length >= zeros.size() ? zeros : QByteArray::fromRawData(zeros.constData(), length));
+}
+
+QByteArray FileDigest::result() const
+{
+    if(m_algorithm == DigestAlgorithm::Blake3)
+        return m_blake3.result();
+
+    return m_sha512.result();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QByteArray>
+#include <QCryptographicHash>
+#include <QString>
+
+#include "blake3.h"
+
+class QIODevice;
+class QJsonObject;
+
+//! The digests a spread records. Sha512 indexes hold a sha512 per file and a
+//! sha256 per part, blake3 indexes a blake3 for both. Indexes name their
+//! algorithm in "digest", ones without it are sha512.
+enum class DigestAlgorithm { Sha512, Blake3 };
+
+//! "sha512" or "blake3", also the index key of the file digest
+QString digestName(DigestAlgorithm algorithm);
+bool parseDigestAlgorithm(const QString &name, DigestAlgorithm &algorithm);
+
+//! Index key of the part digests, "sha256" or "blake3"
+QString partDigestName(DigestAlgorithm algorithm);
+
+DigestAlgorithm indexDigestAlgorithm(const QJsonObject &index);
+
+QByteArray partDigest(DigestAlgorithm algorithm, const QByteArray &content);
+
+//! Incremental file digest, blake3 hashes big updates on up to threads cores
+class FileDigest
+{
+public:
+    explicit FileDigest(DigestAlgorithm algorithm, int threads = 1);
+
+    void addData(const QByteArray &data);
+    bool addData(QIODevice *device);
+    //! for holes, which are not read
+    void addZeros(qint64 length);
+
+    QByteArray result() const;
+
+private:
+    const DigestAlgorithm m_algorithm;
+    QCryptographicHash m_sha512;
+    Blake3 m_blake3;
+};
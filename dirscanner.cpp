@@ -0,0 +1,169 @@
+#include "dirscanner.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+namespace {
+//! older glibcs do not wrap getdents64()
+struct LinuxDirent64
+{
+    quint64 d_ino;
+    qint64 d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+const int direntBufferSize { 256 * 1024 };
+
+//! below this many entries per thread the threads cost more than the stats
+const std::size_t statsPerThread { 4096 };
+
+struct RawEntry
+{
+    QByteArray name;
+    bool keep;
+    StatCache::Stat stat;
+};
+
+bool readEntries(int fd, const QString &path, std::vector<RawEntry> &raw)
+{
+    std::vector<char> buffer(direntBufferSize);
+
+    while(true)
+    {
+        const auto length = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if(length == -1)
+        {
+            qWarning() << "could not read dir" << path << strerror(errno);
+            return false;
+        }
+
+        if(!length)
+            return true;
+
+        for(long pos = 0; pos < length;)
+        {
+            const auto dirent = reinterpret_cast<const LinuxDirent64 *>(buffer.data() + pos);
+            pos += dirent->d_reclen;
+
+            //also skips . and ..
+            if(dirent->d_name[0] == '.')
+                continue;
+
+            //links and filesystems without d_type need the stat to tell
+            switch(dirent->d_type)
+            {
+            case DT_REG:
+            case DT_DIR:
+            case DT_LNK:
+            case DT_UNKNOWN:
+                raw.push_back(RawEntry { QByteArray(dirent->d_name), false, StatCache::Stat() });
+                break;
+            default:
+                break;
+            }
+        }
+    }
+}
+
+bool statEntries(int fd, const QString &path, RawEntry *begin, RawEntry *end)
+{
+    for(auto entry = begin; entry != end; ++entry)
+    {
+        struct stat st;
+        if(fstatat(fd, entry->name.constData(), &st, 0) == -1)
+        {
+            //removed since the listing or a dangling link, QDir skips those as well
+            if(errno == ENOENT || errno == ELOOP)
+                continue;
+
+            qWarning() << "could not stat" << path << entry->name << strerror(errno);
+            return false;
+        }
+
+        if(!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode))
+            continue;
+
+        StatCache::fromStat(st, entry->stat);
+        entry->keep = true;
+    }
+
+    return true;
+}
+}
+
+bool scanDirectory(const QString &path, int threads, QVector<DirEntry> &entries)
+{
+    const auto fd = ::open(QFile::encodeName(path).constData(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd == -1)
+    {
+        qWarning() << "could not open dir" << path << strerror(errno);
+        return false;
+    }
+
+    std::vector<RawEntry> raw;
+    if(!readEntries(fd, path, raw))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    metrics.stats += raw.size();
+
+    const auto threadCount = std::max<std::size_t>(1, std::min<std::size_t>(threads, raw.size() / statsPerThread));
+
+    bool ok = true;
+    if(threadCount == 1)
+        ok = statEntries(fd, path, raw.data(), raw.data() + raw.size());
+    else
+    {
+        std::atomic<bool> failed { false };
+        std::vector<std::thread> statThreads;
+
+        const auto perThread = (raw.size() + threadCount - 1) / threadCount;
+        for(std::size_t begin = 0; begin < raw.size(); begin += perThread)
+        {
+            const auto end = std::min(begin + perThread, raw.size());
+            statThreads.emplace_back([&, begin, end](){
+                if(!statEntries(fd, path, raw.data() + begin, raw.data() + end))
+                    failed = true;
+            });
+        }
+
+        for(auto &thread : statThreads)
+            thread.join();
+
+        ok = !failed;
+    }
+
+    ::close(fd);
+
+    if(!ok)
+        return false;
+
+    entries.clear();
+    entries.reserve(raw.size());
+    for(const auto &entry : raw)
+        if(entry.keep)
+            entries.append(DirEntry { QFile::decodeName(entry.name), entry.stat });
+
+    std::sort(entries.begin(), entries.end(), [](const DirEntry &a, const DirEntry &b){ return a.name < b.name; });
+
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <QString>
+#include <QVector>
+
+#include "statcache.h"
+
+//! One entry of a scanned directory, only regular files and directories
+struct DirEntry
+{
+    QString name;
+    StatCache::Stat stat;
+};
+
+//! Lists path with getdents64() and stats the entries with fstatat() relative
+//! to the directory fd, so no path gets resolved from the root per entry.
+//! Directories with many entries are statted on up to threads threads. Like
+//! QDir, hidden entries are skipped and symlinks are followed. The entries
+//! come back sorted by name.
+bool scanDirectory(const QString &path, int threads, QVector<DirEntry> &entries);
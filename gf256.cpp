@@ -0,0 +1,95 @@
+#include "gf256.h"
+#include "gf256_p.h"
+
+namespace {
+//! x^8 + x^4 + x^3 + x^2 + 1, 2 generates the whole multiplicative group
+const unsigned polynomial { 0x11D };
+
+struct Tables
+{
+    std::uint8_t exp[510];
+    std::uint8_t log[256];
+
+    Tables()
+    {
+        unsigned x = 1;
+        for(int i = 0; i < 255; i++)
+        {
+            exp[i] = exp[i + 255] = std::uint8_t(x);
+            log[x] = std::uint8_t(i);
+            x <<= 1;
+            if(x & 0x100)
+                x ^= polynomial;
+        }
+        log[0] = 0;
+    }
+};
+
+const Tables &tables()
+{
+    static const Tables instance;
+    return instance;
+}
+
+gf256::MulAdd detectKernel()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return gf256::mulAddAvx2;
+    if(__builtin_cpu_supports("ssse3"))
+        return gf256::mulAddSsse3;
+#endif
+    return gf256::mulAddPortable;
+}
+
+gf256::MulAdd &kernel()
+{
+    static gf256::MulAdd cpuKernel = detectKernel();
+    return cpuKernel;
+}
+}
+
+namespace gf256 {
+std::uint8_t mul(std::uint8_t a, std::uint8_t b)
+{
+    if(!a || !b)
+        return 0;
+    const auto &t = tables();
+    return t.exp[t.log[a] + t.log[b]];
+}
+
+std::uint8_t inv(std::uint8_t a)
+{
+    const auto &t = tables();
+    return t.exp[255 - t.log[a]];
+}
+
+void mulAdd(std::uint8_t *dst, const std::uint8_t *src, std::uint8_t c, std::size_t length)
+{
+    if(!c)
+        return;
+
+    std::uint8_t low[16];
+    std::uint8_t high[16];
+    for(int n = 0; n < 16; n++)
+    {
+        low[n] = mul(c, std::uint8_t(n));
+        high[n] = mul(c, std::uint8_t(n << 4));
+    }
+
+    kernel()(dst, src, low, high, length);
+}
+
+void setKernel(MulAdd mulAdd)
+{
+    kernel() = mulAdd;
+}
+
+void mulAddPortable(std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t low[16],
+                    const std::uint8_t high[16], std::size_t length)
+{
+    for(std::size_t i = 0; i < length; i++)
+        dst[i] ^= low[src[i] & 15] ^ high[src[i] >> 4];
+}
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+//! Arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1, what
+//! the Reed-Solomon parity of the parts is computed in. Adding is xor.
+namespace gf256 {
+std::uint8_t mul(std::uint8_t a, std::uint8_t b);
+//! a must not be 0
+std::uint8_t inv(std::uint8_t a);
+
+//! dst ^= c * src over length bytes, 32 or 16 bytes per step where the cpu
+//! has avx2 or ssse3
+void mulAdd(std::uint8_t *dst, const std::uint8_t *src, std::uint8_t c, std::size_t length);
+}
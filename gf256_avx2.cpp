@@ -0,0 +1,34 @@
+// Multiplies 32 bytes at once through vpshufb lookups of the nibble products.
+// Built with -mavx2 and only called after checking the cpu supports it.
+
+#include "gf256_p.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace gf256 {
+void mulAddAvx2(std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t low[16],
+                const std::uint8_t high[16], std::size_t length)
+{
+    //vpshufb looks up within each 128 bit lane, both lanes get the table
+    const auto lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(low)));
+    const auto highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i *>(high)));
+    const auto mask = _mm256_set1_epi8(0x0F);
+
+    std::size_t i = 0;
+    for(; i + 32 <= length; i += 32)
+    {
+        const auto x = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+        const auto product = _mm256_xor_si256(_mm256_shuffle_epi8(lowTable, _mm256_and_si256(x, mask)),
+                                              _mm256_shuffle_epi8(highTable, _mm256_and_si256(_mm256_srli_epi64(x, 4), mask)));
+        const auto target = reinterpret_cast<__m256i *>(dst + i);
+        _mm256_storeu_si256(target, _mm256_xor_si256(_mm256_loadu_si256(target), product));
+    }
+
+    //the rest still gets 16 bytes at a time, the avx2 check implies ssse3
+    mulAddSsse3(dst + i, src + i, low, high, length - i);
+}
+}
+
+#endif
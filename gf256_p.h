@@ -0,0 +1,28 @@
+#pragma once
+
+// Shared between the portable and the SIMD GF(2^8) code, not part of the api.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gf256 {
+//! dst ^= c * src with the products of c split by nibble: low[n] = c * n and
+//! high[n] = c * (n << 4), so c * x = low[x & 15] ^ high[x >> 4]
+using MulAdd = void (*)(std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t low[16],
+                        const std::uint8_t high[16], std::size_t length);
+
+//! Replaces the kernel picked for the cpu, for the tests. Not while anything
+//! is encoding.
+void setKernel(MulAdd mulAdd);
+
+void mulAddPortable(std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t low[16],
+                    const std::uint8_t high[16], std::size_t length);
+
+#if defined(__x86_64__) || defined(__i386__)
+void mulAddSsse3(std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t low[16],
+                 const std::uint8_t high[16], std::size_t length);
+
+void mulAddAvx2(std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t low[16],
+                const std::uint8_t high[16], std::size_t length);
+#endif
+}
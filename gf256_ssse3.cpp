@@ -0,0 +1,32 @@
+// Multiplies 16 bytes at once through pshufb lookups of the nibble products.
+// Built with -mssse3 and only called after checking the cpu supports it.
+
+#include "gf256_p.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+
+#include <immintrin.h>
+
+namespace gf256 {
+void mulAddSsse3(std::uint8_t *dst, const std::uint8_t *src, const std::uint8_t low[16],
+                 const std::uint8_t high[16], std::size_t length)
+{
+    const auto lowTable = _mm_loadu_si128(reinterpret_cast<const __m128i *>(low));
+    const auto highTable = _mm_loadu_si128(reinterpret_cast<const __m128i *>(high));
+    const auto mask = _mm_set1_epi8(0x0F);
+
+    std::size_t i = 0;
+    for(; i + 16 <= length; i += 16)
+    {
+        const auto x = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+        const auto product = _mm_xor_si128(_mm_shuffle_epi8(lowTable, _mm_and_si128(x, mask)),
+                                           _mm_shuffle_epi8(highTable, _mm_and_si128(_mm_srli_epi64(x, 4), mask)));
+        const auto target = reinterpret_cast<__m128i *>(dst + i);
+        _mm_storeu_si128(target, _mm_xor_si128(_mm_loadu_si128(target), product));
+    }
+
+    mulAddPortable(dst + i, src + i, low, high, length - i);
+}
+}
+
+#endif
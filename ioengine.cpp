@@ -0,0 +1,416 @@
+#include "ioengine.h"
+
+#include <QDebug>
+#include <QFile>
+
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include "bitmap.h"
+#include "metrics.h"
+
+namespace {
+//! The links of one chain, also the low byte of its user_data
+enum Step { Open, Header, Content, Padding, Sync, Close, StepCount };
+
+//! every slot has its header on a cache line of its own
+const int headerStride { 64 };
+//! the padding is less than one row of at most 65536 pixels
+const size_t zeroSize { 4 * 65536 };
+
+int ioUringSetup(unsigned entries, io_uring_params *params)
+{
+    return int(syscall(__NR_io_uring_setup, entries, params));
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+int ioUringRegister(int fd, unsigned opcode, const void *arg, unsigned nrArgs)
+{
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+}
+
+std::unique_ptr<IoEngine> IoEngine::create(int queueDepth)
+{
+    std::unique_ptr<IoEngine> engine(new IoEngine(queueDepth));
+    if(!engine->setup())
+    {
+        static std::once_flag once;
+        std::call_once(once, [](){ qInfo() << "io_uring is not usable, writing bitmaps one at a time"; });
+        return nullptr;
+    }
+
+    return engine;
+}
+
+IoEngine::IoEngine(int queueDepth) :
+    m_queueDepth(qMax(1, queueDepth)),
+    m_batchSize(qMax(1, m_queueDepth / 4))
+{
+}
+
+IoEngine::~IoEngine()
+{
+    //the kernel may still read from the contents and slots
+    if(!m_slots.isEmpty())
+        drain();
+
+    if(m_buffers)
+        munmap(m_buffers, m_buffersSize);
+    if(m_sqes)
+        munmap(m_sqes, m_sqesSize);
+    if(m_ring)
+        munmap(m_ring, m_ringSize);
+    if(m_ringFd != -1)
+        ::close(m_ringFd);
+}
+
+bool IoEngine::setup()
+{
+    io_uring_params params;
+    std::memset(&params, 0, sizeof(params));
+
+    //a chain takes at most StepCount entries, so a full queue of them always fits
+    m_ringFd = ioUringSetup(m_queueDepth * StepCount, &params);
+    if(m_ringFd == -1)
+    {
+        qCDebug(picsyncTrace) << "io_uring_setup failed" << strerror(errno);
+        return false;
+    }
+
+    //opening into a registered slot (5.15) has no feature flag of its own, CQE_SKIP came right after it
+    if(!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_CQE_SKIP))
+    {
+        qCDebug(picsyncTrace) << "io_uring is too old" << params.features;
+        return false;
+    }
+
+    m_ringSize = qMax<size_t>(params.sq_off.array + params.sq_entries * sizeof(unsigned),
+                              params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe));
+    m_ring = mmap(nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQ_RING);
+    if(m_ring == MAP_FAILED)
+    {
+        m_ring = nullptr;
+        qCDebug(picsyncTrace) << "could not map io_uring" << strerror(errno);
+        return false;
+    }
+
+    m_sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    const auto sqes = mmap(nullptr, m_sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_ringFd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED)
+    {
+        qCDebug(picsyncTrace) << "could not map io_uring entries" << strerror(errno);
+        return false;
+    }
+    m_sqes = static_cast<io_uring_sqe *>(sqes);
+
+    const auto ring = static_cast<char *>(m_ring);
+    m_sqTail = reinterpret_cast<unsigned *>(ring + params.sq_off.tail);
+    m_sqMask = reinterpret_cast<unsigned *>(ring + params.sq_off.ring_mask);
+    m_sqArray = reinterpret_cast<unsigned *>(ring + params.sq_off.array);
+    m_cqHead = reinterpret_cast<unsigned *>(ring + params.cq_off.head);
+    m_cqTail = reinterpret_cast<unsigned *>(ring + params.cq_off.tail);
+    m_cqMask = reinterpret_cast<unsigned *>(ring + params.cq_off.ring_mask);
+    m_cqes = reinterpret_cast<io_uring_cqe *>(ring + params.cq_off.cqes);
+    m_localTail = *m_sqTail;
+
+    //every op of a chain has to be there, some kernels have them disabled
+    {
+        const int opCount = 256;
+        QByteArray buffer(sizeof(io_uring_probe) + opCount * sizeof(io_uring_probe_op), '\0');
+        const auto probe = reinterpret_cast<io_uring_probe *>(buffer.data());
+        if(ioUringRegister(m_ringFd, IORING_REGISTER_PROBE, probe, opCount) == -1)
+        {
+            qCDebug(picsyncTrace) << "could not probe io_uring" << strerror(errno);
+            return false;
+        }
+
+        for(const int op : { IORING_OP_OPENAT, IORING_OP_WRITE_FIXED, IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE })
+            if(op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+                qCDebug(picsyncTrace) << "io_uring lacks op" << op;
+                return false;
+            }
+    }
+
+    //pinned once here instead of for every header and padding write
+    m_buffersSize = m_queueDepth * headerStride + zeroSize;
+    const auto buffers = mmap(nullptr, m_buffersSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(buffers == MAP_FAILED)
+    {
+        qCDebug(picsyncTrace) << "could not allocate io_uring buffers" << strerror(errno);
+        return false;
+    }
+    m_buffers = static_cast<char *>(buffers);
+
+    const struct iovec iov[2] {
+        { m_buffers, size_t(m_queueDepth * headerStride) },
+        { m_buffers + m_queueDepth * headerStride, zeroSize }
+    };
+    if(ioUringRegister(m_ringFd, IORING_REGISTER_BUFFERS, iov, 2) == -1)
+    {
+        qCDebug(picsyncTrace) << "could not register io_uring buffers" << strerror(errno);
+        return false;
+    }
+
+    //one empty file slot per chain, opened into and closed by the chain itself
+    const QVector<int> fds(m_queueDepth, -1);
+    if(ioUringRegister(m_ringFd, IORING_REGISTER_FILES, fds.constData(), fds.size()) == -1)
+    {
+        qCDebug(picsyncTrace) << "could not register io_uring files" << strerror(errno);
+        return false;
+    }
+
+    m_slots.resize(m_queueDepth);
+    for(auto &slot : m_slots)
+        slot.expected.resize(StepCount);
+    for(int i = m_queueDepth - 1; i >= 0; i--)
+        m_freeSlots.append(i);
+
+    return true;
+}
+
+void IoEngine::writeBitmap(const QString &filename, const QByteArray &content, bool sync, Done done)
+{
+    qCDebug(picsyncTrace) << "writeBitmap" << filename << "queued";
+
+    while(m_freeSlots.isEmpty())
+    {
+        if(!enter(1))
+        {
+            //the ring is unusable, at least this bitmap still gets written
+            m_failed = true;
+            done(::writeBitmap(filename, content, sync));
+            return;
+        }
+
+        reap();
+    }
+
+    const auto slot = m_freeSlots.takeLast();
+    {
+        auto &s = m_slots[slot];
+        s.filename = filename;
+        s.encodedFilename = QFile::encodeName(filename);
+        s.content = content;
+        s.sync = sync;
+        s.done = std::move(done);
+        s.failed = false;
+        s.closed = false;
+    }
+    const auto &s = m_slots.at(slot);
+
+    const auto header = m_buffers + slot * headerStride;
+    const auto paddingSize = bitmapHeader(content.length(), reinterpret_cast<unsigned char *>(header));
+    const auto zeros = m_buffers + m_queueDepth * headerStride;
+    m_slots[slot].fileSize = bitmapHeaderSize + content.length() + paddingSize;
+
+    auto sqe = nextSqe(slot, Open, 0);
+    sqe->opcode = IORING_OP_OPENAT;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<quintptr>(s.encodedFilename.constData());
+    sqe->len = 0666;
+    //no O_CLOEXEC, the kernel rejects it for a registered slot, which no child inherits anyway
+    sqe->open_flags = O_WRONLY | O_CREAT | O_TRUNC;
+    sqe->file_index = slot + 1;
+
+    sqe = nextSqe(slot, Header, bitmapHeaderSize);
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+    sqe->fd = slot;
+    sqe->addr = reinterpret_cast<quintptr>(header);
+    sqe->len = bitmapHeaderSize;
+    sqe->off = 0;
+    sqe->buf_index = 0;
+
+    if(content.length())
+    {
+        sqe = nextSqe(slot, Content, content.length());
+        sqe->opcode = IORING_OP_WRITE;
+        sqe->flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+        sqe->fd = slot;
+        sqe->addr = reinterpret_cast<quintptr>(s.content.constData());
+        sqe->len = content.length();
+        sqe->off = bitmapHeaderSize;
+    }
+
+    if(paddingSize)
+    {
+        sqe = nextSqe(slot, Padding, paddingSize);
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+        sqe->fd = slot;
+        sqe->addr = reinterpret_cast<quintptr>(zeros);
+        sqe->len = paddingSize;
+        sqe->off = bitmapHeaderSize + content.length();
+        sqe->buf_index = 1;
+    }
+
+    if(sync)
+    {
+        sqe = nextSqe(slot, Sync, 0);
+        sqe->opcode = IORING_OP_FSYNC;
+        sqe->flags = IOSQE_IO_LINK | IOSQE_FIXED_FILE;
+        sqe->fd = slot;
+        sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+    }
+
+    //a short write or error above cancels the close, finish() clears the slot then
+    sqe = nextSqe(slot, Close, 0);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->file_index = slot + 1;
+
+    //batched, so one syscall submits several chains
+    if(++m_queuedChains >= m_batchSize)
+    {
+        if(!enter(0))
+            m_failed = true;
+        reap();
+    }
+}
+
+bool IoEngine::drain()
+{
+    while(m_freeSlots.size() < m_slots.size())
+    {
+        if(!enter(1))
+        {
+            m_failed = true;
+            break;
+        }
+
+        reap();
+    }
+
+    const auto written = !m_failed;
+    m_failed = false;
+    return written;
+}
+
+io_uring_sqe *IoEngine::nextSqe(int slot, int step, int expected)
+{
+    const auto index = m_localTail & *m_sqMask;
+
+    auto sqe = &m_sqes[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (quint64(slot) << 8) | step;
+
+    m_sqArray[index] = index;
+    m_localTail++;
+    m_unsubmitted++;
+
+    auto &s = m_slots[slot];
+    s.expected[step] = expected;
+    s.pending++;
+
+    return sqe;
+}
+
+bool IoEngine::enter(unsigned minComplete)
+{
+    MetricsTimer timer(metrics.writeNsecs);
+
+    //the entries have to be visible before the kernel learns about them
+    __atomic_store_n(m_sqTail, m_localTail, __ATOMIC_RELEASE);
+
+    while(true)
+    {
+        const auto submitted = ioUringEnter(m_ringFd, m_unsubmitted, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0);
+        if(submitted == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            qWarning() << "could not submit to io_uring" << strerror(errno);
+            return false;
+        }
+
+        m_unsubmitted -= submitted;
+        m_queuedChains = 0;
+        return true;
+    }
+}
+
+void IoEngine::reap()
+{
+    QVector<int> finished;
+
+    auto head = *m_cqHead;
+    const auto tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    for(; head != tail; head++)
+    {
+        const auto &cqe = m_cqes[head & *m_cqMask];
+        const int slot = cqe.user_data >> 8;
+        const int step = cqe.user_data & 0xFF;
+
+        auto &s = m_slots[slot];
+        if(cqe.res != s.expected.at(step))
+        {
+            if(!s.failed)
+                qCDebug(picsyncTrace) << "io_uring step" << step << "failed" << s.filename << (cqe.res < 0 ? strerror(-cqe.res) : "short write");
+            s.failed = true;
+        }
+        else if(step == Close)
+            s.closed = true;
+
+        if(!--s.pending)
+            finished.append(slot);
+    }
+
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+    for(const auto slot : finished)
+        finish(slot);
+}
+
+void IoEngine::finish(int slot)
+{
+    auto &s = m_slots[slot];
+
+    auto written = !s.failed;
+    if(written)
+    {
+        metrics.bitmapsWritten++;
+        metrics.bytesWritten += s.fileSize;
+    }
+    else
+    {
+        //the chain broke before its close, the slot still holds the file
+        if(!s.closed)
+        {
+            const int fd { -1 };
+            io_uring_files_update update;
+            std::memset(&update, 0, sizeof(update));
+            update.offset = slot;
+            update.fds = reinterpret_cast<quintptr>(&fd);
+            ioUringRegister(m_ringFd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+        }
+
+        //redone blocking, which also reports why it fails if it does
+        written = ::writeBitmap(s.filename, s.content, s.sync);
+        if(!written)
+            m_failed = true;
+    }
+
+    const auto done = std::move(s.done);
+    s.done = nullptr;
+    s.content.clear();
+    m_freeSlots.append(slot);
+
+    done(written);
+}
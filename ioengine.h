@@ -0,0 +1,97 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+#include <memory>
+
+//! Keeps many bitmap writes in flight on an io_uring instead of waiting for
+//! them one at a time, which is what makes high latency targets (network
+//! mounts, sync folders) slow.
+//!
+//! Every bitmap is one linked chain: open into a registered file slot, write
+//! the header and the padding from registered buffers and the content from
+//! its QByteArray, optionally fdatasync and close. Chains are submitted in
+//! batches. A chain that fails anywhere is redone with the blocking
+//! writeBitmap(), which also reports the error.
+//!
+//! Not thread safe, every thread needs an engine of its own.
+class IoEngine
+{
+    Q_DISABLE_COPY(IoEngine)
+
+public:
+    //! Called on the submitting thread once the bitmap is written, or failed to
+    using Done = std::function<void(bool written)>;
+
+    //! nullptr if the kernel has no usable io_uring (older than 5.17, or
+    //! disabled), callers then stay with writeBitmap()
+    static std::unique_ptr<IoEngine> create(int queueDepth);
+
+    ~IoEngine();
+
+    //! writeBitmap() without waiting for it, content is kept alive until done.
+    //! Only blocks while queueDepth bitmaps are in flight.
+    void writeBitmap(const QString &filename, const QByteArray &content, bool sync, Done done);
+
+    //! Waits for everything queued, false if a write failed since the last drain()
+    bool drain();
+
+private:
+    struct Slot
+    {
+        QString filename;
+        QByteArray encodedFilename;
+        QByteArray content;
+        bool sync;
+        quint32 fileSize;
+        Done done;
+        //! submission queue entries of the chain without a completion yet
+        int pending { 0 };
+        bool failed { false };
+        bool closed { false };
+        //! expected result per step of the chain
+        QVector<int> expected;
+    };
+
+    explicit IoEngine(int queueDepth);
+
+    bool setup();
+    struct io_uring_sqe *nextSqe(int slot, int step, int expected);
+    bool enter(unsigned minComplete);
+    void reap();
+    void finish(int slot);
+
+    const int m_queueDepth;
+    //! queued chains that trigger a submit
+    const int m_batchSize;
+
+    int m_ringFd { -1 };
+    //! submission and completion ring share one mapping
+    void *m_ring { nullptr };
+    size_t m_ringSize { 0 };
+    struct io_uring_sqe *m_sqes { nullptr };
+    size_t m_sqesSize { 0 };
+
+    unsigned *m_sqTail { nullptr };
+    unsigned *m_sqMask { nullptr };
+    unsigned *m_sqArray { nullptr };
+    unsigned *m_cqHead { nullptr };
+    unsigned *m_cqTail { nullptr };
+    unsigned *m_cqMask { nullptr };
+    struct io_uring_cqe *m_cqes { nullptr };
+
+    //! the headers of all slots and the zero padding, registered as two buffers
+    char *m_buffers { nullptr };
+    size_t m_buffersSize { 0 };
+
+    unsigned m_localTail { 0 };
+    unsigned m_unsubmitted { 0 };
+    int m_queuedChains { 0 };
+
+    QVector<Slot> m_slots;
+    QVector<int> m_freeSlots;
+    bool m_failed { false };
+};
@@ -0,0 +1,115 @@
+#include "journal.h"
+
+#include <QDebug>
+#include <QJsonDocument>
+#include <QStringBuilder>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+FileJournal::FileJournal(const QDir &targetDir) :
+    m_path(targetDir.absoluteFilePath(QStringLiteral("__journal.log")))
+{
+}
+
+bool FileJournal::open(const QByteArray &header)
+{
+    m_resumedParts.clear();
+
+    QFile oldFile(m_path);
+    if(oldFile.exists())
+    {
+        if(!oldFile.open(QIODevice::ReadOnly))
+        {
+            qWarning() << "could not open journal" << oldFile.errorString();
+            return false;
+        }
+
+        if(oldFile.readLine().trimmed() == header)
+        {
+            while(!oldFile.atEnd())
+            {
+                const auto line = oldFile.readLine();
+
+                //a torn last line from the interruption, everything before it is durable
+                if(!line.endsWith('\n'))
+                    break;
+
+                const auto document = QJsonDocument::fromJson(line);
+                if(!document.isObject())
+                {
+                    qWarning() << "ignoring invalid journal line" << line;
+                    break;
+                }
+
+                m_resumedParts.append(document.object());
+            }
+        }
+        else
+            qInfo() << "journal is from another source or other options" << m_path;
+
+        oldFile.close();
+    }
+
+    //rewritten without what was dropped, so appending can not continue a torn line
+    {
+        const auto tempPath = m_path % ".tmp";
+
+        QFile tempFile(tempPath);
+        if(!tempFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "could not open journal" << tempFile.errorString();
+            return false;
+        }
+
+        tempFile.write(header + '\n');
+        for(const auto &part : m_resumedParts)
+            tempFile.write(QJsonDocument(part).toJson(QJsonDocument::Compact) + '\n');
+
+        if(!tempFile.flush() || fdatasync(tempFile.handle()) == -1)
+        {
+            qWarning() << "could not write journal" << tempFile.errorString();
+            return false;
+        }
+        tempFile.close();
+
+        if(::rename(QFile::encodeName(tempPath).constData(), QFile::encodeName(m_path).constData()) == -1)
+        {
+            qWarning() << "could not replace journal" << strerror(errno);
+            return false;
+        }
+    }
+
+    m_file.setFileName(m_path);
+    if(!m_file.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qWarning() << "could not open journal" << m_file.errorString();
+        return false;
+    }
+
+    if(!m_resumedParts.isEmpty())
+        qInfo() << "resuming with" << m_resumedParts.size() << "parts from the journal" << m_path;
+
+    return true;
+}
+
+bool FileJournal::append(const QJsonObject &part)
+{
+    const auto line = QJsonDocument(part).toJson(QJsonDocument::Compact) + '\n';
+    if(m_file.write(line) != line.size() || !m_file.flush())
+    {
+        qWarning() << "could not write journal" << m_file.errorString();
+        return false;
+    }
+
+    if(fdatasync(m_file.handle()) == -1)
+    {
+        qWarning() << "could not sync journal" << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
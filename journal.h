@@ -0,0 +1,38 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QFile>
+#include <QJsonObject>
+#include <QVector>
+
+//! Append-only log of the parts of one file spread that are durably on disk
+//! (__journal.log in the file's target directory).
+//!
+//! The first line describes the source and the options the parts were cut
+//! with. A run that finds a journal with the same first line takes over the
+//! parts listed in it instead of writing them again, so an interrupted spread
+//! resumes from its last durable part. The journal goes away with the stale
+//! parts once the new index replaced the old one.
+class FileJournal
+{
+    Q_DISABLE_COPY(FileJournal)
+
+public:
+    explicit FileJournal(const QDir &targetDir);
+
+    //! Starts a journal for header, keeping the parts of an earlier one with
+    //! the same header. A torn last line is dropped.
+    bool open(const QByteArray &header);
+
+    //! What an interrupted run left behind, in file order
+    const QVector<QJsonObject> &resumedParts() const { return m_resumedParts; }
+
+    //! Logs a part once its bitmap is durable
+    bool append(const QJsonObject &part);
+
+private:
+    const QString m_path;
+    QFile m_file;
+    QVector<QJsonObject> m_resumedParts;
+};
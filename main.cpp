@@ -2,623 +2,546 @@
 #include <QDebug>
 #include <QDir>
 #include <QFile>
-#include <qmath.h>
-#include <QDataStream>
-#include <QDateTime>
-#include <QCryptographicHash>
-#include <QJsonObject>
-#include <QJsonArray>
-#include <QJsonDocument>
+#include <QFileInfo>
 #include <QCommandLineParser>
 #include <QCommandLineOption>
-#include <QStringBuilder>
-#include <QUuid>
-#include <QtGlobal>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QScopedPointer>
+#include <QThread>
+
+#include <limits>
+
+#include <unistd.h>
+
+#include "bufferpool.h"
+#include "changelog.h"
+#include "compile.h"
+#include "digest.h"
+#include "manifest.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "packs.h"
+#include "parity.h"
+#include "spread.h"
+#include "spreadfile.h"
+#include "statcache.h"
+#include "verify.h"
 
-#include "utils/fileutils.h"
-
-bool writeBitmap(const QString &filename, const QByteArray &content)
+int main(int argc, char *argv[])
 {
-    qDebug() << "writeBitmap" << filename;
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("picsync");
+    QCoreApplication::setApplicationVersion("1.0");
 
-    QFile file(filename);
-    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
-    {
-        qWarning() << "could not open file" << file.errorString();
-        return false;
-    }
+    qSetMessagePattern("%{time dd.MM.yyyy HH:mm:ss.zzz} "
+                       "["
+                       "%{if-debug}DEBUG%{endif}"
+                       "%{if-info}INFO%{endif}"
+                       "%{if-warning}WARN%{endif}"
+                       "%{if-critical}CRIT%{endif}"
+                       "%{if-fatal}FATAL%{endif}"
+                       "] "
+                       "%{function}(): "
+                       "%{message}");
 
-    const quint64 pixels = std::ceil(content.length() / 4.0);
-    const quint32 width = std::sqrt(pixels);
-    const quint32 height = std::ceil(pixels / (qreal)width);
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QCoreApplication::translate("main", "Lets you convert any file into pictures. Mostly used in combination with cloud storage."));
+    parser.addHelpOption();
+    parser.addVersionOption();
 
-    const quint32 bitmapSize = width * height * 4;
+    QCommandLineOption actionOption(QStringList() << "a" << "action", QCoreApplication::translate("main", "Action (spread, compile, verify or cat)"), QCoreApplication::translate("main", "action"));
+    parser.addOption(actionOption);
 
-    {
-        QDataStream dataStream(&file);
-        dataStream.setByteOrder(QDataStream::LittleEndian);
-
-        //BMP Header
-        dataStream << (quint16)0x4D42;            //BM-Header
-        dataStream << (quint32)(54 + bitmapSize); //File size
-        dataStream << content.length();           //Unused (and abused for content length)
-        dataStream << (quint32)54;                //Offset to bitmap data
-
-        //DIB Header
-        dataStream << (quint32)40;                //DIP Header size
-        dataStream << width;                      //width
-        dataStream << height;                     //height
-        dataStream << (quint16)1;                 //Number of color planes
-        dataStream << (quint16)32;                //Bits per pixel
-        dataStream << (quint32)0;                 //No compression;
-        dataStream << bitmapSize;                 //Size of bitmap data
-        dataStream << (quint32)2835;              //Horizontal print resolution
-        dataStream << (quint32)2835;              //Horizontal print resolution
-        dataStream << (quint32)0;                 //Number of colors in palette
-        dataStream << (quint32)0;                 //Important colors
-    }
+    QCommandLineOption sourceOption(QStringList() << "s" << "source", QCoreApplication::translate("main", "Source file or directory, - spreads stdin"), QCoreApplication::translate("main", "some_file"));
+    parser.addOption(sourceOption);
 
-    file.write(content);
-    file.write(QByteArray((width * height * 4) - content.length(), '\0'));
+    QCommandLineOption targetOption(QStringList() << "t" << "target", QCoreApplication::translate("main", "Target directory, - compiles a single file to stdout"), QCoreApplication::translate("main", "some_directory"));
+    parser.addOption(targetOption);
 
-    return true;
-}
+    QCommandLineOption pathOption("path", QCoreApplication::translate("main", "File to cat, relative to the source"), QCoreApplication::translate("main", "some_file"));
+    parser.addOption(pathOption);
 
-bool readBitmap(const QString &filename, QByteArray &content)
-{
-    qDebug() << "readBitmap" << filename;
+    QCommandLineOption offsetOption("offset", QCoreApplication::translate("main", "First byte to cat"), QCoreApplication::translate("main", "bytes"), QStringLiteral("0"));
+    parser.addOption(offsetOption);
+
+    QCommandLineOption lengthOption("length", QCoreApplication::translate("main", "Number of bytes to cat (default up to the end)"), QCoreApplication::translate("main", "bytes"));
+    parser.addOption(lengthOption);
+
+    QCommandLineOption jobsOption(QStringList() << "j" << "jobs", QCoreApplication::translate("main", "Number of parallel jobs for spread, compile and verify (0 for one per core)"), QCoreApplication::translate("main", "jobs"), QStringLiteral("1"));
+    parser.addOption(jobsOption);
+
+    QCommandLineOption verifyOption("verify", QCoreApplication::translate("main", "Re-hash files whose size and modification time did not change and re-spread them if their content did"));
+    parser.addOption(verifyOption);
+
+    QCommandLineOption hashOption("hash", QCoreApplication::translate("main", "Digest for new indexes, sha512 (with sha256 per part) or blake3 (faster, uses several cores per file)"), QCoreApplication::translate("main", "algorithm"), QStringLiteral("sha512"));
+    parser.addOption(hashOption);
+
+    QCommandLineOption cdcOption("cdc", QCoreApplication::translate("main", "Cut files at content defined boundaries so unchanged regions keep their parts"));
+    parser.addOption(cdcOption);
+
+    QCommandLineOption chunkSizesOption("chunk-sizes", QCoreApplication::translate("main", "Minimum, average and maximum part size in KiB for --cdc"), QCoreApplication::translate("main", "min:avg:max"), QStringLiteral("1024:4096:16384"));
+    parser.addOption(chunkSizesOption);
+
+    QCommandLineOption compressOption("compress", QCoreApplication::translate("main", "Compress parts with zlib at this level (1-9), parts that look compressed already stay raw"), QCoreApplication::translate("main", "level"));
+    parser.addOption(compressOption);
 
-    QFile file(filename);
-    if(!file.exists())
+    QCommandLineOption noJournalOption("no-journal", QCoreApplication::translate("main", "Do not journal the parts of big files, an interrupted spread then starts them over"));
+    parser.addOption(noJournalOption);
+
+    QCommandLineOption ioUringOption("io-uring", QCoreApplication::translate("main", "Keep up to this many part bitmaps of a big file in flight on an io_uring, falls back to blocking writes without one"), QCoreApplication::translate("main", "depth"));
+    parser.addOption(ioUringOption);
+
+    QCommandLineOption parityOption("parity", QCoreApplication::translate("main", "Add m parity bitmaps to every k parts of a file, compile and verify rebuild up to m lost parts of each run from them"), QCoreApplication::translate("main", "k:m"));
+    parser.addOption(parityOption);
+
+    QCommandLineOption maxMemoryOption("max-memory", QCoreApplication::translate("main", "Budget in MiB for the parts all jobs hold at once, reading waits when it is used up (0 is unlimited)"), QCoreApplication::translate("main", "size"), QStringLiteral("0"));
+    parser.addOption(maxMemoryOption);
+
+    QCommandLineOption objectStoreOption("object-store", QCoreApplication::translate("main", "Shared directory for deduplicated parts (compile defaults to __objects in the source)"), QCoreApplication::translate("main", "some_directory"));
+    parser.addOption(objectStoreOption);
+
+    QCommandLineOption manifestOption("manifest", QCoreApplication::translate("main", "Also write a binary __manifest.bmp of the whole tree, compile prefers it over the indexes"));
+    parser.addOption(manifestOption);
+
+    QCommandLineOption packOption("pack", QCoreApplication::translate("main", "Append files smaller than --pack-threshold to shared bitmaps in __packs instead of giving each its own part"));
+    parser.addOption(packOption);
+
+    QCommandLineOption packThresholdOption("pack-threshold", QCoreApplication::translate("main", "Size in KiB below which --pack packs a file"), QCoreApplication::translate("main", "size"), QStringLiteral("64"));
+    parser.addOption(packThresholdOption);
+
+    QCommandLineOption changeLogOption("change-log", QCoreApplication::translate("main", "Append every bitmap spread creates or removes to this file, so an uploader does not have to rescan the target"), QCoreApplication::translate("main", "some_file"));
+    parser.addOption(changeLogOption);
+
+    QCommandLineOption outboxOption("outbox", QCoreApplication::translate("main", "Also hardlink every created bitmap into this directory (same filesystem as the target), for --change-log"), QCoreApplication::translate("main", "some_directory"));
+    parser.addOption(outboxOption);
+
+    QCommandLineOption stateOption("state", QCoreApplication::translate("main", "Local state file, lets spread skip unchanged files and directories without reading the target"), QCoreApplication::translate("main", "some_file"));
+    parser.addOption(stateOption);
+
+    QCommandLineOption progressOption("progress", QCoreApplication::translate("main", "Seconds between progress lines (0 to disable)"), QCoreApplication::translate("main", "seconds"), QStringLiteral("5"));
+    parser.addOption(progressOption);
+
+    QCommandLineOption metricsJsonOption("metrics-json", QCoreApplication::translate("main", "Write counters and timings as json when done"), QCoreApplication::translate("main", "some_file"));
+    parser.addOption(metricsJsonOption);
+
+    QCommandLineOption verboseOption("verbose", QCoreApplication::translate("main", "Log every node and bitmap"));
+    parser.addOption(verboseOption);
+
+    parser.process(app);
+
+    if(parser.isSet(verboseOption))
+        QLoggingCategory::setFilterRules(QStringLiteral("picsync.trace.debug=true"));
+
+    if(!parser.isSet(actionOption))
     {
-        qWarning() << "file does not exist";
-        return false;
+        qCritical() << "no action set";
+        parser.showHelp();
+        return -1;
     }
-    if(!file.open(QIODevice::ReadOnly))
+
+    enum { ActionSpread, ActionCompile, ActionVerify, ActionCat } action;
+
+    if(parser.value(actionOption) == QStringLiteral("spread"))
+        action = ActionSpread;
+    else if(parser.value(actionOption) == QStringLiteral("compile"))
+        action = ActionCompile;
+    else if(parser.value(actionOption) == QStringLiteral("verify"))
+        action = ActionVerify;
+    else if(parser.value(actionOption) == QStringLiteral("cat"))
+        action = ActionCat;
+    else
     {
-        qWarning() << "could not open file" << file.errorString();
-        return false;
+        qCritical() << "unknown action" << parser.value(actionOption);
+        parser.showHelp();
+        return -2;
     }
 
-    if(file.size() < 14)
+    if(!parser.isSet(sourceOption))
     {
-        qWarning() << "not enough bytes";
-        return false;
+        qCritical() << "source not set";
+        parser.showHelp();
+        return -3;
     }
 
-    QDataStream dataStream(&file);
-    dataStream.setByteOrder(QDataStream::LittleEndian);
+    //streams are spread as a single file and compiled from one
+    const auto sourceStream = action == ActionSpread && parser.value(sourceOption) == QStringLiteral("-");
+    const auto targetStream = action == ActionCompile && parser.value(targetOption) == QStringLiteral("-");
 
+    QFileInfo sourceFileInfo(parser.value(sourceOption));
+    if(!sourceStream && !sourceFileInfo.exists())
     {
-        quint16 bmHeader;
-        dataStream >> bmHeader;
-        if(bmHeader != 0x4D42)
-        {
-            qWarning() << "no BM header";
-            return false;
-        }
+        qCritical() << "source" << parser.value(sourceOption) << "does not exist";
+        parser.showHelp();
+        return -4;
     }
-
+    if(!sourceStream && !sourceFileInfo.isFile() && !sourceFileInfo.isDir())
     {
-        quint32 filesize;
-        dataStream >> filesize;
-        if(filesize != file.size())
-        {
-            qWarning() << "file size does not match!";
-            return false;
-        }
+        qCritical() << "source" << parser.value(sourceOption) << "isnt file nor dir";
+        parser.showHelp();
+        return -5;
     }
 
-    quint32 usedSize;
-    dataStream >> usedSize;
-
-    quint32 offsetBitmapData;
-    dataStream >> offsetBitmapData;
-
-    if(!file.seek(offsetBitmapData))
+    //verify and cat only read the source
+    if(action != ActionVerify && action != ActionCat && !parser.isSet(targetOption))
     {
-        qWarning() << "could not seek";
-        return false;
+        qCritical() << "target not set";
+        parser.showHelp();
+        return -6;
     }
 
-    content = file.read(usedSize);
-
-    if(content.length() != usedSize)
+    const QFileInfo targetFileInfo(parser.value(targetOption));
+    if(!targetStream && targetFileInfo.exists() && !targetFileInfo.isDir())
     {
-        qWarning() << "could not read enough for usedSize";
-        return false;
+        qCritical() << "target" << parser.value(targetOption) << "exists and is not a dir";
+        parser.showHelp();
+        return -7;
     }
 
-    return true;
-}
-
-bool spread(const QString &sourcePath, const QString &targetPath)
-{
-    qDebug() << "spread" << sourcePath << targetPath;
-
-    const QDir targetDir(targetPath);
-
-    if(!targetDir.mkpath(targetDir.absolutePath()))
+    bool jobsOk;
+    auto jobs = parser.value(jobsOption).toInt(&jobsOk);
+    if(!jobsOk || jobs < 0)
     {
-        qWarning() << "could not create target dir";
-        return false;
+        qCritical() << "invalid jobs" << parser.value(jobsOption);
+        parser.showHelp();
+        return -9;
     }
+    if(jobs == 0)
+        jobs = QThread::idealThreadCount();
+
+    SpreadOptions options;
+    options.jobs = jobs;
+    options.verify = parser.isSet(verifyOption);
 
-    const QFileInfo sourceFileInfo(sourcePath);
-    if(!sourceFileInfo.exists())
+    if(!parseDigestAlgorithm(parser.value(hashOption), options.digestAlgorithm))
     {
-        qWarning() << "source does not exist";
-        return false;
+        qCritical() << "invalid hash" << parser.value(hashOption);
+        parser.showHelp();
+        return -13;
     }
+    //the jobs share the cores, a single big file gets all of them
+    options.hashThreads = qMax(1, QThread::idealThreadCount() / jobs);
+    options.compressThreads = options.hashThreads;
 
-    if(sourceFileInfo.isFile())
+    if(parser.isSet(compressOption))
     {
-        bool rewriteIndex = false;
-
-        if(QFile::exists(targetDir.absoluteFilePath(QStringLiteral("__index.bmp"))))
+        bool compressOk;
+        options.compressionLevel = parser.value(compressOption).toInt(&compressOk);
+        if(!compressOk || options.compressionLevel < 1 || options.compressionLevel > 9)
         {
-            QByteArray content;
-            if(readBitmap(targetDir.absoluteFilePath(QStringLiteral("__index.bmp")), content))
-            {
-                QJsonParseError error;
-                auto document = QJsonDocument::fromJson(content, &error);
-                if(error.error != QJsonParseError::NoError)
-                {
-                    qWarning() << "index is invalid: error parsing json" << error.errorString();
-                    return false;
-                }
-                if(!document.isObject())
-                {
-                    qWarning() << "index is invalid: json is not an object";
-                    return false;
-                }
-                const auto jsonObject = document.object();
-
-                if(!jsonObject.contains(QStringLiteral("type")))
-                {
-                    qWarning() << "index is invalid: json does not contain type";
-                    return false;
-                }
-                const auto typeValue = jsonObject.value(QStringLiteral("type"));
-                if(typeValue.type() != QJsonValue::String)
-                {
-                    qWarning() << "index is invalid: json type is not a string";
-                    return false;
-                }
-                const auto type = typeValue.toString();
-
-                if(type == QStringLiteral("file"))
-                {
-                    //TODO: compare lastmodified and size
-                }
-                else if(type == QStringLiteral("directory"))
-                {
-                    qInfo() << "type changed from file to directory";
-                    if(!emptyDirectory(targetDir.absolutePath()))
-                        return false;
-                    rewriteIndex = true;
-                }
-                else
-                {
-                    qWarning() << "index is invalid: unknown type" << type;
-                    rewriteIndex = true;
-                }
-            }
-            else
-                rewriteIndex = true;
+            qCritical() << "invalid compression level" << parser.value(compressOption);
+            parser.showHelp();
+            return -14;
         }
-        else
-            rewriteIndex = true;
-
-        if(rewriteIndex)
-        {
-            if(!emptyDirectory(targetPath))
-                return false;
-
-            QFile sourceFile(sourcePath);
-            if(!sourceFile.open(QIODevice::ReadOnly))
-            {
-                qWarning() << "could not open source file" << sourceFile.errorString();
-                return false;
-            }
-
-            QJsonArray parts;
-
-            QCryptographicHash hash(QCryptographicHash::Sha512);
-            while(sourceFile.pos() < sourceFile.size())
-            {
-                QString filename;
-                QString completePath;
-
-                do
-                {
-                    filename = QUuid::createUuid().toString().remove(QLatin1Char('{')).remove(QLatin1Char('}')) % ".bmp";
-                    completePath = targetDir.absoluteFilePath(filename);
-                }
-                while(QFileInfo(completePath).exists());
-
-                QJsonObject part;
-                part[QStringLiteral("filename")] = filename;
-                part[QStringLiteral("startPos")] = sourceFile.pos();
-
-                const auto buffer = sourceFile.read(2048 * 2048 * 4);
-                hash.addData(buffer);
-
-                part[QStringLiteral("endPos")] = sourceFile.pos();
-                part[QStringLiteral("length")] = buffer.length();
+    }
 
-                if(!writeBitmap(completePath, buffer))
-                    return false;
+    options.journal = !parser.isSet(noJournalOption);
 
-                parts.append(part);
-            }
-
-            QJsonObject jsonObject;
-            jsonObject[QStringLiteral("type")] = QStringLiteral("file");
-            jsonObject[QStringLiteral("filesize")] = sourceFileInfo.size();
-
-            jsonObject[QStringLiteral("birthTime")] = sourceFileInfo
-#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
-                    //deprecated since 5.10
-                    .created()
-#else
-                    .birthTime()
-#endif
-                    .toMSecsSinceEpoch();
-            jsonObject[QStringLiteral("lastModified")] = sourceFileInfo.lastModified().toMSecsSinceEpoch();
-            jsonObject[QStringLiteral("lastRead")] = sourceFileInfo.lastRead().toMSecsSinceEpoch();
-            jsonObject[QStringLiteral("sha512")] = QString(hash.result().toHex());
-            jsonObject[QStringLiteral("parts")] = parts;
-            if(!writeBitmap(targetDir.absoluteFilePath(QStringLiteral("__index.bmp")),
-                            QJsonDocument(jsonObject).toJson(/* QJsonDocument::Compact */))) //amazon has enough storage for spaces!
-                return false;
-        }
-    }
-    else if(sourceFileInfo.isDir())
+    if(parser.isSet(ioUringOption))
     {
-        const QDir sourceDir(sourcePath);
-        if(!sourceDir.exists())
+        bool depthOk;
+        options.ioQueueDepth = parser.value(ioUringOption).toInt(&depthOk);
+        if(!depthOk || options.ioQueueDepth < 1 || options.ioQueueDepth > 1024)
         {
-            qWarning() << "source dir does not exist";
-            return false;
+            qCritical() << "invalid io_uring queue depth" << parser.value(ioUringOption);
+            parser.showHelp();
+            return -17;
         }
+    }
 
-        bool rewriteIndex = false;
-        QStringList oldEntries;
-
-        if(QFile::exists(targetDir.absoluteFilePath(QStringLiteral("__index.bmp"))))
+    if(parser.isSet(parityOption))
+    {
+        const auto parityParts = parser.value(parityOption).split(QLatin1Char(':'));
+        bool dataOk = false, parityOk = false;
+        if(parityParts.size() == 2)
         {
-            QByteArray content;
-            if(readBitmap(targetDir.absoluteFilePath(QStringLiteral("__index.bmp")), content))
-            {
-                QJsonParseError error;
-                const auto document = QJsonDocument::fromJson(content, &error);
-                if(error.error != QJsonParseError::NoError)
-                {
-                    qWarning() << "index is invalid: error parsing json" << error.errorString();
-                    return false;
-                }
-                if(!document.isObject())
-                {
-                    qWarning() << "index is invalid: json is not an object";
-                    return false;
-                }
-                const auto jsonObject = document.object();
-
-                if(!jsonObject.contains(QStringLiteral("type")))
-                {
-                    qWarning() << "index is invalid: json does not contain type";
-                    return false;
-                }
-                const auto typeValue = jsonObject.value(QStringLiteral("type"));
-                if(typeValue.type() != QJsonValue::String)
-                {
-                    qWarning() << "index is invalid: json type is not a string";
-                    return false;
-                }
-                const auto type = typeValue.toString();
-
-                if(type == QStringLiteral("file"))
-                {
-                    qInfo() << "type changed from directory to file";
-                    if(!emptyDirectory(targetDir.absolutePath()))
-                        return false;
-                    rewriteIndex = true;
-                }
-                else if(type == QStringLiteral("directory"))
-                {
-                    if(!jsonObject.contains("entries"))
-                    {
-                        qWarning() << "index is invalid: json does not contain entries";
-                        rewriteIndex = true;
-                    }
-                    const auto entriesValue = jsonObject.value(QStringLiteral("entries"));
-                    if(entriesValue.type() != QJsonValue::Array)
-                    {
-                        qWarning() << "index is invalid: json entries is not an array";
-                        rewriteIndex = true;
-                    }
-                    const auto entries = entriesValue.toArray();
-
-                    for(auto value : entries)
-                    {
-                        if(value.type() != QJsonValue::String)
-                        {
-                            qWarning() << "index is invalid: json entry is not a string";
-                            rewriteIndex = true;
-                            break;
-                        }
-
-                        oldEntries.append(value.toString());
-                    }
-                }
-                else
-                {
-                    qWarning() << "index is invalid: unknown type" << type;
-                    rewriteIndex = true;
-                }
-            }
-            else
-                rewriteIndex = true;
+            options.parityDataParts = parityParts.at(0).toInt(&dataOk);
+            options.parityParts = parityParts.at(1).toInt(&parityOk);
         }
-        else
-            rewriteIndex = true;
-
-        for(const auto &oldEntry : oldEntries)
+        if(!dataOk || !parityOk || options.parityDataParts < 1 || options.parityDataParts > parity::maxDataShards ||
+           options.parityParts < 1 || options.parityParts > parity::maxParityShards)
         {
-            const QFileInfo oldFileInfo(sourceDir.absoluteFilePath(oldEntry));
-            if(!oldFileInfo.exists())
-            {
-                qInfo() << "deleted" << sourceDir.absoluteFilePath(oldEntry);
-                if(!QDir(targetDir.absoluteFilePath(oldEntry)).removeRecursively())
-                {
-                    qWarning() << "could not remove dir" << targetDir.absoluteFilePath(oldEntry);
-                    return false;
-                }
-                rewriteIndex = true;
-            }
+            qCritical() << "invalid parity" << parser.value(parityOption);
+            parser.showHelp();
+            return -20;
         }
+    }
 
-        QJsonArray entries;
+    options.contentDefinedChunking = parser.isSet(cdcOption);
 
-        for(const auto &fileInfo : sourceDir.entryInfoList(QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot))
+    {
+        const auto chunkSizes = parser.value(chunkSizesOption).split(QLatin1Char(':'));
+        bool minOk = false, averageOk = false, maxOk = false;
+        if(chunkSizes.size() == 3)
         {
-            if(!oldEntries.contains(fileInfo.fileName()))
-            {
-                qInfo() << "added" << fileInfo.absoluteFilePath();
-                rewriteIndex = true;
-            }
-
-            entries.append(fileInfo.fileName());
-            if(!spread(fileInfo.absoluteFilePath(), targetDir.absoluteFilePath(fileInfo.fileName())))
-                return false;
+            options.minChunkSize = chunkSizes.at(0).toInt(&minOk) * 1024;
+            options.averageChunkSize = chunkSizes.at(1).toInt(&averageOk) * 1024;
+            options.maxChunkSize = chunkSizes.at(2).toInt(&maxOk) * 1024;
         }
-
-        if(rewriteIndex)
+        if(!minOk || !averageOk || !maxOk || options.minChunkSize < 64 * 1024 ||
+           options.minChunkSize > options.averageChunkSize || options.averageChunkSize > options.maxChunkSize ||
+           options.maxChunkSize > 256 * 1024 * 1024)
         {
-            QJsonObject jsonObject;
-            jsonObject[QStringLiteral("type")] = QStringLiteral("directory");
-            jsonObject[QStringLiteral("entries")] = entries;
-            if(!writeBitmap(targetDir.absoluteFilePath(QStringLiteral("__index.bmp")),
-                            QJsonDocument(jsonObject).toJson(/* QJsonDocument::Compact */))) //amazon has enough storage for spaces!
-                return false;
+            qCritical() << "invalid chunk sizes" << parser.value(chunkSizesOption);
+            parser.showHelp();
+            return -10;
         }
     }
 
-    return true;
-}
-
-bool compile(const QString &sourcePath, const QString &targetPath)
-{
-    qDebug() << "compile" << sourcePath << targetPath;
-
-    QFileInfo sourceFileInfo(sourcePath);
-    if(!sourceFileInfo.exists())
     {
-        qWarning() << "source does not exist";
-        return false;
+        bool packThresholdOk;
+        options.packThreshold = parser.value(packThresholdOption).toLongLong(&packThresholdOk) * 1024;
+        if(!packThresholdOk || options.packThreshold <= 0 || options.packThreshold > options.maxChunkSize)
+        {
+            qCritical() << "invalid pack threshold" << parser.value(packThresholdOption);
+            parser.showHelp();
+            return -11;
+        }
     }
-    if(!sourceFileInfo.isDir())
+
+    bool maxMemoryOk;
+    const auto maxMemory = parser.value(maxMemoryOption).toLongLong(&maxMemoryOk) * 1024 * 1024;
+    if(!maxMemoryOk || maxMemory < 0)
     {
-        qWarning() << "source is not a dir";
-        return false;
+        qCritical() << "invalid memory budget" << parser.value(maxMemoryOption);
+        parser.showHelp();
+        return -18;
     }
 
-    QDir sourceDir(sourcePath);
-
-    QJsonObject jsonObject;
-
+    if(action == ActionCat && !parser.isSet(pathOption))
     {
-        QByteArray content;
-        if(!readBitmap(sourceDir.absoluteFilePath(QStringLiteral("__index.bmp")), content))
-            return false;
-
-        QJsonParseError error;
-        auto document = QJsonDocument::fromJson(content, &error);
-        if(error.error != QJsonParseError::NoError)
-        {
-            qWarning() << "error parsing json" << error.errorString();
-            return false;
-        }
-        if(!document.isObject())
-        {
-            qWarning() << "json is not an object";
-            return false;
-        }
-        jsonObject = document.object();
+        qCritical() << "path not set";
+        parser.showHelp();
+        return -15;
     }
 
-    if(!jsonObject.contains(QStringLiteral("type")))
+    bool offsetOk;
+    const auto offset = parser.value(offsetOption).toLongLong(&offsetOk);
+    bool lengthOk = true;
+    const auto length = parser.isSet(lengthOption) ? parser.value(lengthOption).toLongLong(&lengthOk) : std::numeric_limits<qint64>::max();
+    if(!offsetOk || !lengthOk || offset < 0 || length < 0)
     {
-        qWarning() << "json does not contain type";
-        return false;
+        qCritical() << "invalid range" << parser.value(offsetOption) << parser.value(lengthOption);
+        parser.showHelp();
+        return -16;
     }
-    const auto typeValue = jsonObject.value(QStringLiteral("type"));
-    if(typeValue.type() != QJsonValue::String)
+
+    bool progressOk;
+    const auto progress = parser.value(progressOption).toInt(&progressOk);
+    if(!progressOk || progress < 0)
     {
-        qWarning() << "json type is not a string";
-        return false;
+        qCritical() << "invalid progress interval" << parser.value(progressOption);
+        parser.showHelp();
+        return -12;
     }
-    const auto type = typeValue.toString();
 
-    if(type == QStringLiteral("file"))
-    {
-        QFile targetFile(targetPath);
+    QElapsedTimer elapsed;
+    elapsed.start();
 
-        if(!targetFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    //dumps the metrics on every way out of the switch below
+    struct MetricsDump
+    {
+        ~MetricsDump()
         {
-            qWarning() << "could not open file" << targetFile.errorString();
-            return false;
+            if(!filename.isEmpty())
+                writeMetrics(filename, elapsed.nsecsElapsed());
         }
 
-        //TODO
-    }
-    else if(type == QStringLiteral("directory"))
-    {
-        QDir targetDir(targetPath);
+        const QString filename;
+        const QElapsedTimer &elapsed;
+    } metricsDump { parser.value(metricsJsonOption), elapsed };
+
+    QScopedPointer<ProgressReporter> progressReporter;
+    if(progress > 0)
+        progressReporter.reset(new ProgressReporter(progress));
+
+    QScopedPointer<ObjectStore> objectStore;
 
-        if(!targetDir.mkpath(targetDir.absolutePath()))
+    switch(action)
+    {
+    case ActionSpread:
+    {
+        QScopedPointer<ChangeLog> changeLog;
+        if(parser.isSet(changeLogOption))
         {
-            qWarning() << "could not create dir";
-            return false;
+            changeLog.reset(new ChangeLog(targetFileInfo.absoluteFilePath(), parser.value(changeLogOption), parser.value(outboxOption)));
+            if(!changeLog->open())
+                return -8;
+            options.changeLog = changeLog.data();
         }
-
-        if(!jsonObject.contains(QStringLiteral("entries")))
+        else if(parser.isSet(outboxOption))
         {
-            qWarning() << "json does not contain entries";
-            return false;
+            qCritical() << "--outbox needs --change-log";
+            parser.showHelp();
+            return -19;
         }
-        const auto entriesValue = jsonObject.value(QStringLiteral("entries"));
-        if(entriesValue.type() != QJsonValue::Array)
+
+        if(parser.isSet(objectStoreOption))
         {
-            qWarning() << "json entries is not an array";
-            return false;
+            objectStore.reset(new ObjectStore(parser.value(objectStoreOption), changeLog.data()));
+            if(!objectStore->open())
+                return -8;
+            options.objectStore = objectStore.data();
         }
-        const auto entries = entriesValue.toArray();
 
-        for(auto entryValue : entries)
+        //a manifest from an earlier run would not match the tree anymore
+        const auto manifestPath = QDir(targetFileInfo.absoluteFilePath()).absoluteFilePath(QStringLiteral("__manifest.bmp"));
+        if(QFile::exists(manifestPath))
         {
-            if(entryValue.type() != QJsonValue::String)
+            if(!QFile::remove(manifestPath))
             {
-                qWarning() << "json entry is not a string";
-                return false;
+                qCritical() << "could not remove old manifest" << manifestPath;
+                return -8;
             }
-            auto entry = entryValue.toString();
+            if(changeLog && !changeLog->removed(manifestPath))
+                return -8;
+        }
 
-            if(!compile(sourceDir.absoluteFilePath(entry), targetDir.absoluteFilePath(entry)))
-                return false;
+        QScopedPointer<StatCache> statCache;
+        if(parser.isSet(stateOption))
+        {
+            statCache.reset(new StatCache(parser.value(stateOption), targetFileInfo.absoluteFilePath()));
+            if(!statCache->open())
+                return -8;
+            options.statCache = statCache.data();
         }
-    }
-    else
-    {
-        qWarning() << "unknown type" << type;
-        return false;
-    }
 
-    return true;
-}
+        QScopedPointer<ManifestBuilder> manifest;
+        if(parser.isSet(manifestOption))
+        {
+            manifest.reset(new ManifestBuilder(targetFileInfo.absoluteFilePath()));
+            options.manifest = manifest.data();
+        }
 
-int main(int argc, char *argv[])
-{
-    QCoreApplication app(argc, argv);
-    QCoreApplication::setApplicationName("picsync");
-    QCoreApplication::setApplicationVersion("1.0");
+        //a single file has nothing to share a pack with, and its target dir is the root
+        QScopedPointer<PackWriter> packWriter;
+        if(parser.isSet(packOption) && sourceFileInfo.isDir())
+        {
+            packWriter.reset(new PackWriter(QDir(targetFileInfo.absoluteFilePath()).absoluteFilePath(QStringLiteral("__packs")), options.maxChunkSize, changeLog.data()));
+            if(!packWriter->open())
+                return -8;
+            options.packWriter = packWriter.data();
+        }
 
-    qSetMessagePattern("%{time dd.MM.yyyy HH:mm:ss.zzz} "
-                       "["
-                       "%{if-debug}DEBUG%{endif}"
-                       "%{if-info}INFO%{endif}"
-                       "%{if-warning}WARN%{endif}"
-                       "%{if-critical}CRIT%{endif}"
-                       "%{if-fatal}FATAL%{endif}"
-                       "] "
-                       "%{function}(): "
-                       "%{message}");
+        //a block fits the largest part, fixed size parts are always 16MiB
+        BufferPool bufferPool(qMax<qint64>(options.maxChunkSize, 2048 * 2048 * 4), maxMemory);
+        options.bufferPool = &bufferPool;
 
-    QCommandLineParser parser;
-    parser.setApplicationDescription(QCoreApplication::translate("main", "Lets you convert any file into pictures. Mostly used in combination with cloud storage."));
-    parser.addHelpOption();
-    parser.addVersionOption();
+        //spread only discovers the files below a directory
+        if(sourceFileInfo.isFile())
+        {
+            metrics.filesTotal++;
+            metrics.bytesTotal += sourceFileInfo.size();
+        }
 
-    QCommandLineOption actionOption(QStringList() << "a" << "action", QCoreApplication::translate("main", "Action (spread or compile)"), QCoreApplication::translate("main", "action"));
-    parser.addOption(actionOption);
+        const Spreader spreader(options);
+        if(!(sourceStream ?
+             spreader.spread(STDIN_FILENO, targetFileInfo.absoluteFilePath()) :
+             spreader.spread(sourceFileInfo.absoluteFilePath(), targetFileInfo.absoluteFilePath())))
+            return -8;
 
-    QCommandLineOption sourceOption(QStringList() << "s" << "source", QCoreApplication::translate("main", "Source file or directory"), QCoreApplication::translate("main", "some_file"));
-    parser.addOption(sourceOption);
+        if(packWriter && (!packWriter->flush() || !packWriter->removeUnreferenced()))
+            return -8;
 
-    QCommandLineOption targetOption(QStringList() << "t" << "target", QCoreApplication::translate("main", "Target directory"), QCoreApplication::translate("main", "some_directory"));
-    parser.addOption(targetOption);
+        if(manifest && (!manifest->write(manifestPath) || (changeLog && !changeLog->created(manifestPath))))
+            return -8;
 
-    parser.process(app);
+        if(changeLog && !changeLog->finish())
+            return -8;
 
-    if(!parser.isSet(actionOption))
+        return 0;
+    }
+    case ActionCompile:
     {
-        qCritical() << "no action set";
-        parser.showHelp();
-        return -1;
+        objectStore.reset(new ObjectStore(parser.isSet(objectStoreOption) ?
+                                          parser.value(objectStoreOption) :
+                                          QDir(sourceFileInfo.absoluteFilePath()).absoluteFilePath(QStringLiteral("__objects"))));
+
+        PackReader packReader(QDir(sourceFileInfo.absoluteFilePath()).absoluteFilePath(QStringLiteral("__packs")));
+
+        CompileOptions compileOptions;
+        compileOptions.objectStore = objectStore.data();
+        compileOptions.packReader = &packReader;
+        compileOptions.jobs = options.jobs;
+        //a stream is one file, a tree shares the cores between the jobs
+        compileOptions.hashThreads = targetStream ? QThread::idealThreadCount() : options.hashThreads;
+
+        const Compiler compiler(compileOptions);
+        if(targetStream ?
+           compiler.compile(sourceFileInfo.absoluteFilePath(), STDOUT_FILENO) :
+           compiler.compile(sourceFileInfo.absoluteFilePath(), targetFileInfo.absoluteFilePath()))
+            return 0;
+        else
+            return -8;
     }
+    case ActionVerify:
+    {
+        objectStore.reset(new ObjectStore(parser.isSet(objectStoreOption) ?
+                                          parser.value(objectStoreOption) :
+                                          QDir(sourceFileInfo.absoluteFilePath()).absoluteFilePath(QStringLiteral("__objects"))));
 
-    enum { ActionSpread, ActionCompile } action;
+        VerifyOptions verifyOptions;
+        verifyOptions.jobs = options.jobs;
+        verifyOptions.objectStore = objectStore.data();
 
-    if(parser.value(actionOption) == QStringLiteral("spread"))
-        action = ActionSpread;
-    else if(parser.value(actionOption) == QStringLiteral("compile"))
-        action = ActionCompile;
-    else
-    {
-        qCritical() << "unknown action" << parser.value(actionOption);
-        parser.showHelp();
-        return -2;
-    }
+        const QDir sourceDir(sourceFileInfo.absoluteFilePath());
+        if(QFile::exists(sourceDir.absoluteFilePath(QStringLiteral("__manifest.bmp"))))
+        {
+            Manifest manifest;
+            if(manifest.open(sourceDir.absoluteFilePath(QStringLiteral("__manifest.bmp"))))
+            {
+                if(verifyManifest(manifest, sourceDir, verifyOptions))
+                    return 0;
+                else
+                    return -8;
+            }
 
-    if(!parser.isSet(sourceOption))
-    {
-        qCritical() << "source not set";
-        parser.showHelp();
-        return -3;
-    }
+            qWarning() << "falling back to the indexes";
+        }
 
-    QFileInfo sourceFileInfo(parser.value(sourceOption));
-    if(!sourceFileInfo.exists())
-    {
-        qCritical() << "source" << parser.value(sourceOption) << "does not exist";
-        parser.showHelp();
-        return -4;
+        if(verify(sourceFileInfo.absoluteFilePath(), verifyOptions))
+            return 0;
+        else
+            return -8;
     }
-    if(!sourceFileInfo.isFile() && !sourceFileInfo.isDir())
+    case ActionCat:
     {
-        qCritical() << "source" << parser.value(sourceOption) << "isnt file nor dir";
-        parser.showHelp();
-        return -5;
-    }
+        objectStore.reset(new ObjectStore(parser.isSet(objectStoreOption) ?
+                                          parser.value(objectStoreOption) :
+                                          QDir(sourceFileInfo.absoluteFilePath()).absoluteFilePath(QStringLiteral("__objects"))));
 
-    if(!parser.isSet(targetOption))
-    {
-        qCritical() << "target not set";
-        parser.showHelp();
-        return -6;
-    }
+        PackReader packReader(QDir(sourceFileInfo.absoluteFilePath()).absoluteFilePath(QStringLiteral("__packs")));
 
-    const QFileInfo targetFileInfo(parser.value(targetOption));
-    if(targetFileInfo.exists() && !targetFileInfo.isDir())
-    {
-        qCritical() << "target" << parser.value(targetOption) << "exists and is not a dir";
-        parser.showHelp();
-        return -7;
-    }
+        CompileOptions compileOptions;
+        compileOptions.objectStore = objectStore.data();
+        compileOptions.packReader = &packReader;
 
-    switch(action)
-    {
-    case ActionSpread:
-        if(spread(sourceFileInfo.absoluteFilePath(), targetFileInfo.absoluteFilePath()))
-            return 0;
-        else
+        const QDir sourceDir(sourceFileInfo.absoluteFilePath());
+
+        Manifest manifest;
+        bool hasManifest = false;
+        if(QFile::exists(sourceDir.absoluteFilePath(QStringLiteral("__manifest.bmp"))))
+        {
+            hasManifest = manifest.open(sourceDir.absoluteFilePath(QStringLiteral("__manifest.bmp")));
+            if(!hasManifest)
+                qWarning() << "falling back to the indexes";
+        }
+
+        SpreadFile file(compileOptions);
+        if(!file.open(sourceDir.absolutePath(), parser.value(pathOption), hasManifest ? &manifest : nullptr))
             return -8;
-    case ActionCompile:
-        if(compile(sourceFileInfo.absoluteFilePath(), targetFileInfo.absoluteFilePath()))
-            return 0;
-        else
+
+        metrics.filesTotal++;
+        metrics.bytesTotal += qMax<qint64>(0, qMin(file.size() - offset, length));
+
+        if(!file.readTo(offset, length, STDOUT_FILENO))
             return -8;
+
+        metrics.filesDone++;
+        metrics.bytesDone += qMax<qint64>(0, qMin(file.size() - offset, length));
+
+        return 0;
+    }
     }
 
     Q_UNREACHABLE();
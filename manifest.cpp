@@ -0,0 +1,389 @@
+#include "manifest.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QStringList>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "bitmap.h"
+#include "compression.h"
+#include "digest.h"
+
+#if Q_BYTE_ORDER != Q_LITTLE_ENDIAN
+#error the manifest is mapped as is and only defined for little endian hosts
+#endif
+
+namespace {
+const char manifestMagic[8] { 'P', 'I', 'C', 'S', 'Y', 'N', 'C', 'M' };
+const quint32 manifestVersion { 7 };
+const int leadingPadding { 2 };
+//! ManifestPart::length is 32 bits, older indexes may have longer zero parts
+const qint64 maxZeroPartLength { 1024 * 1024 * 1024 };
+
+int compareName(const char *a, quint32 aLength, const char *b, quint32 bLength)
+{
+    const auto result = std::memcmp(a, b, qMin(aLength, bLength));
+    if(result != 0)
+        return result;
+    return aLength < bLength ? -1 : (aLength > bLength ? 1 : 0);
+}
+}
+
+bool Manifest::open(const QString &filename)
+{
+    m_header = nullptr;
+
+    if(!m_bitmap.open(filename))
+        return false;
+
+    const auto data = m_bitmap.content();
+    const quint64 length = m_bitmap.contentLength();
+
+    if(length < leadingPadding + sizeof(ManifestHeader))
+    {
+        qWarning() << "manifest is too small";
+        return false;
+    }
+
+    if(quintptr(data + leadingPadding) % 8)
+    {
+        qWarning() << "manifest is not aligned";
+        return false;
+    }
+
+    const auto header = reinterpret_cast<const ManifestHeader *>(data + leadingPadding);
+    if(std::memcmp(header->magic, manifestMagic, sizeof(manifestMagic)) != 0)
+    {
+        qWarning() << "manifest has no magic";
+        return false;
+    }
+    if(header->version != manifestVersion)
+    {
+        qWarning() << "unsupported manifest version" << header->version;
+        return false;
+    }
+    if(header->nodeCount < 1)
+    {
+        qWarning() << "manifest has no root";
+        return false;
+    }
+
+    const quint64 expectedLength = leadingPadding + sizeof(ManifestHeader) +
+                                   quint64(header->nodeCount) * sizeof(ManifestNode) +
+                                   quint64(header->partCount) * sizeof(ManifestPart) +
+                                   header->stringsSize;
+    if(length != expectedLength)
+    {
+        qWarning() << "manifest size does not match";
+        return false;
+    }
+
+    const auto nodes = reinterpret_cast<const ManifestNode *>(header + 1);
+    const auto parts = reinterpret_cast<const ManifestPart *>(nodes + header->nodeCount);
+    const auto strings = reinterpret_cast<const char *>(parts + header->partCount);
+
+    //checked once here so lookups never have to
+    for(quint32 i = 0; i < header->nodeCount; i++)
+    {
+        const auto &node = nodes[i];
+
+        if(quint64(node.nameOffset) + node.nameLength > header->stringsSize)
+        {
+            qWarning() << "manifest node name out of range";
+            return false;
+        }
+
+        if(node.type == ManifestNode::Directory)
+        {
+            //children always come after their parent, which also rules out cycles
+            if(node.childCount && (node.firstChild <= i || quint64(node.firstChild) + node.childCount > header->nodeCount))
+            {
+                qWarning() << "manifest node children out of range";
+                return false;
+            }
+        }
+        else if(node.type == ManifestNode::File)
+        {
+            if(quint64(node.firstPart) + node.partCount > header->partCount)
+            {
+                qWarning() << "manifest node parts out of range";
+                return false;
+            }
+        }
+        else
+        {
+            qWarning() << "manifest node has unknown type" << node.type;
+            return false;
+        }
+    }
+
+    for(quint32 i = 0; i < header->partCount; i++)
+    {
+        if(quint64(parts[i].nameOffset) + parts[i].nameLength > header->stringsSize)
+        {
+            qWarning() << "manifest part name out of range";
+            return false;
+        }
+    }
+
+    m_header = header;
+    m_nodes = nodes;
+    m_parts = parts;
+    m_strings = strings;
+
+    return true;
+}
+
+const ManifestNode *Manifest::find(const QString &relativePath) const
+{
+    const ManifestNode *node = &root();
+
+    for(const auto &component : relativePath.split(QLatin1Char('/'), QString::SkipEmptyParts))
+    {
+        if(component == QStringLiteral("."))
+            continue;
+
+        node = child(*node, component.toUtf8());
+        if(!node)
+            return nullptr;
+    }
+
+    return node;
+}
+
+const ManifestNode *Manifest::child(const ManifestNode &node, const QByteArray &name) const
+{
+    if(node.type != ManifestNode::Directory)
+        return nullptr;
+
+    const auto begin = children(node);
+    const auto end = begin + node.childCount;
+
+    const auto iter = std::lower_bound(begin, end, name, [this](const ManifestNode &child, const QByteArray &name){
+        return compareName(m_strings + child.nameOffset, child.nameLength, name.constData(), name.size()) < 0;
+    });
+
+    if(iter == end || compareName(m_strings + iter->nameOffset, iter->nameLength, name.constData(), name.size()) != 0)
+        return nullptr;
+
+    return iter;
+}
+
+QString Manifest::name(const ManifestNode &node) const
+{
+    return QString::fromUtf8(m_strings + node.nameOffset, node.nameLength);
+}
+
+QString Manifest::name(const ManifestPart &part) const
+{
+    return QString::fromUtf8(m_strings + part.nameOffset, part.nameLength);
+}
+
+ManifestBuilder::ManifestBuilder(const QString &rootPath) :
+    m_rootPath(QDir(rootPath).absolutePath())
+{
+}
+
+void ManifestBuilder::addDirectory(const QString &targetPath)
+{
+    const auto path = relativePath(targetPath);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.insert(path, QJsonObject());
+}
+
+void ManifestBuilder::addFile(const QString &targetPath, const QJsonObject &index)
+{
+    const auto path = relativePath(targetPath);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries.insert(path, index);
+}
+
+namespace {
+struct TreeNode
+{
+    const QJsonObject *index { nullptr };
+    std::map<std::string, TreeNode> children;
+};
+
+void appendRaw(QByteArray &payload, const void *data, int length)
+{
+    payload.append(static_cast<const char *>(data), length);
+}
+}
+
+bool ManifestBuilder::write(const QString &filename) const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    TreeNode root;
+    for(auto iter = m_entries.constBegin(); iter != m_entries.constEnd(); ++iter)
+    {
+        auto node = &root;
+        for(const auto &component : iter.key().split(QLatin1Char('/'), QString::SkipEmptyParts))
+            node = &node->children[component.toUtf8().toStdString()];
+        node->index = &iter.value();
+    }
+
+    //breadth first, so the children of every directory end up next to each other
+    const std::string rootName;
+    std::vector<std::pair<const std::string *, const TreeNode *>> order { { &rootName, &root } };
+
+    std::vector<ManifestNode> nodes;
+    std::vector<ManifestPart> parts;
+    QByteArray strings;
+
+    for(std::size_t i = 0; i < order.size(); i++)
+    {
+        const auto &name = *order[i].first;
+        const auto &treeNode = *order[i].second;
+
+        ManifestNode node;
+        std::memset(&node, 0, sizeof(node));
+        node.nameOffset = strings.size();
+        node.nameLength = name.size();
+        strings.append(name.data(), name.size());
+
+        if(treeNode.index && treeNode.index->value(QStringLiteral("type")).toString() == QStringLiteral("file"))
+        {
+            const auto &index = *treeNode.index;
+
+            node.type = ManifestNode::File;
+            node.filesize = index.value(QStringLiteral("filesize")).toDouble();
+            node.birthTime = index.value(QStringLiteral("birthTime")).toDouble();
+            node.lastModified = index.value(QStringLiteral("lastModified")).toDouble();
+            node.lastRead = index.value(QStringLiteral("lastRead")).toDouble();
+
+            const auto algorithm = indexDigestAlgorithm(index);
+            if(algorithm == DigestAlgorithm::Blake3)
+                node.flags |= ManifestNode::Blake3Digest;
+            if(!index.value(QStringLiteral("parity")).toArray().isEmpty())
+                node.flags |= ManifestNode::HasParity;
+
+            const auto digest = QByteArray::fromHex(index.value(digestName(algorithm)).toString().toLatin1());
+            std::memcpy(node.digest, digest.constData(), qMin<int>(digest.size(), sizeof(node.digest)));
+
+            const auto partsArray = index.value(QStringLiteral("parts")).toArray();
+            node.firstPart = parts.size();
+
+            for(const auto &partValue : partsArray)
+            {
+                const auto partObject = partValue.toObject();
+
+                ManifestPart part;
+                std::memset(&part, 0, sizeof(part));
+                part.startPos = partObject.value(QStringLiteral("startPos")).toDouble();
+                auto length = qint64(partObject.value(QStringLiteral("length")).toDouble());
+                part.length = length;
+
+                QByteArray partName;
+                if(partObject.value(QStringLiteral("zero")).toBool())
+                    part.flags |= ManifestPart::IsZero;
+                else if(partObject.contains(QStringLiteral("object")))
+                {
+                    part.flags |= ManifestPart::IsObject;
+                    partName = partObject.value(QStringLiteral("object")).toString().toUtf8();
+                }
+                else if(partObject.contains(QStringLiteral("pack")))
+                {
+                    part.flags |= ManifestPart::IsPacked;
+                    part.offset = partObject.value(QStringLiteral("offset")).toDouble();
+                    partName = partObject.value(QStringLiteral("pack")).toString().toUtf8();
+                }
+                else
+                    partName = partObject.value(QStringLiteral("filename")).toString().toUtf8();
+
+                if(partObject.value(QStringLiteral("codec")).toString() == zlibCodec())
+                {
+                    part.flags |= ManifestPart::IsCompressed;
+                    part.storedLength = partObject.value(QStringLiteral("storedLength")).toDouble();
+                }
+
+                const auto digest = QByteArray::fromHex(partObject.value(partDigestName(algorithm)).toString().toLatin1());
+                if(digest.size() == sizeof(part.digest))
+                {
+                    part.flags |= ManifestPart::HasDigest;
+                    if(algorithm == DigestAlgorithm::Blake3)
+                        part.flags |= ManifestPart::Blake3Digest;
+                    std::memcpy(part.digest, digest.constData(), sizeof(part.digest));
+                }
+
+                part.nameOffset = strings.size();
+                part.nameLength = partName.size();
+                strings.append(partName);
+
+                //a hole spread before zero parts were capped becomes several
+                if(part.flags & ManifestPart::IsZero)
+                {
+                    for(; length > maxZeroPartLength; length -= maxZeroPartLength)
+                    {
+                        part.length = maxZeroPartLength;
+                        parts.push_back(part);
+                        part.startPos += maxZeroPartLength;
+                    }
+                    part.length = length;
+                }
+
+                parts.push_back(part);
+            }
+
+            node.partCount = parts.size() - node.firstPart;
+        }
+        else
+        {
+            node.type = ManifestNode::Directory;
+            node.firstChild = order.size();
+            node.childCount = treeNode.children.size();
+
+            for(const auto &child : treeNode.children)
+                order.emplace_back(&child.first, &child.second);
+        }
+
+        nodes.push_back(node);
+    }
+
+    const quint64 size = leadingPadding + sizeof(ManifestHeader) +
+                         nodes.size() * sizeof(ManifestNode) +
+                         parts.size() * sizeof(ManifestPart) +
+                         strings.size();
+    if(size > std::numeric_limits<int>::max())
+    {
+        qWarning() << "manifest would be too big";
+        return false;
+    }
+
+    ManifestHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, manifestMagic, sizeof(manifestMagic));
+    header.version = manifestVersion;
+    header.nodeCount = nodes.size();
+    header.partCount = parts.size();
+    header.stringsSize = strings.size();
+
+    QByteArray payload;
+    payload.reserve(size);
+    payload.append(leadingPadding, '\0');
+    appendRaw(payload, &header, sizeof(header));
+    appendRaw(payload, nodes.data(), nodes.size() * sizeof(ManifestNode));
+    appendRaw(payload, parts.data(), parts.size() * sizeof(ManifestPart));
+    payload.append(strings);
+
+    //readers either see the old or the new manifest, never half of one
+    return replaceBitmap(filename, payload);
+}
+
+QString ManifestBuilder::relativePath(const QString &targetPath) const
+{
+    const auto path = QDir(targetPath).absolutePath();
+    if(path == m_rootPath)
+        return QString();
+    return path.mid(m_rootPath.length() + 1);
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <QDir>
+#include <QMap>
+#include <QJsonObject>
+#include <QString>
+#include <QtGlobal>
+
+#include <mutex>
+
+#include "mappedbitmap.h"
+
+//! Binary description of a whole spread tree in one bitmap (__manifest.bmp in
+//! the target root), so reading the tree is one mmap() instead of parsing an
+//! __index.bmp per node.
+//!
+//! Layout of the payload, all little endian:
+//!  - 2 bytes padding, the payload starts at offset 54 of the bitmap and this
+//!    puts everything behind it on an 8 byte boundary
+//!  - ManifestHeader
+//!  - nodeCount ManifestNodes, the root first. The children of a directory are
+//!    stored next to each other, sorted bytewise by name, so a path can be
+//!    looked up with one binary search per component.
+//!  - partCount ManifestParts, the parts of a file next to each other
+//!  - the string table with all names as utf8, not terminated
+
+struct ManifestHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 nodeCount;
+    quint32 partCount;
+    quint32 stringsSize;
+};
+
+struct ManifestNode
+{
+    enum : quint32 { Directory, File };
+    //! HasParity: the parity stripes are only in the file's __index.bmp, whoever
+    //! may have to rebuild a part reads that instead
+    enum : quint32 { Blake3Digest = 1, HasParity = 2 };
+
+    quint32 nameOffset;
+    quint32 nameLength;
+    quint32 firstChild;
+    quint32 childCount;
+    quint32 firstPart;
+    quint32 partCount;
+    quint32 type;
+    quint32 flags;
+    qint64 filesize;
+    qint64 birthTime;
+    qint64 lastModified;
+    qint64 lastRead;
+    //! sha512, or blake3 in the first 32 bytes with Blake3Digest
+    quint8 digest[64];
+};
+
+struct ManifestPart
+{
+    enum : quint32 { IsObject = 1, IsPacked = 2, HasDigest = 4, Blake3Digest = 8, IsZero = 16, IsCompressed = 32 };
+
+    qint64 startPos;
+    quint32 length;
+    quint32 flags;
+    //! part bitmap in the file's directory, object store digest or pack id, empty for zero parts
+    quint32 nameOffset;
+    quint32 nameLength;
+    //! position of the content in the pack
+    quint32 offset;
+    //! payload length of the bitmap, only set with IsCompressed (zlib)
+    quint32 storedLength;
+    //! sha256 or blake3, only set with HasDigest, indexes written before parts had digests lack it
+    quint8 digest[32];
+};
+
+static_assert(sizeof(ManifestHeader) == 24, "manifest layout changed");
+static_assert(sizeof(ManifestNode) == 128, "manifest layout changed");
+static_assert(sizeof(ManifestPart) == 64, "manifest layout changed");
+
+//! Memory mapped, read-only manifest
+class Manifest
+{
+    Q_DISABLE_COPY(Manifest)
+
+public:
+    Manifest() = default;
+
+    bool open(const QString &filename);
+
+    const ManifestNode &root() const { return m_nodes[0]; }
+    quint32 nodeCount() const { return m_header->nodeCount; }
+
+    //! Looks up a path relative to the root, returns nullptr if it does not exist
+    const ManifestNode *find(const QString &relativePath) const;
+    const ManifestNode *child(const ManifestNode &node, const QByteArray &name) const;
+
+    const ManifestNode *children(const ManifestNode &node) const { return m_nodes + node.firstChild; }
+    const ManifestPart *parts(const ManifestNode &node) const { return m_parts + node.firstPart; }
+
+    QString name(const ManifestNode &node) const;
+    QString name(const ManifestPart &part) const;
+
+private:
+    MappedBitmap m_bitmap;
+    const ManifestHeader *m_header { nullptr };
+    const ManifestNode *m_nodes { nullptr };
+    const ManifestPart *m_parts { nullptr };
+    const char *m_strings { nullptr };
+};
+
+//! Collects the index of every node while spread() walks the tree and writes
+//! the manifest once it is done. Safe to feed from several threads.
+class ManifestBuilder
+{
+    Q_DISABLE_COPY(ManifestBuilder)
+
+public:
+    explicit ManifestBuilder(const QString &rootPath);
+
+    void addDirectory(const QString &targetPath);
+    void addFile(const QString &targetPath, const QJsonObject &index);
+
+    bool write(const QString &filename) const;
+
+private:
+    QString relativePath(const QString &targetPath) const;
+
+    const QString m_rootPath;
+    //! relative path -> file index, directories are stored with an empty object
+    QMap<QString, QJsonObject> m_entries;
+    mutable std::mutex m_mutex;
+};
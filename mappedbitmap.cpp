@@ -0,0 +1,171 @@
+#include "mappedbitmap.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QString>
+#include <QtEndian>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+MappedBitmap::~MappedBitmap()
+{
+    close();
+}
+
+bool MappedBitmap::open(const QString &filename)
+{
+    close();
+
+    m_fd = ::open(QFile::encodeName(filename).constData(), O_RDONLY | O_CLOEXEC);
+    if(m_fd == -1)
+    {
+        qWarning() << "could not open file" << filename << strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(m_fd, &st) == -1)
+    {
+        qWarning() << "could not stat file" << filename << strerror(errno);
+        close();
+        return false;
+    }
+
+    if(st.st_size < 14)
+    {
+        qWarning() << "not enough bytes";
+        close();
+        return false;
+    }
+
+    auto data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if(data == MAP_FAILED)
+    {
+        qWarning() << "could not map file" << filename << strerror(errno);
+        close();
+        return false;
+    }
+
+    m_data = static_cast<char *>(data);
+    m_size = st.st_size;
+
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+
+    if(qFromLittleEndian<quint16>(m_data) != 0x4D42)
+    {
+        qWarning() << "no BM header";
+        close();
+        return false;
+    }
+
+    if(qFromLittleEndian<quint32>(m_data + 2) != m_size)
+    {
+        qWarning() << "file size does not match!";
+        close();
+        return false;
+    }
+
+    m_contentLength = qFromLittleEndian<quint32>(m_data + 6);
+    m_contentOffset = qFromLittleEndian<quint32>(m_data + 10);
+
+    if(qint64(m_contentOffset) + m_contentLength > m_size)
+    {
+        qWarning() << "could not read enough for usedSize";
+        close();
+        return false;
+    }
+
+    metrics.bitmapsRead++;
+
+    return true;
+}
+
+void MappedBitmap::close()
+{
+    if(m_data)
+    {
+        munmap(m_data, m_size);
+        m_data = nullptr;
+    }
+
+    if(m_fd != -1)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+
+    m_size = 0;
+    m_contentLength = 0;
+    m_contentOffset = 0;
+}
+
+bool MappedBitmap::copyTo(int fd, qint64 offset) const
+{
+    return copyTo(fd, offset, 0, m_contentLength);
+}
+
+bool MappedBitmap::copyTo(int fd, qint64 offset, quint32 from, quint32 length) const
+{
+    if(quint64(from) + length > m_contentLength)
+    {
+        qWarning() << "range is out of the payload";
+        return false;
+    }
+
+    MetricsTimer timer(metrics.writeNsecs);
+    metrics.bytesRead += length;
+    metrics.bytesWritten += length;
+
+    loff_t inOffset = m_contentOffset + from;
+    loff_t outOffset = offset;
+    size_t remaining = length;
+
+    while(remaining)
+    {
+        const auto copied = copy_file_range(m_fd, &inOffset, fd, &outOffset, remaining, 0);
+        if(copied == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            //not supported for this pair of files, fall back to pwrite()
+            if(errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)
+                break;
+
+            qWarning() << "could not copy file range" << strerror(errno);
+            return false;
+        }
+
+        if(copied == 0)
+            break;
+
+        remaining -= copied;
+    }
+
+    while(remaining)
+    {
+        const auto written = pwrite(fd, m_data + inOffset, remaining, outOffset);
+        if(written == -1)
+        {
+            if(errno == EINTR)
+                continue;
+
+            qWarning() << "could not write" << strerror(errno);
+            return false;
+        }
+
+        inOffset += written;
+        outOffset += written;
+        remaining -= written;
+    }
+
+    return true;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <QtGlobal>
+
+class QString;
+
+//! Read-only memory mapping of a bitmap written by writeBitmap(). Gives direct
+//! access to the payload without copying it into a QByteArray first.
+class MappedBitmap
+{
+    Q_DISABLE_COPY(MappedBitmap)
+
+public:
+    MappedBitmap() = default;
+    ~MappedBitmap();
+
+    bool open(const QString &filename);
+    void close();
+
+    bool isOpen() const { return m_data != nullptr; }
+    int handle() const { return m_fd; }
+
+    const char *content() const { return m_data + m_contentOffset; }
+    quint32 contentLength() const { return m_contentLength; }
+    quint32 contentOffset() const { return m_contentOffset; }
+
+    //! Writes the payload to fd at offset. Stays inside the kernel with
+    //! copy_file_range() where the filesystems allow it, pwrite()s from the
+    //! mapping otherwise.
+    bool copyTo(int fd, qint64 offset) const;
+
+    //! Same for length bytes starting at from in the payload
+    bool copyTo(int fd, qint64 offset, quint32 from, quint32 length) const;
+
+private:
+    int m_fd { -1 };
+    char *m_data { nullptr };
+    qint64 m_size { 0 };
+    quint32 m_contentLength { 0 };
+    quint32 m_contentOffset { 0 };
+};
@@ -0,0 +1,128 @@
+#include "metrics.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QString>
+
+#include <chrono>
+
+Q_LOGGING_CATEGORY(picsyncTrace, "picsync.trace", QtInfoMsg)
+
+Metrics metrics;
+
+void Metrics::reset()
+{
+    for(auto counter : { &bytesRead, &bytesWritten, &bitmapsRead, &bitmapsWritten, &stats, &indexParses, &zeroBytes, &compressionSavedBytes, &resumedBytes, &rebuiltParts,
+                         &hashNsecs, &readNsecs, &writeNsecs, &jsonNsecs, &compressNsecs, &parityNsecs,
+                         &filesTotal, &filesDone, &bytesTotal, &bytesDone })
+        *counter = 0;
+}
+
+QJsonObject Metrics::toJson() const
+{
+    QJsonObject jsonObject;
+    jsonObject[QStringLiteral("bytesRead")] = qint64(bytesRead);
+    jsonObject[QStringLiteral("bytesWritten")] = qint64(bytesWritten);
+    jsonObject[QStringLiteral("bitmapsRead")] = qint64(bitmapsRead);
+    jsonObject[QStringLiteral("bitmapsWritten")] = qint64(bitmapsWritten);
+    jsonObject[QStringLiteral("stats")] = qint64(stats);
+    jsonObject[QStringLiteral("indexParses")] = qint64(indexParses);
+    jsonObject[QStringLiteral("zeroBytes")] = qint64(zeroBytes);
+    jsonObject[QStringLiteral("compressionSavedBytes")] = qint64(compressionSavedBytes);
+    jsonObject[QStringLiteral("resumedBytes")] = qint64(resumedBytes);
+    jsonObject[QStringLiteral("rebuiltParts")] = qint64(rebuiltParts);
+    jsonObject[QStringLiteral("hashMsecs")] = qint64(hashNsecs) / 1000000;
+    jsonObject[QStringLiteral("readMsecs")] = qint64(readNsecs) / 1000000;
+    jsonObject[QStringLiteral("writeMsecs")] = qint64(writeNsecs) / 1000000;
+    jsonObject[QStringLiteral("jsonMsecs")] = qint64(jsonNsecs) / 1000000;
+    jsonObject[QStringLiteral("compressMsecs")] = qint64(compressNsecs) / 1000000;
+    jsonObject[QStringLiteral("parityMsecs")] = qint64(parityNsecs) / 1000000;
+    jsonObject[QStringLiteral("filesTotal")] = qint64(filesTotal);
+    jsonObject[QStringLiteral("filesDone")] = qint64(filesDone);
+    jsonObject[QStringLiteral("bytesTotal")] = qint64(bytesTotal);
+    jsonObject[QStringLiteral("bytesDone")] = qint64(bytesDone);
+    return jsonObject;
+}
+
+ProgressReporter::ProgressReporter(int intervalSecs)
+{
+    m_thread = std::thread([this, intervalSecs](){
+        QElapsedTimer elapsed;
+        elapsed.start();
+
+        qint64 lastBytes = 0;
+        qint64 lastNsecs = 0;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(!m_condition.wait_for(lock, std::chrono::seconds(intervalSecs), [this](){ return m_quit; }))
+        {
+            const qint64 bytes = metrics.bytesDone;
+            const auto nsecs = elapsed.nsecsElapsed();
+            report(nsecs, bytes - lastBytes, nsecs - lastNsecs);
+            lastBytes = bytes;
+            lastNsecs = nsecs;
+        }
+    });
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_condition.notify_one();
+    m_thread.join();
+}
+
+void ProgressReporter::report(qint64 elapsedNsecs, qint64 intervalBytes, qint64 intervalNsecs) const
+{
+    const qint64 filesDone = metrics.filesDone;
+    const qint64 filesTotal = metrics.filesTotal;
+    const qint64 bytesDone = metrics.bytesDone;
+    const qint64 bytesTotal = metrics.bytesTotal;
+
+    const auto rate = intervalNsecs > 0 ? intervalBytes * 1000. / intervalNsecs : 0.;
+    const auto averageRate = elapsedNsecs > 0 ? bytesDone * 1000. / elapsedNsecs : 0.;
+
+    QString eta(QStringLiteral("unknown"));
+    if(averageRate > 0 && bytesTotal >= bytesDone)
+    {
+        const auto secs = qint64((bytesTotal - bytesDone) / (averageRate * 1000000.));
+        eta = QStringLiteral("%0:%1:%2")
+                .arg(secs / 3600)
+                .arg(secs / 60 % 60, 2, 10, QLatin1Char('0'))
+                .arg(secs % 60, 2, 10, QLatin1Char('0'));
+    }
+
+    qInfo().noquote() << QStringLiteral("progress: %0/%1 files, %2/%3 MB, %4 MB/s, eta %5 (of what was found so far)")
+                         .arg(filesDone)
+                         .arg(filesTotal)
+                         .arg(bytesDone / 1000000)
+                         .arg(bytesTotal / 1000000)
+                         .arg(rate, 0, 'f', 1)
+                         .arg(eta);
+}
+
+bool writeMetrics(const QString &filename, qint64 elapsedNsecs)
+{
+    auto jsonObject = metrics.toJson();
+    jsonObject[QStringLiteral("elapsedMsecs")] = elapsedNsecs / 1000000;
+
+    QFile file(filename);
+    if(!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        qWarning() << "could not open metrics file" << file.errorString();
+        return false;
+    }
+
+    if(file.write(QJsonDocument(jsonObject).toJson()) == -1)
+    {
+        qWarning() << "could not write metrics file" << file.errorString();
+        return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <QtGlobal>
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+class QJsonObject;
+class QString;
+
+//! Per bitmap, per node and per stage tracing. Off unless --verbose or
+//! QT_LOGGING_RULES="picsync.trace.debug=true", so the hot paths only pay for
+//! checking the category.
+Q_DECLARE_LOGGING_CATEGORY(picsyncTrace)
+
+//! Process wide counters, cheap enough to be bumped from every hot path and
+//! every thread.
+struct Metrics
+{
+    std::atomic<qint64> bytesRead { 0 };
+    std::atomic<qint64> bytesWritten { 0 };
+    std::atomic<qint64> bitmapsRead { 0 };
+    std::atomic<qint64> bitmapsWritten { 0 };
+    std::atomic<qint64> stats { 0 };
+    std::atomic<qint64> indexParses { 0 };
+    //! holes and zero runs recorded as zero parts instead of being stored
+    std::atomic<qint64> zeroBytes { 0 };
+    //! what compressing parts saved compared to storing them raw
+    std::atomic<qint64> compressionSavedBytes { 0 };
+    //! parts taken over from the journal of an interrupted run
+    std::atomic<qint64> resumedBytes { 0 };
+    //! lost or damaged parts compile and verify rebuilt from parity
+    std::atomic<qint64> rebuiltParts { 0 };
+
+    std::atomic<qint64> hashNsecs { 0 };
+    std::atomic<qint64> readNsecs { 0 };
+    std::atomic<qint64> writeNsecs { 0 };
+    std::atomic<qint64> jsonNsecs { 0 };
+    //! compressing on spread, decompressing on compile and verify
+    std::atomic<qint64> compressNsecs { 0 };
+    //! encoding parity on spread, rebuilding parts from it on compile and verify
+    std::atomic<qint64> parityNsecs { 0 };
+
+    //! The totals grow while the tree is walked, so they only cover what has
+    //! been discovered so far
+    std::atomic<qint64> filesTotal { 0 };
+    std::atomic<qint64> filesDone { 0 };
+    std::atomic<qint64> bytesTotal { 0 };
+    std::atomic<qint64> bytesDone { 0 };
+
+    void reset();
+    QJsonObject toJson() const;
+};
+
+extern Metrics metrics;
+
+//! Adds the lifetime of the scope to one of the Metrics timers
+class MetricsTimer
+{
+    Q_DISABLE_COPY(MetricsTimer)
+
+public:
+    explicit MetricsTimer(std::atomic<qint64> &nsecs) : m_nsecs(nsecs) { m_timer.start(); }
+    ~MetricsTimer() { m_nsecs += m_timer.nsecsElapsed(); }
+
+private:
+    std::atomic<qint64> &m_nsecs;
+    QElapsedTimer m_timer;
+};
+
+//! Runs func and adds its duration to nsecs
+template<typename Func>
+auto measure(std::atomic<qint64> &nsecs, Func &&func) -> decltype(func())
+{
+    MetricsTimer timer(nsecs);
+    return func();
+}
+
+//! Logs throughput and an ETA every interval until it is destroyed
+class ProgressReporter
+{
+    Q_DISABLE_COPY(ProgressReporter)
+
+public:
+    explicit ProgressReporter(int intervalSecs);
+    ~ProgressReporter();
+
+private:
+    void report(qint64 elapsedNsecs, qint64 intervalBytes, qint64 intervalNsecs) const;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_quit { false };
+    std::thread m_thread;
+};
+
+bool writeMetrics(const QString &filename, qint64 elapsedNsecs);
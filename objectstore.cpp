@@ -0,0 +1,191 @@
+#include "objectstore.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QStringBuilder>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "changelog.h"
+
+ObjectStore::ObjectStore(const QString &path, ChangeLog *changeLog) :
+    m_dir(path),
+    m_changeLog(changeLog)
+{
+}
+
+bool ObjectStore::open()
+{
+    if(!m_dir.mkpath(m_dir.absolutePath()))
+    {
+        qWarning() << "could not create object store" << m_dir.absolutePath();
+        return false;
+    }
+
+    const auto logPath = m_dir.absoluteFilePath(QStringLiteral("__refcounts.log"));
+
+    m_log.setFileName(logPath);
+    if(m_log.exists())
+    {
+        if(!m_log.open(QIODevice::ReadOnly))
+        {
+            qWarning() << "could not open reference log" << m_log.errorString();
+            return false;
+        }
+
+        while(!m_log.atEnd())
+        {
+            const auto line = m_log.readLine().trimmed();
+            if(line.isEmpty())
+                continue;
+
+            const auto separator = line.indexOf(' ');
+            bool ok;
+            const auto delta = separator == -1 ? 0 : line.mid(separator + 1).toInt(&ok);
+            if(separator == -1 || !ok)
+            {
+                //a torn last line from an interrupted run, everything before it is valid
+                qWarning() << "ignoring invalid reference log line" << line;
+                continue;
+            }
+
+            m_refCounts[QString::fromLatin1(line.left(separator))] += delta;
+        }
+
+        m_log.close();
+    }
+
+    //compact the log to one line per live object
+    {
+        const auto tempPath = logPath % ".tmp";
+
+        QFile tempFile(tempPath);
+        if(!tempFile.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        {
+            qWarning() << "could not open reference log" << tempFile.errorString();
+            return false;
+        }
+
+        for(auto iter = m_refCounts.begin(); iter != m_refCounts.end(); )
+        {
+            if(iter.value() <= 0)
+            {
+                iter = m_refCounts.erase(iter);
+                continue;
+            }
+
+            tempFile.write(iter.key().toLatin1() + ' ' + QByteArray::number(iter.value()) + '\n');
+            ++iter;
+        }
+
+        if(!tempFile.flush())
+        {
+            qWarning() << "could not write reference log" << tempFile.errorString();
+            return false;
+        }
+        tempFile.close();
+
+        if(::rename(QFile::encodeName(tempPath).constData(), QFile::encodeName(logPath).constData()) == -1)
+        {
+            qWarning() << "could not replace reference log" << strerror(errno);
+            return false;
+        }
+    }
+
+    if(!m_log.open(QIODevice::WriteOnly | QIODevice::Append))
+    {
+        qWarning() << "could not open reference log" << m_log.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+QString ObjectStore::filePath(const QString &digest) const
+{
+    return m_dir.absoluteFilePath(digest.left(2) % QLatin1Char('/') % digest % ".bmp");
+}
+
+bool ObjectStore::ref(const QString &digest, bool &write)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!log(digest, 1))
+        return false;
+
+    m_refCounts[digest]++;
+
+    //an earlier reference may never have gotten its object written, or is still writing it
+    write = !QFileInfo::exists(filePath(digest));
+
+    if(write && !m_dir.mkpath(digest.left(2)))
+    {
+        qWarning() << "could not create object dir" << m_dir.absoluteFilePath(digest.left(2));
+        return false;
+    }
+
+    return true;
+}
+
+
+bool ObjectStore::unref(const QString &digest)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto iter = m_refCounts.find(digest);
+    if(iter == m_refCounts.end())
+    {
+        qWarning() << "object is not referenced" << digest;
+        return true;
+    }
+
+    if(!log(digest, -1))
+        return false;
+
+    if(--iter.value() > 0)
+        return true;
+
+    m_refCounts.erase(iter);
+
+    if(!QFile::remove(filePath(digest)) && QFile::exists(filePath(digest)))
+    {
+        qWarning() << "could not remove object" << filePath(digest);
+        return false;
+    }
+
+    if(m_changeLog && !m_changeLog->removed(filePath(digest)))
+        return false;
+
+    return true;
+}
+
+bool ObjectStore::unrefParts(const QJsonArray &parts)
+{
+    for(const auto &partValue : parts)
+    {
+        const auto objectValue = partValue.toObject().value(QStringLiteral("object"));
+        if(objectValue.type() != QJsonValue::String)
+            continue;
+
+        if(!unref(objectValue.toString()))
+            return false;
+    }
+
+    return true;
+}
+
+bool ObjectStore::log(const QString &digest, int delta)
+{
+    //flushed right away so the line survives the process getting killed
+    if(m_log.write(digest.toLatin1() + ' ' + QByteArray::number(delta) + '\n') == -1 || !m_log.flush())
+    {
+        qWarning() << "could not write reference log" << m_log.errorString();
+        return false;
+    }
+
+    return true;
+}
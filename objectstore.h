@@ -0,0 +1,58 @@
+#pragma once
+
+#include <QDir>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+#include <mutex>
+
+class QJsonArray;
+
+class ChangeLog;
+
+//! Shared directory of part bitmaps named by the digest of their payload, so a
+//! chunk that shows up in many files or many runs is only stored once.
+//!
+//! References are counted in an append-only log next to the objects. A
+//! reference is logged before the index using it is written and dropped only
+//! after the index stopped using it, so an interrupted run can leak an object
+//! but never delete one that is still referenced. Whether an object has to be
+//! written goes by what is on disk instead, a reference logged by a run that
+//! never got to write its object does not keep the next one from writing it.
+class ObjectStore
+{
+    Q_DISABLE_COPY(ObjectStore)
+
+public:
+    //! Deleted objects go to changeLog if there is one
+    explicit ObjectStore(const QString &path, ChangeLog *changeLog = nullptr);
+
+    QString path() const { return m_dir.absolutePath(); }
+
+    //! Replays and compacts the reference log. Only needed before ref()/unref().
+    bool open();
+
+    QString filePath(const QString &digest) const;
+
+    //! Adds a reference to digest. write is set if the object is not on disk,
+    //! the caller then has to write it before its index. Jobs sharing an object
+    //! may both get write while the first one is still writing it, so it has
+    //! to go to a tempBitmapPath() and be moved into place by commitBitmap().
+    bool ref(const QString &digest, bool &write);
+
+    //! Drops a reference and deletes the object once the last one is gone.
+    bool unref(const QString &digest);
+
+    //! unref()s every object referenced by a parts array of a file index
+    bool unrefParts(const QJsonArray &parts);
+
+private:
+    bool log(const QString &digest, int delta);
+
+    QDir m_dir;
+    ChangeLog *m_changeLog;
+    QFile m_log;
+    QHash<QString, int> m_refCounts;
+    std::mutex m_mutex;
+};
@@ -0,0 +1,152 @@
+#include "packs.h"
+
+#include <QDebug>
+#include <QFile>
+#include <QStringBuilder>
+#include <QUuid>
+
+#include "bitmap.h"
+#include "changelog.h"
+#include "mappedbitmap.h"
+
+namespace {
+const int maxMappedPacks { 8 };
+}
+
+PackWriter::PackWriter(const QString &path, int packSize, ChangeLog *changeLog) :
+    m_dir(path),
+    m_packSize(packSize),
+    m_changeLog(changeLog)
+{
+}
+
+bool PackWriter::open()
+{
+    if(!m_dir.mkpath(m_dir.absolutePath()))
+    {
+        qWarning() << "could not create pack dir" << m_dir.absolutePath();
+        return false;
+    }
+
+    return true;
+}
+
+bool PackWriter::add(const QByteArray &content, Committed committed)
+{
+    Pack full;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if(!m_current.files.isEmpty() && m_current.content.size() + content.size() > m_packSize)
+            std::swap(full, m_current);
+
+        if(m_current.id.isEmpty())
+            m_current.id = QUuid::createUuid().toString().remove(QLatin1Char('{')).remove(QLatin1Char('}'));
+
+        m_current.files.append(std::make_pair(quint32(m_current.content.size()), std::move(committed)));
+        m_current.content.append(content);
+    }
+
+    //outside of the lock, the other threads keep filling the next pack meanwhile
+    if(!full.files.isEmpty())
+        return write(full);
+
+    return true;
+}
+
+bool PackWriter::flush()
+{
+    Pack full;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::swap(full, m_current);
+    }
+
+    if(!full.files.isEmpty())
+        return write(full);
+
+    return true;
+}
+
+void PackWriter::reference(const QString &pack)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_referenced.insert(pack);
+}
+
+bool PackWriter::removeUnreferenced()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for(const auto &filename : m_dir.entryList(QStringList { QStringLiteral("*.bmp") }, QDir::Files))
+    {
+        if(m_referenced.contains(filename.left(filename.size() - 4)))
+            continue;
+
+        qInfo() << "removing unreferenced pack" << filename;
+        if(!QFile::remove(m_dir.absoluteFilePath(filename)))
+        {
+            qWarning() << "could not remove pack" << m_dir.absoluteFilePath(filename);
+            return false;
+        }
+
+        if(m_changeLog && !m_changeLog->removed(m_dir.absoluteFilePath(filename)))
+            return false;
+    }
+
+    return true;
+}
+
+bool PackWriter::write(Pack &pack)
+{
+    const auto filename = m_dir.absoluteFilePath(pack.id % ".bmp");
+    if(!writeBitmap(filename, pack.content))
+        return false;
+
+    if(m_changeLog && !m_changeLog->created(filename))
+        return false;
+
+    for(const auto &file : pack.files)
+        if(!file.second(pack.id, file.first))
+            return false;
+
+    return true;
+}
+
+PackReader::PackReader(const QString &path) :
+    m_dir(path)
+{
+}
+
+PackReader::~PackReader() = default;
+
+QString PackReader::filePath(const QString &pack) const
+{
+    return m_dir.absoluteFilePath(pack % ".bmp");
+}
+
+std::shared_ptr<const MappedBitmap> PackReader::open(const QString &pack)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for(auto iter = m_packs.begin(); iter != m_packs.end(); ++iter)
+    {
+        if(iter->first != pack)
+            continue;
+
+        m_packs.splice(m_packs.begin(), m_packs, iter);
+        return m_packs.front().second;
+    }
+
+    const auto bitmap = std::make_shared<MappedBitmap>();
+    if(!bitmap->open(filePath(pack)))
+        return nullptr;
+
+    m_packs.emplace_front(pack, bitmap);
+    if(m_packs.size() > maxMappedPacks)
+        m_packs.pop_back();
+
+    return bitmap;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QSet>
+#include <QString>
+#include <QVector>
+
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+class ChangeLog;
+class MappedBitmap;
+
+//! Appends small files into shared pack bitmaps (__packs/<id>.bmp in the
+//! target root) instead of giving each of them a part bitmap of its own.
+//!
+//! The index of a packed file is only written once its pack is on disk, so an
+//! interrupted run never leaves an index pointing into a missing pack. Packs
+//! are not reference counted, removeUnreferenced() sweeps the ones no index
+//! mentioned after a complete run.
+class PackWriter
+{
+    Q_DISABLE_COPY(PackWriter)
+
+public:
+    //! Called once the content is stored in pack at offset, writes the file's index
+    using Committed = std::function<bool(const QString &pack, quint32 offset)>;
+
+    PackWriter(const QString &path, int packSize, ChangeLog *changeLog = nullptr);
+
+    QString path() const { return m_dir.absolutePath(); }
+
+    bool open();
+
+    //! Queues content for the current pack, writes the pack first if it would not fit anymore
+    bool add(const QByteArray &content, Committed committed);
+
+    //! Writes the current pack and commits everything in it
+    bool flush();
+
+    //! Keeps a pack alive, called for every pack an index of this run references
+    void reference(const QString &pack);
+
+    //! Only valid after every index of the tree went through reference()
+    bool removeUnreferenced();
+
+private:
+    struct Pack
+    {
+        QString id;
+        QByteArray content;
+        QVector<std::pair<quint32, Committed>> files;
+    };
+
+    bool write(Pack &pack);
+
+    QDir m_dir;
+    const int m_packSize;
+    ChangeLog *m_changeLog;
+    Pack m_current;
+    QSet<QString> m_referenced;
+    std::mutex m_mutex;
+};
+
+//! Keeps the most recently used packs mapped, compile restores the files of
+//! one pack next to each other, so every pack is only read once.
+class PackReader
+{
+    Q_DISABLE_COPY(PackReader)
+
+public:
+    explicit PackReader(const QString &path);
+    ~PackReader();
+
+    QString filePath(const QString &pack) const;
+
+    //! Safe from several threads, a pack dropped from the cache stays mapped
+    //! until its last user lets go of it
+    std::shared_ptr<const MappedBitmap> open(const QString &pack);
+
+private:
+    QDir m_dir;
+    //! most recently used first
+    std::list<std::pair<QString, std::shared_ptr<const MappedBitmap>>> m_packs;
+    std::mutex m_mutex;
+};
@@ -0,0 +1,119 @@
+#include "parity.h"
+
+#include "gf256.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace parity {
+std::uint8_t coefficient(int parityIndex, int dataIndex)
+{
+    //1 / (x_j + y_i) with x_j = 128 + j and y_i = i, the two sets never meet
+    return gf256::inv(std::uint8_t((maxDataShards + parityIndex) ^ dataIndex));
+}
+
+void addShard(QVector<QByteArray> &parity, int dataIndex, const char *data, int length)
+{
+    for(int j = 0; j < parity.size(); j++)
+    {
+        auto &shard = parity[j];
+        if(shard.size() < length)
+            shard.append(QByteArray(length - shard.size(), '\0'));
+
+        gf256::mulAdd(reinterpret_cast<std::uint8_t *>(shard.data()), reinterpret_cast<const std::uint8_t *>(data),
+                      coefficient(j, dataIndex), std::size_t(length));
+    }
+}
+
+bool reconstruct(QVector<QByteArray> &shards, int dataShards)
+{
+    QVector<int> lost;
+    for(int i = 0; i < dataShards; i++)
+        if(shards.at(i).isEmpty())
+            lost.append(i);
+
+    if(lost.isEmpty())
+        return true;
+
+    QVector<int> rows;
+    for(int j = 0; dataShards + j < shards.size() && rows.size() < lost.size(); j++)
+        if(!shards.at(dataShards + j).isEmpty())
+            rows.append(j);
+
+    if(rows.size() < lost.size())
+        return false;
+
+    const auto n = lost.size();
+    const auto length = std::size_t(shards.at(dataShards + rows.first()).size());
+
+    //what is left of each parity shard once the surviving parts are taken out
+    QVector<QByteArray> syndromes;
+    for(const auto row : rows)
+    {
+        auto syndrome = shards.at(dataShards + row);
+        for(int i = 0; i < dataShards; i++)
+            if(!shards.at(i).isEmpty())
+                gf256::mulAdd(reinterpret_cast<std::uint8_t *>(syndrome.data()),
+                              reinterpret_cast<const std::uint8_t *>(shards.at(i).constData()),
+                              coefficient(row, i), length);
+        syndromes.append(syndrome);
+    }
+
+    //syndromes = matrix * lost parts, inverted with gauss jordan
+    std::vector<std::uint8_t> matrix(std::size_t(n * n));
+    std::vector<std::uint8_t> inverse(std::size_t(n * n), 0);
+    for(int r = 0; r < n; r++)
+    {
+        for(int c = 0; c < n; c++)
+            matrix[r * n + c] = coefficient(rows.at(r), lost.at(c));
+        inverse[r * n + r] = 1;
+    }
+
+    for(int column = 0; column < n; column++)
+    {
+        int pivot = column;
+        while(pivot < n && !matrix[pivot * n + column])
+            pivot++;
+        if(pivot == n)
+            return false;
+
+        if(pivot != column)
+        {
+            std::swap_ranges(matrix.begin() + pivot * n, matrix.begin() + (pivot + 1) * n, matrix.begin() + column * n);
+            std::swap_ranges(inverse.begin() + pivot * n, inverse.begin() + (pivot + 1) * n, inverse.begin() + column * n);
+        }
+
+        const auto scale = gf256::inv(matrix[column * n + column]);
+        for(int c = 0; c < n; c++)
+        {
+            matrix[column * n + c] = gf256::mul(matrix[column * n + c], scale);
+            inverse[column * n + c] = gf256::mul(inverse[column * n + c], scale);
+        }
+
+        for(int r = 0; r < n; r++)
+        {
+            const auto factor = matrix[r * n + column];
+            if(r == column || !factor)
+                continue;
+
+            for(int c = 0; c < n; c++)
+            {
+                matrix[r * n + c] ^= gf256::mul(matrix[column * n + c], factor);
+                inverse[r * n + c] ^= gf256::mul(inverse[column * n + c], factor);
+            }
+        }
+    }
+
+    for(int c = 0; c < n; c++)
+    {
+        QByteArray shard(int(length), '\0');
+        for(int r = 0; r < n; r++)
+            gf256::mulAdd(reinterpret_cast<std::uint8_t *>(shard.data()),
+                          reinterpret_cast<const std::uint8_t *>(syndromes.at(r).constData()),
+                          inverse[c * n + r], length);
+        shards[lost.at(c)] = shard;
+    }
+
+    return true;
+}
+}
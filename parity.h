@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QByteArray>
+#include <QVector>
+
+#include <cstdint>
+
+//! Systematic Reed-Solomon erasure code over GF(2^8) for the parity parts of
+//! a file. A stripe of data parts gets parity shards as long as its longest
+//! part, shorter parts count as padded with zeros. Parity shard j is the sum
+//! of coefficient(j, i) * part i over a Cauchy matrix. Every square piece of
+//! it can be inverted, so a stripe survives losing as many of its parts as
+//! it has parity. The coefficients do not depend on the stripe size, a short
+//! last stripe is encoded like a full one.
+namespace parity {
+const int maxDataShards { 128 };
+const int maxParityShards { 127 };
+
+//! Recorded with every stripe, so another code can be told apart later
+const char codeName[] { "cauchy-gf256" };
+
+std::uint8_t coefficient(int parityIndex, int dataIndex);
+
+//! Adds data shard dataIndex of a stripe to its parity, which grows with
+//! zeros to fit. Feeding the parts as they come keeps none of them around.
+void addShard(QVector<QByteArray> &parity, int dataIndex, const char *data, int length);
+
+//! shards holds the dataShards data shards followed by the parity, all of
+//! one length and the lost ones empty. Rebuilds the lost data shards, false
+//! if more are lost than there is parity left.
+bool reconstruct(QVector<QByteArray> &shards, int dataShards);
+}
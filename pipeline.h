@@ -0,0 +1,138 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QtGlobal>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+//! Fixed capacity queue connecting two pipeline stages. push() blocks while the
+//! queue is full, pop() while it is empty. After close() push() fails and pop()
+//! only drains what is left.
+template<typename T>
+class BoundedQueue
+{
+    Q_DISABLE_COPY(BoundedQueue)
+
+public:
+    explicit BoundedQueue(std::size_t capacity) : m_capacity(capacity) {}
+
+    bool push(T value)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notFull.wait(lock, [this](){ return m_closed || m_queue.size() < m_capacity; });
+        if(m_closed)
+            return false;
+
+        m_queue.push_back(std::move(value));
+        lock.unlock();
+        m_notEmpty.notify_one();
+        return true;
+    }
+
+    bool pop(T &value)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_notEmpty.wait(lock, [this](){ return m_closed || !m_queue.empty(); });
+        if(m_queue.empty())
+            return false;
+
+        value = std::move(m_queue.front());
+        m_queue.pop_front();
+        lock.unlock();
+        m_notFull.notify_one();
+        return true;
+    }
+
+    bool isEmpty()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queue.empty();
+    }
+
+    void close()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_closed = true;
+        }
+        m_notFull.notify_all();
+        m_notEmpty.notify_all();
+    }
+
+private:
+    const std::size_t m_capacity;
+    std::deque<T> m_queue;
+    bool m_closed { false };
+    std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+};
+
+//! Accounts the time one pipeline stage spends blocked on its queues versus
+//! doing actual work. Only ever touched by the stage's own thread.
+class PipelineStage
+{
+public:
+    explicit PipelineStage(const char *name) : m_name(name) {}
+
+    template<typename T>
+    bool push(BoundedQueue<T> &queue, T value)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        const auto result = queue.push(std::move(value));
+        m_waitNsecs += timer.nsecsElapsed();
+        return result;
+    }
+
+    template<typename T>
+    bool pop(BoundedQueue<T> &queue, T &value)
+    {
+        QElapsedTimer timer;
+        timer.start();
+        const auto result = queue.pop(value);
+        m_waitNsecs += timer.nsecsElapsed();
+        return result;
+    }
+
+    template<typename Func>
+    auto work(Func &&func) -> decltype(func())
+    {
+        QElapsedTimer timer;
+        timer.start();
+        struct Accounter
+        {
+            ~Accounter() { nsecs += timer.nsecsElapsed(); }
+            qint64 &nsecs;
+            QElapsedTimer &timer;
+        } accounter { m_workNsecs, timer };
+        return func();
+    }
+
+    //! Accounts func as waiting, for blocking on something else than the queues
+    template<typename Func>
+    auto wait(Func &&func) -> decltype(func())
+    {
+        QElapsedTimer timer;
+        timer.start();
+        struct Accounter
+        {
+            ~Accounter() { nsecs += timer.nsecsElapsed(); }
+            qint64 &nsecs;
+            QElapsedTimer &timer;
+        } accounter { m_waitNsecs, timer };
+        return func();
+    }
+
+    const char *name() const { return m_name; }
+    qint64 waitNsecs() const { return m_waitNsecs; }
+    qint64 workNsecs() const { return m_workNsecs; }
+
+private:
+    const char *m_name;
+    qint64 m_waitNsecs { 0 };
+    qint64 m_workNsecs { 0 };
+};
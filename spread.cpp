@@ -0,0 +1,1604 @@
+#include "spread.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QDateTime>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QStringBuilder>
+#include <QUuid>
+#include <QScopedPointer>
+#include <QSet>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <future>
+#include <limits>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
+#include "utils/fileutils.h"
+
+#include "bitmap.h"
+#include "bufferpool.h"
+#include "changelog.h"
+#include "chunker.h"
+#include "compression.h"
+#include "dirscanner.h"
+#include "ioengine.h"
+#include "journal.h"
+#include "digest.h"
+#include "metrics.h"
+#include "manifest.h"
+#include "objectstore.h"
+#include "packs.h"
+#include "parity.h"
+#include "pipeline.h"
+#include "statcache.h"
+#include "workstealingpool.h"
+
+struct DirectoryDiff
+{
+    QDir sourceDir;
+    QVector<DirEntry> entries;
+    bool rewriteIndex;
+    StatCache::Stat sourceStat;
+};
+
+//! Drops the object store references of every file below targetDir before it gets removed
+bool releaseTree(const QDir &targetDir, ObjectStore &objectStore)
+{
+    const auto indexPath = targetDir.absoluteFilePath(QStringLiteral("__index.bmp"));
+    if(!QFile::exists(indexPath))
+        return true;
+
+    QJsonObject jsonObject;
+    if(!readIndex(indexPath, jsonObject))
+    {
+        //nothing to release, at worst the objects it referenced are leaked
+        qWarning() << "could not release" << targetDir.absolutePath();
+        return true;
+    }
+
+    const auto type = jsonObject.value(QStringLiteral("type")).toString();
+    if(type == QStringLiteral("file"))
+        return objectStore.unrefParts(jsonObject.value(QStringLiteral("parts")).toArray());
+    else if(type == QStringLiteral("directory"))
+    {
+        for(const auto &entryValue : jsonObject.value(QStringLiteral("entries")).toArray())
+            if(!releaseTree(QDir(targetDir.absoluteFilePath(entryValue.toString())), objectStore))
+                return false;
+    }
+
+    return true;
+}
+
+bool hashFile(const QString &filename, DigestAlgorithm algorithm, int threads, QByteArray &digest)
+{
+    QFile file(filename);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "could not open source file" << file.errorString();
+        return false;
+    }
+
+    MetricsTimer timer(metrics.hashNsecs);
+
+    FileDigest hash(algorithm, threads);
+    if(!hash.addData(&file))
+    {
+        qWarning() << "could not read source file" << file.errorString();
+        return false;
+    }
+
+    metrics.bytesRead += file.size();
+
+    digest = hash.result();
+    return true;
+}
+
+namespace {
+struct Chunk
+{
+    qint64 startPos;
+    QByteArray buffer;
+    //! set for zero parts, holes have no buffer and zero runs drop theirs
+    qint64 zeroLength { 0 };
+    //! only valid with compression, empty if the part is stored raw
+    std::shared_future<QByteArray> compressed;
+    //! the part an interrupted run already wrote for this chunk
+    QJsonObject journaled;
+    //! with a buffer pool buffer only points into this block
+    BufferPool::Lease lease;
+};
+
+//! A run of data or of a hole in the source file
+struct Extent
+{
+    qint64 end;
+    bool hole;
+};
+
+//! Finds the data or hole run starting at pos. Filesystems without
+//! SEEK_DATA/SEEK_HOLE report the whole file as data.
+bool nextExtent(QFile &file, qint64 pos, Extent &extent)
+{
+    const auto fd = file.handle();
+    const auto size = file.size();
+
+    const auto data = lseek(fd, pos, SEEK_DATA);
+    if(data == -1)
+    {
+        if(errno == ENXIO)
+            extent = Extent { size, true };
+        else if(errno == EINVAL || errno == EOPNOTSUPP)
+            extent = Extent { size, false };
+        else
+        {
+            qWarning() << "could not seek source file" << strerror(errno);
+            return false;
+        }
+    }
+    else if(data > pos)
+        extent = Extent { qMin<qint64>(data, size), true };
+    else
+    {
+        const auto hole = lseek(fd, pos, SEEK_HOLE);
+        if(hole == -1)
+        {
+            qWarning() << "could not seek source file" << strerror(errno);
+            return false;
+        }
+        extent = Extent { qMin<qint64>(hole, size), false };
+    }
+
+    //SEEK_DATA and SEEK_HOLE move the offset as well
+    if(!file.seek(pos))
+    {
+        qWarning() << "could not seek source file" << file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+//! Reads maxSize bytes, less only at the end of the source. Pipes and sockets
+//! hand out whatever they have, so this keeps reading until maxSize is there.
+qint64 readFull(QIODevice &source, char *data, qint64 maxSize)
+{
+    qint64 length = 0;
+    while(length < maxSize)
+    {
+        const auto read = source.read(data + length, maxSize - length);
+        if(read == -1)
+            return -1;
+
+        //files and pipes are at their end, other devices may just have nothing yet
+        if(read == 0 && !source.waitForReadyRead(-1))
+            break;
+
+        length += read;
+    }
+
+    return length;
+}
+
+bool readFull(QIODevice &source, qint64 maxSize, QByteArray &buffer)
+{
+    buffer.resize(maxSize);
+
+    const auto length = readFull(source, buffer.data(), maxSize);
+    if(length == -1)
+    {
+        buffer.clear();
+        return false;
+    }
+
+    buffer.resize(length);
+    return true;
+}
+
+//! 256 bytes are or'ed together per step, which the compiler vectorizes
+bool isAllZero(const QByteArray &buffer)
+{
+    const auto data = buffer.constData();
+    const auto length = buffer.size();
+
+    int pos = 0;
+    for(; pos + 256 <= length; pos += 256)
+    {
+        quint64 words[32];
+        std::memcpy(words, data + pos, sizeof(words));
+
+        quint64 any = 0;
+        for(const auto word : words)
+            any |= word;
+        if(any)
+            return false;
+    }
+
+    for(; pos < length; pos++)
+        if(data[pos])
+            return false;
+
+    return true;
+}
+
+void reportStage(const PipelineStage &stage)
+{
+    qCDebug(picsyncTrace).noquote() << QStringLiteral("%0: worked %1ms, waited %2ms")
+                         .arg(stage.name())
+                         .arg(stage.workNsecs() / 1000000)
+                         .arg(stage.waitNsecs() / 1000000);
+}
+}
+
+//! Tells the change log about a bitmap this run wrote, if there is one
+bool logCreated(const QString &path, const SpreadOptions &options)
+{
+    return !options.changeLog || options.changeLog->created(path);
+}
+
+bool logRemoved(const QString &path, const SpreadOptions &options)
+{
+    return !options.changeLog || options.changeLog->removed(path);
+}
+
+//! Writes one part bitmap and appends its entry to parts. Content defined parts
+//! are named after their digest so an unchanged chunk finds its bitmap from the
+//! previous run and is not written again. With an object store the bitmap is
+//! only written if its object is not on disk yet. Every part records its
+//! digest so -a verify can check it on its own. Compressed parts are stored
+//! under their digest plus codec, so they never get mixed up with a raw bitmap
+//! of the same content.
+//!
+//! written is called once the bitmap is written, with sync once it is on disk.
+//! With an engine that may be after this returned.
+bool writePart(const QDir &targetDir, const Chunk &chunk, const SpreadOptions &options, IoEngine *engine, bool sync,
+               const IoEngine::Done &written, QJsonArray &parts)
+{
+    bool queued = false;
+    //objects and content defined parts are taken as they are once they exist, so they go to a
+    //path of their own first and are renamed into place, a torn write never gets reused
+    const auto write = [&](const QString &filename, const QByteArray &content, bool reused){
+        const auto path = reused ? tempBitmapPath(filename) : filename;
+        //on an engine the rename waits for the write as well, with sync it is on disk before the journal takes the part
+        const auto finish = [filename, path, sync](bool written){
+            if(path == filename)
+                return written;
+            if(!written)
+            {
+                QFile::remove(path);
+                return false;
+            }
+            return commitBitmap(path, filename, sync);
+        };
+
+        if(engine)
+        {
+            const auto changeLog = options.changeLog;
+            engine->writeBitmap(path, content, sync, [written, changeLog, filename, finish](bool durable){
+                written(finish(durable) && (!changeLog || changeLog->created(filename)));
+            });
+            queued = true;
+            return true;
+        }
+
+        return finish(writeBitmap(path, content, sync)) && logCreated(filename, options);
+    };
+
+    QJsonObject part;
+    part[QStringLiteral("startPos")] = chunk.startPos;
+
+    //zeros are not stored at all, compile leaves a hole
+    if(chunk.zeroLength)
+    {
+        part[QStringLiteral("endPos")] = chunk.startPos + chunk.zeroLength;
+        part[QStringLiteral("length")] = chunk.zeroLength;
+        part[QStringLiteral("zero")] = true;
+        parts.append(part);
+
+        metrics.zeroBytes += chunk.zeroLength;
+        written(true);
+        return true;
+    }
+
+    part[QStringLiteral("endPos")] = chunk.startPos + chunk.buffer.length();
+    part[QStringLiteral("length")] = chunk.buffer.length();
+
+    const auto digest = measure(metrics.hashNsecs, [&](){ return QString(partDigest(options.digestAlgorithm, chunk.buffer).toHex()); });
+    part[partDigestName(options.digestAlgorithm)] = digest;
+
+    auto content = chunk.buffer;
+    auto name = digest;
+
+    if(chunk.compressed.valid())
+    {
+        const auto compressed = chunk.compressed.get();
+        if(!compressed.isEmpty())
+        {
+            part[QStringLiteral("codec")] = zlibCodec();
+            part[QStringLiteral("storedLength")] = compressed.length();
+
+            metrics.compressionSavedBytes += chunk.buffer.length() - compressed.length();
+
+            content = compressed;
+            name = digest % '.' % zlibCodec();
+        }
+    }
+
+    if(options.objectStore)
+    {
+        part[QStringLiteral("object")] = name;
+
+        bool missing;
+        if(!options.objectStore->ref(name, missing))
+            return false;
+
+        if(missing && !write(options.objectStore->filePath(name), content, true))
+            return false;
+    }
+    else
+    {
+        QString filename;
+        QString completePath;
+
+        if(options.contentDefinedChunking)
+        {
+            filename = name % ".bmp";
+            completePath = targetDir.absoluteFilePath(filename);
+        }
+        else
+        {
+            do
+            {
+                filename = QUuid::createUuid().toString().remove(QLatin1Char('{')).remove(QLatin1Char('}')) % ".bmp";
+                completePath = targetDir.absoluteFilePath(filename);
+            }
+            while(QFileInfo(completePath).exists());
+        }
+
+        part[QStringLiteral("filename")] = filename;
+
+        if(!options.contentDefinedChunking || !QFileInfo(completePath).exists())
+            if(!write(completePath, content, options.contentDefinedChunking))
+                return false;
+    }
+
+    parts.append(part);
+
+    if(!queued)
+        written(true);
+
+    return true;
+}
+
+//! Cuts source into part bitmaps. Reading, hashing and writing run as three
+//! stages connected by bounded queues so the slowest one sets the pace instead
+//! of the sum of all three. Holes are skipped without reading them and both
+//! they and all zero chunks become zero parts.
+//!
+//! source may also be a stream (stdin, a pipe, a socket), which has no size
+//! and no holes and ends with the first empty read. Only the queues hold
+//! parts, so memory stays bounded however long it is. length is set to the
+//! number of bytes spread.
+//!
+//! With options.ioQueueDepth the bitmaps of a file bigger than one part are
+//! kept in flight on an IoEngine instead of being written one at a time.
+//!
+//! With a journal every part is logged once it is durable. Chunks that line up
+//! with the parts an interrupted run logged are only hashed, the parts from the
+//! journal are taken over without writing anything.
+//!
+//! With compression every chunk is also handed to options.compressThreads
+//! compressors, the write stage waits for the results in file order. The write
+//! queue is long enough to keep all of them busy.
+//!
+//! With options.parityParts a parity stage adds every part that is not zero to
+//! the parity of its stripe as it comes, over the raw content, and writes the
+//! parity bitmaps of each full stripe. Nothing waits for a stripe to fill and
+//! no part is kept for it. stripes gets one entry per stripe.
+bool spreadParts(QIODevice &source, const QDir &targetDir, const SpreadOptions &options, FileJournal *journal,
+                 QJsonArray &parts, QJsonArray &stripes, QByteArray &digest, qint64 &length)
+{
+    const auto compress = options.compressionLevel > 0;
+
+    const auto sequential = source.isSequential();
+    const auto size = sequential ? std::numeric_limits<qint64>::max() : source.size();
+    //only files have extents, everything else is one run of data
+    const auto sourceFile = sequential ? nullptr : qobject_cast<QFile *>(&source);
+
+    BoundedQueue<Chunk> hashQueue(4);
+    BoundedQueue<Chunk> writeQueue(compress ? 4 + options.compressThreads : 4);
+    BoundedQueue<std::packaged_task<QByteArray()>> compressQueue(options.compressThreads);
+
+    PipelineStage readStage("read");
+    PipelineStage hashStage("hash");
+    PipelineStage writeStage("write");
+
+    std::thread hashThread([&](){
+        FileDigest hash(options.digestAlgorithm, options.hashThreads);
+
+        //a chunk is dropped once hashed, it must not pin a pooled block while waiting for the next one
+        Chunk chunk;
+        while(hashStage.pop(hashQueue, chunk))
+        {
+            hashStage.work([&](){
+                if(chunk.zeroLength)
+                    hash.addZeros(chunk.zeroLength);
+                else
+                    hash.addData(chunk.buffer);
+            });
+            chunk = Chunk();
+        }
+
+        digest = hash.result();
+    });
+
+    //compressQueue drains after close(), so every future the write stage waits for gets its result
+    std::vector<std::thread> compressThreads;
+    if(compress)
+        for(int i = 0; i < options.compressThreads; i++)
+            compressThreads.emplace_back([&](){
+                std::packaged_task<QByteArray()> task;
+                while(compressQueue.pop(task))
+                {
+                    task();
+                    task = std::packaged_task<QByteArray()>();
+                }
+            });
+
+    std::atomic<bool> writeFailed { false };
+
+    //the only thread touching parts until it is joined, keeps them in file order
+    std::thread writeThread([&](){
+        //parts complete out of order with an engine, the journal still gets them in file order
+        enum PartState : char { Pending, Durable, Failed, Logged };
+        std::vector<PartState> states;
+        std::size_t logged = 0;
+        const auto logDurable = [&](){
+            for(; logged < states.size() && states[logged] != Pending; logged++)
+            {
+                if(states[logged] == Failed)
+                    return false;
+                if(states[logged] == Durable && journal && !journal->append(parts.at(logged).toObject()))
+                    return false;
+            }
+            return true;
+        };
+
+        //a single part is not worth setting up a ring for
+        std::unique_ptr<IoEngine> engine;
+        if(options.ioQueueDepth > 0 && size > options.maxChunkSize)
+            engine = IoEngine::create(options.ioQueueDepth);
+
+        Chunk chunk;
+        while(true)
+        {
+            //starved anyway, so the engine hands back the finished parts and their pooled blocks before waiting
+            if(engine && writeQueue.isEmpty() && !writeStage.work([&](){ return engine->drain() && logDurable(); }))
+            {
+                writeFailed = true;
+                writeQueue.close();
+                break;
+            }
+
+            if(!writeStage.pop(writeQueue, chunk))
+                break;
+
+            const auto written = writeStage.work([&](){
+                if(!chunk.journaled.isEmpty())
+                {
+                    parts.append(chunk.journaled);
+                    states.push_back(Logged);
+                    return logDurable();
+                }
+
+                const auto index = states.size();
+                states.push_back(Pending);
+                //an engine may still write from the pooled block after writePart() returned
+                const auto lease = chunk.lease;
+                const auto done = [&states, index, lease](bool durable){ states[index] = durable ? Durable : Failed; };
+                if(!writePart(targetDir, chunk, options, engine.get(), journal != nullptr, done, parts))
+                    return false;
+
+                return logDurable();
+            });
+            chunk = Chunk();
+            if(!written)
+            {
+                writeFailed = true;
+                writeQueue.close();
+                break;
+            }
+        }
+
+        if(engine && !writeStage.work([&](){ return engine->drain(); }))
+            writeFailed = true;
+        if(!writeFailed && !logDurable())
+            writeFailed = true;
+    });
+
+    //the index each part will get in parts, the stripes refer to them by it
+    BoundedQueue<std::pair<int, Chunk>> parityQueue(4);
+    PipelineStage parityStage("parity");
+    std::atomic<bool> parityFailed { false };
+
+    std::thread parityThread;
+    if(options.parityParts > 0)
+        parityThread = std::thread([&](){
+            QVector<QByteArray> shards(options.parityParts);
+            QJsonArray members;
+            int shardLength = 0;
+
+            const auto finishStripe = [&](){
+                if(members.isEmpty())
+                    return true;
+
+                QJsonArray shardEntries;
+                for(auto &shard : shards)
+                {
+                    //named after their content like content defined parts, an unchanged stripe keeps its bitmaps
+                    const auto shardDigest = measure(metrics.hashNsecs, [&](){ return QString(partDigest(options.digestAlgorithm, shard).toHex()); });
+                    const auto filename = shardDigest % ".parity.bmp";
+                    const auto completePath = targetDir.absoluteFilePath(filename);
+                    //reused as it is once it exists, so it only ever shows up complete
+                    if(!QFileInfo(completePath).exists())
+                    {
+                        const auto tempPath = tempBitmapPath(completePath);
+                        if(!writeBitmap(tempPath, shard, journal != nullptr))
+                        {
+                            QFile::remove(tempPath);
+                            return false;
+                        }
+                        if(!commitBitmap(tempPath, completePath, journal != nullptr) || !logCreated(completePath, options))
+                            return false;
+                    }
+
+                    QJsonObject shardEntry;
+                    shardEntry[QStringLiteral("filename")] = filename;
+                    shardEntry[partDigestName(options.digestAlgorithm)] = shardDigest;
+                    shardEntries.append(shardEntry);
+
+                    shard.clear();
+                }
+
+                QJsonObject stripe;
+                stripe[QStringLiteral("code")] = QLatin1String(parity::codeName);
+                stripe[QStringLiteral("parts")] = members;
+                stripe[QStringLiteral("shardLength")] = shardLength;
+                stripe[QStringLiteral("shards")] = shardEntries;
+                stripes.append(stripe);
+
+                members = QJsonArray();
+                shardLength = 0;
+                return true;
+            };
+
+            std::pair<int, Chunk> item;
+            while(parityStage.pop(parityQueue, item))
+            {
+                const auto encoded = parityStage.work([&](){
+                    const auto &buffer = item.second.buffer;
+                    measure(metrics.parityNsecs, [&](){ parity::addShard(shards, members.size(), buffer.constData(), buffer.size()); });
+                    shardLength = qMax(shardLength, buffer.size());
+                    members.append(item.first);
+
+                    return members.size() < options.parityDataParts || finishStripe();
+                });
+                item = std::pair<int, Chunk>();
+                if(!encoded)
+                {
+                    parityFailed = true;
+                    parityQueue.close();
+                    break;
+                }
+            }
+
+            //the last stripe may be short
+            if(!parityFailed && !parityStage.work(finishStripe))
+                parityFailed = true;
+        });
+
+    const Chunker chunker(options.minChunkSize, options.averageChunkSize, options.maxChunkSize);
+    QByteArray window;
+
+    //fixed parts are read straight into their block, content defined ones copied there from the window
+    const qint64 readSize = options.contentDefinedChunking ? chunker.maxSize() : 2048 * 2048 * 4;
+    const auto pool = options.bufferPool && options.bufferPool->blockSize() >= readSize ? options.bufferPool : nullptr;
+
+    bool readFailed = false;
+    qint64 pos = 0;
+    //ahead of pos by what the chunker still holds
+    qint64 readPos = 0;
+    Extent extent { sourceFile ? 0 : size, false };
+
+    QVector<QJsonObject> journaled;
+    if(journal)
+        journaled = journal->resumedParts();
+    int nextJournaled = 0;
+
+    int partIndex = 0;
+
+    //the journal is followed as long as its parts line up with the chunks cut now
+    const auto takeJournaled = [&](Chunk &chunk, qint64 length){
+        if(nextJournaled == journaled.size())
+            return false;
+
+        const auto &part = journaled.at(nextJournaled);
+        const auto bitmapPath = part.contains(QStringLiteral("object")) ?
+                    options.objectStore->filePath(part.value(QStringLiteral("object")).toString()) :
+                    targetDir.absoluteFilePath(part.value(QStringLiteral("filename")).toString());
+        if(qint64(part.value(QStringLiteral("startPos")).toDouble()) != chunk.startPos ||
+           qint64(part.value(QStringLiteral("length")).toDouble()) != length ||
+           part.value(QStringLiteral("zero")).toBool() != (chunk.zeroLength != 0) ||
+           (!chunk.zeroLength && !QFile::exists(bitmapPath)))
+        {
+            nextJournaled = journaled.size();
+            return false;
+        }
+
+        chunk.journaled = part;
+        nextJournaled++;
+        metrics.resumedBytes += length;
+        return true;
+    };
+
+    while(pos < size)
+    {
+        if(window.isEmpty() && readPos == extent.end && !nextExtent(*sourceFile, readPos, extent))
+        {
+            readFailed = true;
+            break;
+        }
+
+        if(extent.hole)
+        {
+            //capped like data parts, the manifest only has 32 bits for a part's length
+            Chunk chunk { pos, QByteArray(), qMin<qint64>(extent.end - pos, options.maxChunkSize) };
+            takeJournaled(chunk, chunk.zeroLength);
+            pos = readPos = pos + chunk.zeroLength;
+
+            if(!readStage.push(hashQueue, chunk) ||
+               !readStage.push(writeQueue, chunk))
+                break;
+            partIndex++;
+            continue;
+        }
+
+        //blocks while the memory budget is used up, until the later stages give a block back
+        BufferPool::Lease lease;
+        if(pool)
+        {
+            lease = readStage.wait([&](){ return pool->acquire(); });
+            if(!lease)
+            {
+                readFailed = true;
+                break;
+            }
+        }
+
+        QByteArray buffer;
+        const auto read = readStage.work([&](){
+            const auto available = extent.end - readPos;
+            if(!options.contentDefinedChunking)
+            {
+                if(pool)
+                {
+                    const auto length = readFull(source, lease.get(), qMin(readSize, available));
+                    if(length == -1)
+                        return false;
+                    buffer = QByteArray::fromRawData(lease.get(), length);
+                }
+                else if(!readFull(source, qMin(readSize, available), buffer))
+                    return false;
+
+                readPos += buffer.length();
+                return true;
+            }
+
+            QByteArray data;
+            if(!readFull(source, qMin<qint64>(chunker.maxSize() - window.size(), available), data))
+                return false;
+            readPos += data.length();
+            window.append(data);
+
+            const auto length = chunker.cut(window.constData(), window.size());
+            if(pool)
+            {
+                std::memcpy(lease.get(), window.constData(), length);
+                buffer = QByteArray::fromRawData(lease.get(), length);
+            }
+            else
+                buffer = window.left(length);
+            window.remove(0, length);
+            return true;
+        });
+        if(!read)
+        {
+            qWarning() << "could not read source" << source.errorString();
+            readFailed = true;
+            break;
+        }
+
+        //the end of a stream, a file must not end before its size
+        if(buffer.isEmpty())
+        {
+            if(sequential)
+                break;
+
+            qWarning() << "could not read source file" << source.errorString();
+            readFailed = true;
+            break;
+        }
+
+        metrics.bytesRead += buffer.length();
+
+        auto chunk = Chunk { pos, buffer };
+        chunk.lease = lease;
+        pos += buffer.length();
+
+        if(isAllZero(buffer))
+        {
+            chunk.buffer.clear();
+            chunk.lease.reset();
+            chunk.zeroLength = buffer.length();
+        }
+
+        if(!takeJournaled(chunk, buffer.length()) && !chunk.zeroLength && compress)
+        {
+            const auto level = options.compressionLevel;
+            //the lease keeps the block of a pooled buffer until the compressor is done with it
+            std::packaged_task<QByteArray()> task([buffer, lease, level](){
+                return measure(metrics.compressNsecs, [&](){ return compressPart(buffer, level); });
+            });
+            chunk.compressed = task.get_future().share();
+
+            if(!readStage.push(compressQueue, std::move(task)))
+                break;
+        }
+
+        //QByteArray is implicitly shared, all stages get the same buffer. Journaled
+        //parts still go to the parity stage, it is not journaled itself.
+        if(!readStage.push(hashQueue, chunk) ||
+           (parityThread.joinable() && !chunk.zeroLength && !readStage.push(parityQueue, std::make_pair(partIndex, chunk))) ||
+           !readStage.push(writeQueue, chunk))
+            break;
+        partIndex++;
+    }
+
+    hashQueue.close();
+    writeQueue.close();
+    compressQueue.close();
+    parityQueue.close();
+    hashThread.join();
+    writeThread.join();
+    for(auto &thread : compressThreads)
+        thread.join();
+    if(parityThread.joinable())
+        parityThread.join();
+
+    //the write stage is accounted by writeBitmap() and the part hashes themselves
+    metrics.readNsecs += readStage.workNsecs();
+    metrics.hashNsecs += hashStage.workNsecs();
+
+    reportStage(readStage);
+    reportStage(hashStage);
+    reportStage(writeStage);
+    if(options.parityParts > 0)
+        reportStage(parityStage);
+
+    length = pos;
+
+    return !readFailed && !writeFailed && !parityFailed;
+}
+
+//! emptyDirectory() that logs what goes, the bitmaps one by one and child nodes as whole trees
+bool clearDirectory(const QString &targetPath, const SpreadOptions &options)
+{
+    if(!options.changeLog)
+        return emptyDirectory(targetPath);
+
+    const auto fileInfos = QDir(targetPath).entryInfoList(QDir::AllEntries | QDir::NoDotAndDotDot | QDir::Hidden | QDir::System);
+    if(!emptyDirectory(targetPath))
+        return false;
+
+    for(const auto &fileInfo : fileInfos)
+    {
+        if(fileInfo.isDir() && !fileInfo.isSymLink())
+        {
+            if(!options.changeLog->removedTree(fileInfo.absoluteFilePath()))
+                return false;
+        }
+        else if(fileInfo.fileName().endsWith(QStringLiteral(".bmp")) && !logRemoved(fileInfo.absoluteFilePath(), options))
+            return false;
+    }
+
+    return true;
+}
+
+//! Removes every bitmap in a file's target dir that the new index does not reference anymore
+bool removeStaleParts(const QDir &targetDir, const QJsonObject &index, const SpreadOptions &options)
+{
+    QSet<QString> referenced;
+    referenced.insert(QStringLiteral("__index.bmp"));
+    for(const auto &part : index.value(QStringLiteral("parts")).toArray())
+        referenced.insert(part.toObject().value(QStringLiteral("filename")).toString());
+    for(const auto &stripe : index.value(QStringLiteral("parity")).toArray())
+        for(const auto &shard : stripe.toObject().value(QStringLiteral("shards")).toArray())
+            referenced.insert(shard.toObject().value(QStringLiteral("filename")).toString());
+
+    for(const auto &filename : targetDir.entryList(QDir::Files))
+    {
+        if(referenced.contains(filename))
+            continue;
+
+        if(!QFile::remove(targetDir.absoluteFilePath(filename)))
+        {
+            qWarning() << "could not remove stale part" << targetDir.absoluteFilePath(filename);
+            return false;
+        }
+
+        //the journal and temporary files never made it into the change log
+        if(filename.endsWith(QStringLiteral(".bmp")) && !logRemoved(targetDir.absoluteFilePath(filename), options))
+            return false;
+    }
+
+    return true;
+}
+
+QJsonObject fileIndex(qint64 filesize, const QDateTime &birthTime, const QDateTime &lastModified, const QDateTime &lastRead,
+                      DigestAlgorithm algorithm, const QByteArray &digest, const QJsonArray &parts)
+{
+    QJsonObject jsonObject;
+    jsonObject[QStringLiteral("type")] = QStringLiteral("file");
+    jsonObject[QStringLiteral("filesize")] = filesize;
+    jsonObject[QStringLiteral("birthTime")] = birthTime.toMSecsSinceEpoch();
+    jsonObject[QStringLiteral("lastModified")] = lastModified.toMSecsSinceEpoch();
+    jsonObject[QStringLiteral("lastRead")] = lastRead.toMSecsSinceEpoch();
+    //sha512 indexes stay as they were so older versions can still compile them
+    if(algorithm != DigestAlgorithm::Sha512)
+        jsonObject[QStringLiteral("digest")] = digestName(algorithm);
+    jsonObject[digestName(algorithm)] = QString(digest.toHex());
+    jsonObject[QStringLiteral("parts")] = parts;
+    return jsonObject;
+}
+
+QJsonObject fileIndex(const QFileInfo &sourceFileInfo, DigestAlgorithm algorithm, const QByteArray &digest, const QJsonArray &parts)
+{
+    const auto birthTime = sourceFileInfo
+#if QT_VERSION < QT_VERSION_CHECK(5, 10, 0)
+            //deprecated since 5.10
+            .created();
+#else
+            .birthTime();
+#endif
+
+    return fileIndex(sourceFileInfo.size(), birthTime, sourceFileInfo.lastModified(), sourceFileInfo.lastRead(), algorithm, digest, parts);
+}
+
+//! Makes a new file index current, whatever only the old one referenced goes
+//! afterwards. Until the rename the old index and its parts stay intact. Stale
+//! parts include those of an interrupted run and its journal.
+bool writeFileIndex(const QDir &targetDir, const QJsonObject &index, const QJsonArray &oldParts, const SpreadOptions &options, bool sync = false)
+{
+    //amazon has enough storage for spaces!
+    const auto content = measure(metrics.jsonNsecs, [&](){ return QJsonDocument(index).toJson(/* QJsonDocument::Compact */); });
+    const auto indexPath = targetDir.absoluteFilePath(QStringLiteral("__index.bmp"));
+    if(!replaceBitmap(indexPath, content, sync) || !logCreated(indexPath, options))
+        return false;
+
+    if(!removeStaleParts(targetDir, index, options))
+        return false;
+
+    //only now that the new index references its objects the old ones may go
+    if(options.objectStore && !options.objectStore->unrefParts(oldParts))
+        return false;
+
+    return true;
+}
+
+//! Everything the parts of a file depend on, a journal is only resumed if it still matches
+QByteArray journalHeader(const StatCache::Stat &sourceStat, const SpreadOptions &options)
+{
+    QJsonObject header;
+    header[QStringLiteral("filesize")] = sourceStat.size;
+    //beyond what a double holds exactly
+    header[QStringLiteral("mtimeNsecs")] = QString::number(sourceStat.mtimeNsecs);
+    header[QStringLiteral("inode")] = QString::number(sourceStat.inode);
+    header[QStringLiteral("digest")] = digestName(options.digestAlgorithm);
+    header[QStringLiteral("chunking")] = options.contentDefinedChunking ?
+                QStringLiteral("%0:%1:%2").arg(options.minChunkSize).arg(options.averageChunkSize).arg(options.maxChunkSize) :
+                QStringLiteral("fixed");
+    header[QStringLiteral("compression")] = options.compressionLevel;
+    header[QStringLiteral("objectStore")] = options.objectStore ? options.objectStore->path() : QString();
+    return QJsonDocument(header).toJson(QJsonDocument::Compact);
+}
+
+//! Bookkeeping for every file of the tree, changed or not
+void recordFile(const QString &targetPath, const StatCache::Stat &sourceStat, const QJsonObject &index, const SpreadOptions &options)
+{
+    if(options.statCache)
+        options.statCache->insert(targetPath, sourceStat, index);
+
+    if(options.manifest)
+        options.manifest->addFile(targetPath, index);
+
+    if(options.packWriter)
+        for(const auto &part : index.value(QStringLiteral("parts")).toArray())
+            if(part.toObject().contains(QStringLiteral("pack")))
+                options.packWriter->reference(part.toObject().value(QStringLiteral("pack")).toString());
+}
+
+//! Small files are read in one go and go into the current pack. Their index is
+//! written by the pack writer once the pack is on disk.
+bool spreadPackedFile(const QFileInfo &sourceFileInfo, const QDir &targetDir, const SpreadOptions &options,
+                      const QJsonArray &oldParts, const StatCache::Stat &sourceStat)
+{
+    QFile sourceFile(sourceFileInfo.absoluteFilePath());
+    if(!sourceFile.open(QIODevice::ReadOnly))
+    {
+        qWarning() << "could not open source file" << sourceFile.errorString();
+        return false;
+    }
+
+    const auto content = measure(metrics.readNsecs, [&](){ return sourceFile.readAll(); });
+    if(content.size() != sourceFileInfo.size())
+    {
+        qWarning() << "could not read source file" << sourceFile.errorString();
+        return false;
+    }
+
+    metrics.bytesRead += content.size();
+
+    const auto algorithm = options.digestAlgorithm;
+    const auto fileDigest = measure(metrics.hashNsecs, [&](){
+        FileDigest hash(algorithm);
+        hash.addData(content);
+        return hash.result();
+    });
+    //with blake3 the file and its only part have the same digest
+    const auto contentDigest = algorithm == DigestAlgorithm::Blake3 ?
+                fileDigest : measure(metrics.hashNsecs, [&](){ return partDigest(algorithm, content); });
+    const auto index = fileIndex(sourceFileInfo, algorithm, fileDigest, QJsonArray());
+    const auto length = content.size();
+
+    return options.packWriter->add(content, [=, &options](const QString &pack, quint32 offset){
+        QJsonObject part;
+        part[QStringLiteral("startPos")] = 0;
+        part[QStringLiteral("endPos")] = length;
+        part[QStringLiteral("length")] = length;
+        part[partDigestName(algorithm)] = QString(contentDigest.toHex());
+        part[QStringLiteral("pack")] = pack;
+        part[QStringLiteral("offset")] = qint64(offset);
+
+        auto packedIndex = index;
+        packedIndex[QStringLiteral("parts")] = QJsonArray { part };
+
+        if(!writeFileIndex(targetDir, packedIndex, oldParts, options))
+            return false;
+
+        recordFile(targetDir.absolutePath(), sourceStat, packedIndex, options);
+        return true;
+    });
+}
+
+//! sourceStat comes from the scan of the parent dir, an unchanged file is not
+//! statted again
+bool spreadFile(const QString &sourcePath, const StatCache::Stat &sourceStat, const QDir &targetDir, const SpreadOptions &options)
+{
+    const auto targetPath = targetDir.absolutePath();
+
+    bool rewriteIndex = false;
+    QJsonArray oldParts;
+    QJsonObject index;
+
+    //--verify has to look at the content anyway
+    if(options.statCache && !options.verify && options.statCache->lookup(targetPath, sourceStat, index))
+    {
+        recordFile(targetPath, sourceStat, index, options);
+        return true;
+    }
+
+    if(!targetDir.mkpath(targetDir.absolutePath()))
+    {
+        qWarning() << "could not create target dir";
+        return false;
+    }
+
+    if(QFile::exists(targetDir.absoluteFilePath(QStringLiteral("__index.bmp"))))
+    {
+        QByteArray content;
+        if(readBitmap(targetDir.absoluteFilePath(QStringLiteral("__index.bmp")), content))
+        {
+            QJsonParseError error;
+            auto document = measure(metrics.jsonNsecs, [&](){ return QJsonDocument::fromJson(content, &error); });
+            metrics.indexParses++;
+            if(error.error != QJsonParseError::NoError)
+            {
+                qWarning() << "index is invalid: error parsing json" << error.errorString();
+                return false;
+            }
+            if(!document.isObject())
+            {
+                qWarning() << "index is invalid: json is not an object";
+                return false;
+            }
+            const auto jsonObject = document.object();
+
+            if(!jsonObject.contains(QStringLiteral("type")))
+            {
+                qWarning() << "index is invalid: json does not contain type";
+                return false;
+            }
+            const auto typeValue = jsonObject.value(QStringLiteral("type"));
+            if(typeValue.type() != QJsonValue::String)
+            {
+                qWarning() << "index is invalid: json type is not a string";
+                return false;
+            }
+            const auto type = typeValue.toString();
+
+            if(type == QStringLiteral("file"))
+            {
+                index = jsonObject;
+                oldParts = jsonObject.value(QStringLiteral("parts")).toArray();
+
+                const auto filesizeValue = jsonObject.value(QStringLiteral("filesize"));
+                const auto lastModifiedValue = jsonObject.value(QStringLiteral("lastModified"));
+                if(filesizeValue.type() != QJsonValue::Double || lastModifiedValue.type() != QJsonValue::Double)
+                {
+                    qWarning() << "index is invalid: json filesize or lastModified is not a number";
+                    rewriteIndex = true;
+                }
+                else if(qint64(filesizeValue.toDouble()) != sourceStat.size ||
+                        qint64(lastModifiedValue.toDouble()) != sourceStat.mtimeNsecs / 1000000)
+                {
+                    qInfo() << "changed" << sourcePath;
+                    rewriteIndex = true;
+                }
+                else if(options.verify)
+                {
+                    //compared with the algorithm the index was written with
+                    const auto algorithm = indexDigestAlgorithm(jsonObject);
+
+                    QByteArray digest;
+                    if(!hashFile(sourcePath, algorithm, options.hashThreads, digest))
+                        return false;
+
+                    if(QString(digest.toHex()) != jsonObject.value(digestName(algorithm)).toString())
+                    {
+                        qInfo() << "content changed" << sourcePath;
+                        rewriteIndex = true;
+                    }
+                }
+            }
+            else if(type == QStringLiteral("directory"))
+            {
+                qInfo() << "type changed from file to directory";
+                if(options.objectStore && !releaseTree(targetDir, *options.objectStore))
+                    return false;
+                if(options.statCache)
+                    options.statCache->removeTree(targetPath);
+                if(!clearDirectory(targetDir.absolutePath(), options))
+                    return false;
+                rewriteIndex = true;
+            }
+            else
+            {
+                qWarning() << "index is invalid: unknown type" << type;
+                rewriteIndex = true;
+            }
+        }
+        else
+            rewriteIndex = true;
+    }
+    else
+        rewriteIndex = true;
+
+    if(rewriteIndex)
+    {
+        //only the index needs the times, the content is read anyway
+        const QFileInfo sourceFileInfo(sourcePath);
+
+        const auto packed = options.packWriter && sourceStat.size > 0 && sourceStat.size < options.packThreshold;
+
+        //the parts of the previous run stay until the new index is in place,
+        //content defined ones get reused and the stale ones removed then. A
+        //packed file's index only comes once its pack is on disk.
+        if(packed)
+            return spreadPackedFile(sourceFileInfo, targetDir, options, oldParts, sourceStat);
+
+        //a file of a single part has nothing to resume
+        QScopedPointer<FileJournal> journal;
+        if(options.journal && sourceStat.size > options.maxChunkSize)
+        {
+            journal.reset(new FileJournal(targetDir));
+            if(!journal->open(journalHeader(sourceStat, options)))
+                return false;
+        }
+
+        //unbuffered, the extent lookups move the file offset behind QFile's back
+        QFile sourceFile(sourcePath);
+        if(!sourceFile.open(QIODevice::ReadOnly | QIODevice::Unbuffered))
+        {
+            qWarning() << "could not open source file" << sourceFile.errorString();
+            return false;
+        }
+
+        QJsonArray parts;
+        QJsonArray stripes;
+        QByteArray digest;
+        qint64 length;
+        if(!spreadParts(sourceFile, targetDir, options, journal.data(), parts, stripes, digest, length))
+            return false;
+
+        index = fileIndex(sourceFileInfo, options.digestAlgorithm, digest, parts);
+        if(!stripes.isEmpty())
+            index[QStringLiteral("parity")] = stripes;
+        if(!writeFileIndex(targetDir, index, oldParts, options, !journal.isNull()))
+            return false;
+    }
+
+    recordFile(targetPath, sourceStat, index, options);
+
+    return true;
+}
+
+bool diffDirectory(const QDir &sourceDir, const StatCache::Stat &sourceStat, const QDir &targetDir, const SpreadOptions &options, DirectoryDiff &diff)
+{
+    diff.sourceStat = sourceStat;
+
+    auto &entries = diff.entries;
+    auto &rewriteIndex = diff.rewriteIndex;
+
+    rewriteIndex = false;
+    QStringList oldEntries;
+
+    //a cache hit means the index in the target is the one we wrote last time
+    bool cached = false;
+    if(options.statCache)
+    {
+        QJsonObject cachedIndex;
+        if(options.statCache->lookup(targetDir.absolutePath(), diff.sourceStat, cachedIndex))
+        {
+            cached = true;
+            for(const auto &value : cachedIndex.value(QStringLiteral("entries")).toArray())
+                oldEntries.append(value.toString());
+        }
+    }
+
+    if(!cached && !targetDir.mkpath(targetDir.absolutePath()))
+    {
+        qWarning() << "could not create target dir";
+        return false;
+    }
+
+    if(!cached && QFile::exists(targetDir.absoluteFilePath(QStringLiteral("__index.bmp"))))
+    {
+        QByteArray content;
+        if(readBitmap(targetDir.absoluteFilePath(QStringLiteral("__index.bmp")), content))
+        {
+            QJsonParseError error;
+            const auto document = measure(metrics.jsonNsecs, [&](){ return QJsonDocument::fromJson(content, &error); });
+            metrics.indexParses++;
+            if(error.error != QJsonParseError::NoError)
+            {
+                qWarning() << "index is invalid: error parsing json" << error.errorString();
+                return false;
+            }
+            if(!document.isObject())
+            {
+                qWarning() << "index is invalid: json is not an object";
+                return false;
+            }
+            const auto jsonObject = document.object();
+
+            if(!jsonObject.contains(QStringLiteral("type")))
+            {
+                qWarning() << "index is invalid: json does not contain type";
+                return false;
+            }
+            const auto typeValue = jsonObject.value(QStringLiteral("type"));
+            if(typeValue.type() != QJsonValue::String)
+            {
+                qWarning() << "index is invalid: json type is not a string";
+                return false;
+            }
+            const auto type = typeValue.toString();
+
+            if(type == QStringLiteral("file"))
+            {
+                qInfo() << "type changed from directory to file";
+                if(options.objectStore && !options.objectStore->unrefParts(jsonObject.value(QStringLiteral("parts")).toArray()))
+                    return false;
+                if(!clearDirectory(targetDir.absolutePath(), options))
+                    return false;
+                rewriteIndex = true;
+            }
+            else if(type == QStringLiteral("directory"))
+            {
+                if(!jsonObject.contains("entries"))
+                {
+                    qWarning() << "index is invalid: json does not contain entries";
+                    rewriteIndex = true;
+                }
+                const auto entriesValue = jsonObject.value(QStringLiteral("entries"));
+                if(entriesValue.type() != QJsonValue::Array)
+                {
+                    qWarning() << "index is invalid: json entries is not an array";
+                    rewriteIndex = true;
+                }
+                const auto entries = entriesValue.toArray();
+
+                for(auto value : entries)
+                {
+                    if(value.type() != QJsonValue::String)
+                    {
+                        qWarning() << "index is invalid: json entry is not a string";
+                        rewriteIndex = true;
+                        break;
+                    }
+
+                    oldEntries.append(value.toString());
+                }
+            }
+            else
+            {
+                qWarning() << "index is invalid: unknown type" << type;
+                rewriteIndex = true;
+            }
+        }
+        else
+            rewriteIndex = true;
+    }
+    else if(!cached)
+        rewriteIndex = true;
+
+    diff.sourceDir = sourceDir;
+    if(!scanDirectory(sourceDir.absolutePath(), options.jobs, entries))
+        return false;
+
+    //indexes written before the scanner are in QDir order, a broken one may even repeat names
+    if(!std::is_sorted(oldEntries.constBegin(), oldEntries.constEnd()))
+        std::sort(oldEntries.begin(), oldEntries.end());
+    oldEntries.erase(std::unique(oldEntries.begin(), oldEntries.end()), oldEntries.end());
+
+    const auto removeDeleted = [&](const QString &oldEntry){
+        qInfo() << "deleted" << sourceDir.absoluteFilePath(oldEntry);
+        if(options.objectStore && !releaseTree(QDir(targetDir.absoluteFilePath(oldEntry)), *options.objectStore))
+            return false;
+        if(options.statCache)
+            options.statCache->removeTree(targetDir.absoluteFilePath(oldEntry));
+        if(!QDir(targetDir.absoluteFilePath(oldEntry)).removeRecursively())
+        {
+            qWarning() << "could not remove dir" << targetDir.absoluteFilePath(oldEntry);
+            return false;
+        }
+        if(options.changeLog && !options.changeLog->removedTree(targetDir.absoluteFilePath(oldEntry)))
+            return false;
+        rewriteIndex = true;
+        return true;
+    };
+
+    //both sides are sorted, one merge pass finds what was added and what was deleted
+    auto oldIter = oldEntries.constBegin();
+    for(const auto &entry : entries)
+    {
+        for(; oldIter != oldEntries.constEnd() && *oldIter < entry.name; ++oldIter)
+            if(!removeDeleted(*oldIter))
+                return false;
+
+        if(oldIter != oldEntries.constEnd() && *oldIter == entry.name)
+            ++oldIter;
+        else
+        {
+            qInfo() << "added" << sourceDir.absoluteFilePath(entry.name);
+            rewriteIndex = true;
+        }
+
+        if(!entry.stat.isDir)
+        {
+            metrics.filesTotal++;
+            metrics.bytesTotal += entry.stat.size;
+        }
+    }
+
+    for(; oldIter != oldEntries.constEnd(); ++oldIter)
+        if(!removeDeleted(*oldIter))
+            return false;
+
+    if(options.manifest)
+        options.manifest->addDirectory(targetDir.absolutePath());
+
+    return true;
+}
+
+//! Called after all entries of a directory have been spread
+bool finishDirectory(const QDir &targetDir, const DirectoryDiff &diff, const SpreadOptions &options)
+{
+    QJsonArray entriesArray;
+    for(const auto &entry : diff.entries)
+        entriesArray.append(entry.name);
+
+    QJsonObject jsonObject;
+    jsonObject[QStringLiteral("type")] = QStringLiteral("directory");
+    jsonObject[QStringLiteral("entries")] = entriesArray;
+
+    if(diff.rewriteIndex)
+    {
+        //amazon has enough storage for spaces!
+        const auto content = measure(metrics.jsonNsecs, [&](){ return QJsonDocument(jsonObject).toJson(/* QJsonDocument::Compact */); });
+        const auto indexPath = targetDir.absoluteFilePath(QStringLiteral("__index.bmp"));
+        if(!replaceBitmap(indexPath, content) || !logCreated(indexPath, options))
+            return false;
+    }
+
+    if(options.statCache)
+        options.statCache->insert(targetDir.absolutePath(), diff.sourceStat, jsonObject);
+
+    return true;
+}
+
+//! Only the root is statted here, every other node comes with the stat of
+//! the scan of its parent dir
+bool prepareSpread(const QString &sourcePath, const StatCache::Stat *scannedStat, StatCache::Stat &sourceStat)
+{
+    if(scannedStat)
+    {
+        sourceStat = *scannedStat;
+        return true;
+    }
+
+    if(!StatCache::stat(sourcePath, sourceStat))
+    {
+        qWarning() << "source does not exist";
+        return false;
+    }
+
+    return true;
+}
+
+namespace {
+bool spreadNode(const QString &sourcePath, const StatCache::Stat *scannedStat, const QString &targetPath, const SpreadOptions &options)
+{
+    qCDebug(picsyncTrace) << "spread" << sourcePath << targetPath;
+
+    const QDir targetDir(targetPath);
+
+    StatCache::Stat sourceStat;
+    if(!prepareSpread(sourcePath, scannedStat, sourceStat))
+        return false;
+
+    if(sourceStat.isFile)
+    {
+        if(!spreadFile(sourcePath, sourceStat, targetDir, options))
+            return false;
+
+        metrics.filesDone++;
+        metrics.bytesDone += sourceStat.size;
+    }
+    else if(sourceStat.isDir)
+    {
+        DirectoryDiff diff;
+        if(!diffDirectory(QDir(sourcePath), sourceStat, targetDir, options, diff))
+            return false;
+
+        for(const auto &entry : diff.entries)
+            if(!spreadNode(diff.sourceDir.absoluteFilePath(entry.name), &entry.stat, targetDir.absoluteFilePath(entry.name), options))
+                return false;
+
+        return finishDirectory(targetDir, diff, options);
+    }
+
+    return true;
+}
+}
+
+bool spread(const QString &sourcePath, const QString &targetPath, const SpreadOptions &options)
+{
+    return spreadNode(sourcePath, nullptr, targetPath, options);
+}
+
+bool spreadStream(QIODevice &source, const QString &targetPath, const SpreadOptions &options)
+{
+    qCDebug(picsyncTrace) << "spreadStream" << targetPath;
+
+    const QDir targetDir(targetPath);
+
+    if(!targetDir.mkpath(targetDir.absolutePath()))
+    {
+        qWarning() << "could not create target dir";
+        return false;
+    }
+
+    //a stream cannot be compared with the last run, it is always spread anew
+    QJsonArray oldParts;
+    const auto indexPath = targetDir.absoluteFilePath(QStringLiteral("__index.bmp"));
+    if(QFile::exists(indexPath))
+    {
+        QJsonObject jsonObject;
+        if(readIndex(indexPath, jsonObject) && jsonObject.value(QStringLiteral("type")).toString() == QStringLiteral("file"))
+            oldParts = jsonObject.value(QStringLiteral("parts")).toArray();
+        else
+        {
+            if(options.objectStore && !releaseTree(targetDir, *options.objectStore))
+                return false;
+            if(!clearDirectory(targetPath, options))
+                return false;
+        }
+    }
+
+    //the previous parts and index stay a good copy until writeFileIndex() replaced them
+    QJsonArray parts;
+    QJsonArray stripes;
+    QByteArray digest;
+    qint64 length;
+    if(!spreadParts(source, targetDir, options, nullptr, parts, stripes, digest, length))
+        return false;
+
+    //a stream has no times of its own, it was created now
+    const auto now = QDateTime::currentDateTime();
+    auto index = fileIndex(length, now, now, now, options.digestAlgorithm, digest, parts);
+    if(!stripes.isEmpty())
+        index[QStringLiteral("parity")] = stripes;
+    if(!writeFileIndex(targetDir, index, oldParts, options))
+        return false;
+
+    if(options.manifest)
+        options.manifest->addFile(targetDir.absolutePath(), index);
+
+    metrics.filesDone++;
+    metrics.bytesDone += length;
+
+    return true;
+}
+
+namespace {
+struct PendingDirectory
+{
+    QDir targetDir;
+    DirectoryDiff diff;
+    std::atomic<int> pending;
+    std::shared_ptr<PendingDirectory> parent;
+};
+
+class ParallelSpread
+{
+public:
+    explicit ParallelSpread(const SpreadOptions &options) :
+        m_options(options),
+        m_pool(options.jobs)
+    {
+    }
+
+    bool run(const QString &sourcePath, const QString &targetPath)
+    {
+        m_pool.start([=](){ spreadEntry(sourcePath, nullptr, targetPath, nullptr); });
+        m_pool.waitForDone();
+        return !m_failed;
+    }
+
+private:
+    //! scannedStat points into the entries of parent, which it keeps alive
+    void spreadEntry(const QString &sourcePath, const StatCache::Stat *scannedStat, const QString &targetPath, const std::shared_ptr<PendingDirectory> &parent)
+    {
+        if(m_failed)
+            return;
+
+        qCDebug(picsyncTrace) << "spread" << sourcePath << targetPath;
+
+        const QDir targetDir(targetPath);
+
+        StatCache::Stat sourceStat;
+        if(!prepareSpread(sourcePath, scannedStat, sourceStat))
+        {
+            m_failed = true;
+            return;
+        }
+
+        if(sourceStat.isFile)
+        {
+            if(!spreadFile(sourcePath, sourceStat, targetDir, m_options))
+            {
+                m_failed = true;
+                return;
+            }
+
+            metrics.filesDone++;
+            metrics.bytesDone += sourceStat.size;
+        }
+        else if(sourceStat.isDir)
+        {
+            auto directory = std::make_shared<PendingDirectory>();
+            directory->targetDir = targetDir;
+            if(!diffDirectory(QDir(sourcePath), sourceStat, targetDir, m_options, directory->diff))
+            {
+                m_failed = true;
+                return;
+            }
+
+            //one extra reference so the index cannot be written while children are still being started
+            directory->pending = directory->diff.entries.size() + 1;
+            directory->parent = parent;
+
+            for(const auto &entry : directory->diff.entries)
+            {
+                const auto childSourcePath = directory->diff.sourceDir.absoluteFilePath(entry.name);
+                const auto childTargetPath = targetDir.absoluteFilePath(entry.name);
+                const auto childStat = &entry.stat;
+                m_pool.start([=](){ spreadEntry(childSourcePath, childStat, childTargetPath, directory); });
+            }
+
+            finished(directory);
+            return;
+        }
+
+        finished(parent);
+    }
+
+    //! Called once per finished child, writes the directory index after the last one
+    void finished(std::shared_ptr<PendingDirectory> directory)
+    {
+        while(directory && --directory->pending == 0)
+        {
+            if(m_failed)
+                return;
+
+            if(!finishDirectory(directory->targetDir, directory->diff, m_options))
+            {
+                m_failed = true;
+                return;
+            }
+
+            directory = directory->parent;
+        }
+    }
+
+    const SpreadOptions &m_options;
+    WorkStealingPool m_pool;
+    std::atomic<bool> m_failed { false };
+};
+}
+
+bool spreadParallel(const QString &sourcePath, const QString &targetPath, const SpreadOptions &options)
+{
+    return ParallelSpread(options).run(sourcePath, targetPath);
+}
+
+Spreader::Spreader(const SpreadOptions &options) :
+    m_options(options)
+{
+}
+
+bool Spreader::spread(const QString &sourcePath, const QString &targetPath) const
+{
+    return m_options.jobs > 1 ?
+                spreadParallel(sourcePath, targetPath, m_options) :
+                ::spread(sourcePath, targetPath, m_options);
+}
+
+bool Spreader::spread(QIODevice *source, const QString &targetPath) const
+{
+    return spreadStream(*source, targetPath, m_options);
+}
+
+bool Spreader::spread(int fd, const QString &targetPath) const
+{
+    //unbuffered, the pipeline reads whole parts anyway
+    QFile source;
+    if(!source.open(fd, QIODevice::ReadOnly | QIODevice::Unbuffered, QFileDevice::DontCloseHandle))
+    {
+        qWarning() << "could not open source" << source.errorString();
+        return false;
+    }
+
+    return spreadStream(source, targetPath, m_options);
+}
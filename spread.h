@@ -0,0 +1,97 @@
+#pragma once
+
+#include <QtGlobal>
+
+#include "digest.h"
+
+class QIODevice;
+class QString;
+
+class BufferPool;
+class ChangeLog;
+class ManifestBuilder;
+class ObjectStore;
+class PackWriter;
+class StatCache;
+
+struct SpreadOptions
+{
+    int jobs { 1 };
+    bool verify { false };
+
+    DigestAlgorithm digestAlgorithm { DigestAlgorithm::Sha512 };
+    //! cores one file digest may use, blake3 only
+    int hashThreads { 1 };
+
+    bool contentDefinedChunking { false };
+    int minChunkSize { 1024 * 1024 };
+    int averageChunkSize { 4 * 1024 * 1024 };
+    int maxChunkSize { 2048 * 2048 * 4 };
+
+    //! zlib level for parts, 0 stores them raw
+    int compressionLevel { 0 };
+    //! threads compressing the parts of one file
+    int compressThreads { 1 };
+
+    //! files bigger than one part log their durable parts in a __journal.log,
+    //! so an interrupted run resumes where it stopped. Costs an fdatasync() per part.
+    bool journal { true };
+
+    //! bitmaps of files bigger than one part kept in flight on an io_uring,
+    //! 0 (or a kernel without io_uring) writes them one at a time
+    int ioQueueDepth { 0 };
+
+    //! every run of parityDataParts parts of a file gets parityParts parity
+    //! bitmaps, compile and verify rebuild up to that many lost parts of the
+    //! run from them. 0 spreads no parity.
+    int parityDataParts { 4 };
+    int parityParts { 0 };
+
+    //! parts go to this shared store instead of the file's own directory
+    ObjectStore *objectStore { nullptr };
+
+    //! collects every node for the __manifest.bmp written after the run
+    ManifestBuilder *manifest { nullptr };
+
+    //! local state of the last run, unchanged nodes are not looked up in the target
+    StatCache *statCache { nullptr };
+
+    //! chunk buffers come out of this, so the memory all jobs hold stays within its budget
+    BufferPool *bufferPool { nullptr };
+
+    //! every bitmap created or removed below the target is logged here
+    ChangeLog *changeLog { nullptr };
+
+    //! files smaller than packThreshold are appended to shared packs
+    PackWriter *packWriter { nullptr };
+    qint64 packThreshold { 64 * 1024 };
+};
+
+//! Turns sourcePath into bitmaps below targetPath, only touching what changed since the last run
+bool spread(const QString &sourcePath, const QString &targetPath, const SpreadOptions &options);
+
+//! spread() on a work stealing pool of options.jobs threads
+bool spreadParallel(const QString &sourcePath, const QString &targetPath, const SpreadOptions &options);
+
+//! Spreads a stream (stdin, a pipe, a socket, any QIODevice) as a single file
+//! node at targetPath. Nothing is staged on disk and only the pipeline queues
+//! hold parts, so memory stays bounded however long the stream is.
+bool spreadStream(QIODevice &source, const QString &targetPath, const SpreadOptions &options);
+
+//! Entry point for library users, a file or directory on disk is just one
+//! kind of source
+class Spreader
+{
+public:
+    explicit Spreader(const SpreadOptions &options);
+
+    //! spread() or spreadParallel(), depending on options.jobs
+    bool spread(const QString &sourcePath, const QString &targetPath) const;
+
+    bool spread(QIODevice *source, const QString &targetPath) const;
+    //! fd stays open
+    bool spread(int fd, const QString &targetPath) const;
+
+private:
+    const SpreadOptions m_options;
+};
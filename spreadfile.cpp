@@ -0,0 +1,205 @@
+#include "spreadfile.h"
+
+#include <QDebug>
+#include <QJsonObject>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "bitmap.h"
+#include "compression.h"
+#include "manifest.h"
+#include "mappedbitmap.h"
+#include "metrics.h"
+#include "packs.h"
+
+namespace {
+//! zero parts are handed out from this page
+const char zeroPage[65536] {};
+}
+
+SpreadFile::SpreadFile(const CompileOptions &options) :
+    m_options(options)
+{
+}
+
+bool SpreadFile::open(const QString &rootPath, const QString &path, const Manifest *manifest)
+{
+    qCDebug(picsyncTrace) << "open" << rootPath << path;
+
+    m_file = FileParts();
+
+    //an absolute path would replace the root when joined with it
+    if(QDir::isAbsolutePath(path) || path.split(QLatin1Char('/')).contains(QStringLiteral("..")))
+    {
+        qWarning() << "path leaves the tree" << path;
+        return false;
+    }
+
+    const QDir sourceDir(path.isEmpty() ? rootPath : QDir(rootPath).absoluteFilePath(path));
+
+    if(manifest)
+    {
+        const auto node = manifest->find(path);
+        if(!node)
+        {
+            qWarning() << "path does not exist" << path;
+            return false;
+        }
+        if(node->type != ManifestNode::File)
+        {
+            qWarning() << "path is not a file" << path;
+            return false;
+        }
+
+        return manifestFileParts(*manifest, *node, sourceDir, m_options, m_file);
+    }
+
+    //every node has a directory of its own named like it, so the file's index
+    //is found without reading the indexes above it
+    QJsonObject jsonObject;
+    if(!readIndex(sourceDir.absoluteFilePath(QStringLiteral("__index.bmp")), jsonObject))
+        return false;
+
+    if(jsonObject.value(QStringLiteral("type")).toString() != QStringLiteral("file"))
+    {
+        qWarning() << "path is not a file" << path;
+        return false;
+    }
+
+    return parseFileIndex(jsonObject, sourceDir, m_options, m_file);
+}
+
+bool SpreadFile::read(qint64 offset, qint64 length, const Sink &sink) const
+{
+    if(offset < 0 || length < 0)
+    {
+        qWarning() << "invalid range" << offset << length;
+        return false;
+    }
+
+    //written so length may be anything up to the maximum without overflowing
+    const auto end = offset + qMin(length, qMax<qint64>(0, m_file.filesize - offset));
+    const auto &parts = m_file.parts;
+
+    //the parts are in file order, start with the first one ending behind offset
+    auto iter = std::upper_bound(parts.constBegin(), parts.constEnd(), offset, [](qint64 pos, const RestorePart &part){
+        return pos < part.startPos + part.length;
+    });
+
+    auto pos = offset;
+    for(; pos < end && iter != parts.constEnd(); ++iter)
+    {
+        if(iter->startPos > pos)
+        {
+            qWarning() << "parts are not contiguous";
+            return false;
+        }
+
+        const auto count = qMin(iter->startPos + iter->length, end) - pos;
+        if(!readPart(int(iter - parts.constBegin()), pos - iter->startPos, count, sink))
+            return false;
+
+        pos += count;
+    }
+
+    if(pos < end)
+    {
+        qWarning() << "parts do not add up to filesize";
+        return false;
+    }
+
+    return true;
+}
+
+bool SpreadFile::read(qint64 offset, qint64 length, QByteArray &content) const
+{
+    content.clear();
+    content.reserve(qMax<qint64>(0, qMin(m_file.filesize - offset, length)));
+
+    return read(offset, length, [&content](const char *data, qint64 count){
+        content.append(data, count);
+        return true;
+    });
+}
+
+bool SpreadFile::readTo(qint64 offset, qint64 length, int fd) const
+{
+    return read(offset, length, [fd](const char *data, qint64 count){
+        MetricsTimer timer(metrics.writeNsecs);
+
+        while(count)
+        {
+            const auto written = ::write(fd, data, count);
+            if(written == -1)
+            {
+                if(errno == EINTR)
+                    continue;
+
+                qWarning() << "could not write" << strerror(errno);
+                return false;
+            }
+
+            data += written;
+            count -= written;
+            metrics.bytesWritten += written;
+        }
+
+        return true;
+    });
+}
+
+bool SpreadFile::readPart(int index, qint64 from, qint64 length, const Sink &sink) const
+{
+    const auto &part = m_file.parts.at(index);
+
+    if(part.zero)
+    {
+        for(auto remaining = length; remaining; )
+        {
+            const auto count = qMin<qint64>(remaining, sizeof(zeroPage));
+            if(!sink(zeroPage, count))
+                return false;
+            remaining -= count;
+        }
+        return true;
+    }
+
+    auto bitmap = openPart(part, m_options);
+
+    //with parity the whole part is checked, there is no rebuilding a damaged range after it was handed out
+    if(bitmap && part.codec.isEmpty() && !checkPart(m_file, part, bitmap->content() + part.offset))
+        bitmap.reset();
+
+    //a compressed part can only be read as a whole, so can one rebuilt from parity
+    if(!bitmap || !part.codec.isEmpty())
+    {
+        QByteArray content;
+        if(bitmap)
+        {
+            if(!measure(metrics.compressNsecs, [&](){ return decompressPart(part.codec, bitmap->content(), bitmap->contentLength(), part.length, content); }))
+            {
+                qWarning() << "could not decompress part" << part.path;
+                bitmap.reset();
+            }
+            else
+            {
+                metrics.bytesRead += bitmap->contentLength();
+                if(!checkPart(m_file, part, content.constData()))
+                    bitmap.reset();
+            }
+        }
+
+        if(!bitmap && !rebuildPart(m_file, index, m_options, content))
+            return false;
+
+        return sink(content.constData() + from, length);
+    }
+
+    //only the pages of the range get faulted in
+    metrics.bytesRead += length;
+    return sink(bitmap->content() + part.offset + from, length);
+}
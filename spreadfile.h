@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QByteArray>
+#include <QDir>
+#include <QString>
+#include <QtGlobal>
+
+#include <functional>
+
+#include "compile.h"
+
+class Manifest;
+
+//! Random access to a single file of a spread tree. Only the file's own index
+//! (or its manifest node) is read, and a range only touches the part bitmaps
+//! covering it, read straight from their pixel data. The file digest covers
+//! the whole file, so ranges are not checked against it, -a verify checks the
+//! parts. A lost part is rebuilt from the file's parity if it has any.
+class SpreadFile
+{
+    Q_DISABLE_COPY(SpreadFile)
+
+public:
+    //! Gets the range in file order, returning false aborts the read
+    using Sink = std::function<bool(const char *data, qint64 length)>;
+
+    explicit SpreadFile(const CompileOptions &options);
+
+    //! path is relative to rootPath, the root of the spread tree, and empty if
+    //! the root is the file. The file is looked up in manifest if there is one.
+    bool open(const QString &rootPath, const QString &path, const Manifest *manifest = nullptr);
+
+    qint64 size() const { return m_file.filesize; }
+    DigestAlgorithm algorithm() const { return m_file.algorithm; }
+    //! hex digest of the whole file
+    QString digest() const { return m_file.digest; }
+
+    //! Hands length bytes starting at offset to sink, a range reaching past
+    //! the end of the file is cut off there
+    bool read(qint64 offset, qint64 length, const Sink &sink) const;
+    bool read(qint64 offset, qint64 length, QByteArray &content) const;
+
+    //! Writes the range to fd at its current position, so fd may be a pipe
+    bool readTo(qint64 offset, qint64 length, int fd) const;
+
+private:
+    //! index into the file's parts
+    bool readPart(int index, qint64 from, qint64 length, const Sink &sink) const;
+
+    const CompileOptions &m_options;
+    FileParts m_file;
+};
@@ -0,0 +1,458 @@
+#include "statcache.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QStringBuilder>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+struct StatCache::Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 clean;
+    quint64 rootHash;
+    quint64 bucketCount;
+    quint64 used;
+    quint64 deleted;
+    quint64 heapUsed;
+    quint64 heapSize;
+};
+
+struct StatCache::Bucket
+{
+    enum : quint32 { Used = 1, Deleted = 2, IsDir = 4 };
+
+    quint64 hash;
+    quint64 keyOffset;
+    quint64 valueOffset;
+    quint32 keyLength;
+    quint32 valueLength;
+    qint64 size;
+    qint64 mtimeNsecs;
+    quint64 inode;
+    quint64 device;
+    quint32 flags;
+    quint32 reserved;
+};
+
+namespace {
+const char statCacheMagic[8] { 'P', 'I', 'C', 'S', 'T', 'A', 'T', 'E' };
+const quint32 statCacheVersion { 1 };
+const quint64 initialBucketCount { 1 << 16 };
+const quint64 initialHeapSize { 16 * 1024 * 1024 };
+
+//! qHash() is seeded per process, the table outlives it
+quint64 fnv1a(const char *data, int length)
+{
+    quint64 hash = 0xcbf29ce484222325ull;
+    for(int i = 0; i < length; i++)
+    {
+        hash ^= quint8(data[i]);
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+quint64 fnv1a(const QByteArray &data)
+{
+    return fnv1a(data.constData(), data.size());
+}
+}
+
+bool StatCache::stat(const QString &path, Stat &stat)
+{
+    metrics.stats++;
+
+    struct stat st;
+    if(::stat(QFile::encodeName(path).constData(), &st) == -1)
+    {
+        qWarning() << "could not stat" << path << strerror(errno);
+        return false;
+    }
+
+    fromStat(st, stat);
+    return true;
+}
+
+void StatCache::fromStat(const struct stat &st, Stat &stat)
+{
+    stat.size = st.st_size;
+    stat.mtimeNsecs = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    stat.inode = st.st_ino;
+    stat.device = st.st_dev;
+    stat.isDir = S_ISDIR(st.st_mode);
+    stat.isFile = S_ISREG(st.st_mode);
+}
+
+StatCache::StatCache(const QString &filename, const QString &rootPath) :
+    m_filename(filename),
+    m_rootPath(QDir(rootPath).absolutePath()),
+    m_rootHash(fnv1a(m_rootPath.toUtf8()))
+{
+}
+
+StatCache::~StatCache()
+{
+    close();
+}
+
+bool StatCache::open()
+{
+    m_fd = ::open(QFile::encodeName(m_filename).constData(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(m_fd == -1)
+    {
+        qWarning() << "could not open state" << m_filename << strerror(errno);
+        return false;
+    }
+
+    if(!map(m_fd))
+        return false;
+
+    const bool valid = m_size >= sizeof(Header) &&
+                       std::memcmp(header()->magic, statCacheMagic, sizeof(statCacheMagic)) == 0 &&
+                       header()->version == statCacheVersion &&
+                       m_size == sizeof(Header) + header()->bucketCount * sizeof(Bucket) + header()->heapSize;
+
+    if(!valid || !header()->clean || header()->rootHash != m_rootHash)
+    {
+        if(m_size)
+            qInfo() << "discarding state" << m_filename;
+
+        unmap();
+        if(!create(m_fd, initialBucketCount, initialHeapSize) || !map(m_fd))
+            return false;
+    }
+
+    //stays dirty until close(), a run that dies in between starts from scratch next time
+    header()->clean = 0;
+    msync(m_data, sizeof(Header), MS_SYNC);
+
+    return true;
+}
+
+void StatCache::close()
+{
+    if(m_data)
+    {
+        msync(m_data, m_size, MS_SYNC);
+        header()->clean = 1;
+        msync(m_data, sizeof(Header), MS_SYNC);
+        unmap();
+    }
+
+    if(m_fd != -1)
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool StatCache::lookup(const QString &targetPath, const Stat &stat, QJsonObject &index)
+{
+    const auto key = this->key(targetPath);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const auto bucket = find(key, fnv1a(key));
+    if(!bucket || !(bucket->flags & Bucket::Used))
+        return false;
+
+    if(bucket->size != stat.size || bucket->mtimeNsecs != stat.mtimeNsecs ||
+       bucket->inode != stat.inode || bucket->device != stat.device ||
+       bool(bucket->flags & Bucket::IsDir) != stat.isDir)
+        return false;
+
+    const auto document = measure(metrics.jsonNsecs, [&](){
+        return QJsonDocument::fromJson(QByteArray(heap() + bucket->valueOffset, bucket->valueLength));
+    });
+    if(!document.isObject())
+        return false;
+
+    metrics.indexParses++;
+    index = document.object();
+    return true;
+}
+
+bool StatCache::insert(const QString &targetPath, const Stat &stat, const QJsonObject &index)
+{
+    const auto key = this->key(targetPath);
+    const auto hash = fnv1a(key);
+    const auto value = measure(metrics.jsonNsecs, [&](){ return QJsonDocument(index).toJson(QJsonDocument::Compact); });
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    if(!reserve(key.size() + value.size()))
+        return false;
+
+    auto bucket = find(key, hash);
+    if(!bucket)
+    {
+        qWarning() << "state is full";
+        return false;
+    }
+
+    if(!(bucket->flags & Bucket::Used))
+    {
+        if(bucket->flags & Bucket::Deleted)
+            header()->deleted--;
+        header()->used++;
+
+        bucket->hash = hash;
+        bucket->keyOffset = header()->heapUsed;
+        bucket->keyLength = key.size();
+        std::memcpy(heap() + header()->heapUsed, key.constData(), key.size());
+        header()->heapUsed += key.size();
+    }
+
+    //the old value stays behind as garbage until the table is rebuilt
+    bucket->valueOffset = header()->heapUsed;
+    bucket->valueLength = value.size();
+    std::memcpy(heap() + header()->heapUsed, value.constData(), value.size());
+    header()->heapUsed += value.size();
+
+    bucket->size = stat.size;
+    bucket->mtimeNsecs = stat.mtimeNsecs;
+    bucket->inode = stat.inode;
+    bucket->device = stat.device;
+    bucket->flags = Bucket::Used | (stat.isDir ? Bucket::IsDir : 0);
+
+    return true;
+}
+
+void StatCache::removeTree(const QString &targetPath)
+{
+    const auto key = this->key(targetPath);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    removeTree(key);
+}
+
+void StatCache::removeTree(const QByteArray &key)
+{
+    const auto bucket = find(key, fnv1a(key));
+    if(!bucket || !(bucket->flags & Bucket::Used))
+        return;
+
+    if(bucket->flags & Bucket::IsDir)
+    {
+        const auto document = QJsonDocument::fromJson(QByteArray(heap() + bucket->valueOffset, bucket->valueLength));
+        for(const auto &entryValue : document.object().value(QStringLiteral("entries")).toArray())
+        {
+            const auto entry = entryValue.toString().toUtf8();
+            removeTree(key.isEmpty() ? entry : key + '/' + entry);
+        }
+    }
+
+    bucket->flags = Bucket::Deleted;
+    header()->used--;
+    header()->deleted++;
+}
+
+QByteArray StatCache::key(const QString &targetPath) const
+{
+    const auto path = QDir(targetPath).absolutePath();
+    if(path == m_rootPath)
+        return QByteArray();
+    return path.mid(m_rootPath.length() + 1).toUtf8();
+}
+
+//! Linear probing. Returns the bucket holding key or the first free one on its
+//! probe sequence, nullptr only if the table is completely full.
+StatCache::Bucket *StatCache::find(const QByteArray &key, quint64 hash) const
+{
+    const auto mask = header()->bucketCount - 1;
+    Bucket *firstFree = nullptr;
+
+    for(quint64 i = 0; i <= mask; i++)
+    {
+        const auto bucket = buckets() + ((hash + i) & mask);
+
+        if(bucket->flags & Bucket::Used)
+        {
+            if(bucket->hash == hash && bucket->keyLength == quint32(key.size()) &&
+               std::memcmp(heap() + bucket->keyOffset, key.constData(), key.size()) == 0)
+                return bucket;
+        }
+        else if(bucket->flags & Bucket::Deleted)
+        {
+            if(!firstFree)
+                firstFree = bucket;
+        }
+        else
+            return firstFree ? firstFree : bucket;
+    }
+
+    return firstFree;
+}
+
+//! Makes sure one more entry with heapBytes fits, rebuilding the table into a
+//! bigger file (which also drops the garbage) if it does not.
+bool StatCache::reserve(quint64 heapBytes)
+{
+    const auto &h = *header();
+    if((h.used + h.deleted + 1) * 10 < h.bucketCount * 7 && h.heapUsed + heapBytes <= h.heapSize)
+        return true;
+
+    quint64 bucketCount = h.bucketCount;
+    while((h.used + 1) * 10 >= bucketCount * 5)
+        bucketCount *= 2;
+
+    quint64 liveHeap = heapBytes;
+    for(quint64 i = 0; i < h.bucketCount; i++)
+        if(buckets()[i].flags & Bucket::Used)
+            liveHeap += buckets()[i].keyLength + buckets()[i].valueLength;
+
+    const auto heapSize = qMax(initialHeapSize, liveHeap * 2);
+
+    const auto tempFilename = m_filename % ".tmp";
+    const int fd = ::open(QFile::encodeName(tempFilename).constData(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd == -1)
+    {
+        qWarning() << "could not open state" << tempFilename << strerror(errno);
+        return false;
+    }
+
+    if(!create(fd, bucketCount, heapSize))
+    {
+        ::close(fd);
+        return false;
+    }
+
+    const auto oldFd = m_fd;
+    const auto oldData = m_data;
+    const auto oldSize = m_size;
+    const auto oldHeader = header();
+    const auto oldBuckets = buckets();
+    const auto oldHeap = heap();
+
+    m_data = nullptr;
+    if(!map(fd))
+    {
+        m_data = oldData;
+        m_size = oldSize;
+        ::close(fd);
+        return false;
+    }
+    m_fd = fd;
+
+    for(quint64 i = 0; i < oldHeader->bucketCount; i++)
+    {
+        const auto &oldBucket = oldBuckets[i];
+        if(!(oldBucket.flags & Bucket::Used))
+            continue;
+
+        const QByteArray key(oldHeap + oldBucket.keyOffset, oldBucket.keyLength);
+        auto bucket = find(key, oldBucket.hash);
+
+        *bucket = oldBucket;
+        bucket->keyOffset = header()->heapUsed;
+        std::memcpy(heap() + header()->heapUsed, oldHeap + oldBucket.keyOffset, oldBucket.keyLength);
+        header()->heapUsed += oldBucket.keyLength;
+        bucket->valueOffset = header()->heapUsed;
+        std::memcpy(heap() + header()->heapUsed, oldHeap + oldBucket.valueOffset, oldBucket.valueLength);
+        header()->heapUsed += oldBucket.valueLength;
+        header()->used++;
+    }
+
+    header()->clean = 0;
+
+    munmap(oldData, oldSize);
+    ::close(oldFd);
+
+    if(::rename(QFile::encodeName(tempFilename).constData(), QFile::encodeName(m_filename).constData()) == -1)
+    {
+        qWarning() << "could not replace state" << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+bool StatCache::create(int fd, quint64 bucketCount, quint64 heapSize)
+{
+    const quint64 size = sizeof(Header) + bucketCount * sizeof(Bucket) + heapSize;
+
+    //a fresh ftruncate() reads as zeroes, which is an empty table
+    if(ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1)
+    {
+        qWarning() << "could not resize state" << strerror(errno);
+        return false;
+    }
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, statCacheMagic, sizeof(statCacheMagic));
+    header.version = statCacheVersion;
+    header.rootHash = m_rootHash;
+    header.bucketCount = bucketCount;
+    header.heapSize = heapSize;
+
+    if(pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+    {
+        qWarning() << "could not write state" << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
+
+bool StatCache::map(int fd)
+{
+    struct stat st;
+    if(fstat(fd, &st) == -1)
+    {
+        qWarning() << "could not stat state" << strerror(errno);
+        return false;
+    }
+
+    m_size = st.st_size;
+    if(!m_size)
+        return true;
+
+    const auto data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if(data == MAP_FAILED)
+    {
+        qWarning() << "could not map state" << strerror(errno);
+        return false;
+    }
+
+    m_data = static_cast<char *>(data);
+    return true;
+}
+
+void StatCache::unmap()
+{
+    if(m_data)
+        munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+}
+
+StatCache::Header *StatCache::header() const
+{
+    return reinterpret_cast<Header *>(m_data);
+}
+
+StatCache::Bucket *StatCache::buckets() const
+{
+    return reinterpret_cast<Bucket *>(m_data + sizeof(Header));
+}
+
+char *StatCache::heap() const
+{
+    return m_data + sizeof(Header) + header()->bucketCount * sizeof(Bucket);
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <QtGlobal>
+
+#include <mutex>
+
+class QJsonObject;
+struct stat;
+
+//! Local, memory mapped hash table remembering the source stat and the index
+//! of every node of the last successful spread, keyed by path relative to the
+//! target root. A node whose size, mtime and inode did not change is taken
+//! from here without reading anything from the target tree.
+//!
+//! Only ever a cache: it is thrown away if the target root changed or the
+//! last run did not close it cleanly.
+class StatCache
+{
+    Q_DISABLE_COPY(StatCache)
+
+public:
+    struct Stat
+    {
+        qint64 size;
+        qint64 mtimeNsecs;
+        quint64 inode;
+        quint64 device;
+        bool isDir;
+        //! neither means something spread skips, a socket or the like
+        bool isFile;
+    };
+
+    static bool stat(const QString &path, Stat &stat);
+    static void fromStat(const struct stat &st, Stat &stat);
+
+    StatCache(const QString &filename, const QString &rootPath);
+    ~StatCache();
+
+    bool open();
+    void close();
+
+    //! Returns the cached index of targetPath if its source still has the same stat
+    bool lookup(const QString &targetPath, const Stat &stat, QJsonObject &index);
+    bool insert(const QString &targetPath, const Stat &stat, const QJsonObject &index);
+
+    //! Forgets targetPath and, for directories, everything below it
+    void removeTree(const QString &targetPath);
+
+private:
+    struct Header;
+    struct Bucket;
+
+    QByteArray key(const QString &targetPath) const;
+    Bucket *find(const QByteArray &key, quint64 hash) const;
+    void removeTree(const QByteArray &key);
+    bool reserve(quint64 heapBytes);
+    bool create(int fd, quint64 bucketCount, quint64 heapSize);
+    bool map(int fd);
+    void unmap();
+
+    Header *header() const;
+    Bucket *buckets() const;
+    char *heap() const;
+
+    const QString m_filename;
+    const QString m_rootPath;
+    const quint64 m_rootHash;
+
+    int m_fd { -1 };
+    char *m_data { nullptr };
+    quint64 m_size { 0 };
+
+    std::mutex m_mutex;
+};
@@ -0,0 +1,187 @@
+#include <QtTest>
+
+#include <cstring>
+
+#include "blake3.h"
+#include "blake3_p.h"
+
+namespace {
+struct Kernel
+{
+    const char *name;
+    blake3::HashMany hashMany;
+    std::size_t degree;
+    bool supported;
+};
+
+//! Every kernel compiled in, the ones the cpu lacks are skipped
+QVector<Kernel> kernels()
+{
+    QVector<Kernel> kernels { { "portable", blake3::hashManyPortable, 1, true } };
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    kernels.append(Kernel { "sse41", blake3::hashManySse41, 4, bool(__builtin_cpu_supports("sse4.1")) });
+    kernels.append(Kernel { "avx2", blake3::hashManyAvx2, 8, bool(__builtin_cpu_supports("avx2")) });
+#endif
+    return kernels;
+}
+
+//! The hash column of the official test vectors,
+//! https://github.com/BLAKE3-team/BLAKE3/blob/master/test_vectors/test_vectors.json
+const struct
+{
+    int length;
+    const char *hash;
+} testVectors[] {
+    { 0, "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262" },
+    { 1, "2d3adedff11b61f14c886e35afa036736dcd87a74d27b5c1510225d0f592e213" },
+    { 1023, "10108970eeda3eb932baac1428c7a2163b0e924c9a9e25b35bba72b28f70bd11" },
+    { 1024, "42214739f095a406f3fc83deb889744ac00df831c10daa55189b5d121c855af7" },
+    { 1025, "d00278ae47eb27b34faecf67b4fe263f82d5412916c1ffd97c8cb7fb814b8444" },
+    { 2048, "e776b6028c7cd22a4d0ba182a8bf62205d2ef576467e838ed6f2529b85fba24a" },
+    { 2049, "5f4d72f40d7a5f82b15ca2b2e44b1de3c2ef86c426c95c1af0b6879522563030" },
+    { 3072, "b98cb0ff3623be03326b373de6b9095218513e64f1ee2edd2525c7ad1e5cffd2" },
+    { 3073, "7124b49501012f81cc7f11ca069ec9226cecb8a2c850cfe644e327d22d3e1cd3" },
+    { 4096, "015094013f57a5277b59d8475c0501042c0b642e531b0a1c8f58d2163229e969" },
+    { 4097, "9b4052b38f1c5fc8b1f9ff7ac7b27cd242487b3d890d15c96a1c25b8aa0fb995" },
+    { 5120, "9cadc15fed8b5d854562b26a9536d9707cadeda9b143978f319ab34230535833" },
+    { 5121, "628bd2cb2004694adaab7bbd778a25df25c47b9d4155a55f8fbd79f2fe154cff" },
+    { 6144, "3e2e5b74e048f3add6d21faab3f83aa44d3b2278afb83b80b3c35164ebeca205" },
+    { 6145, "f1323a8631446cc50536a9f705ee5cb619424d46887f3c376c695b70e0f0507f" },
+    { 7168, "61da957ec2499a95d6b8023e2b0e604ec7f6b50e80a9678b89d2628e99ada77a" },
+    { 7169, "a003fc7a51754a9b3c7fae0367ab3d782dccf28855a03d435f8cfe74605e7817" },
+    { 8192, "aae792484c8efe4f19e2ca7d371d8c467ffb10748d8a5a1ae579948f718a2a63" },
+    { 8193, "bab6c09cb8ce8cf459261398d2e7aef35700bf488116ceb94a36d0f5f1b7bc3b" },
+    { 16384, "f875d6646de28985646f34ee13be9a576fd515f76b5b0a26bb324735041ddde4" },
+    { 31744, "62b6960e1a44bcc1eb1a611a8d6235b6b4b78f32e7abc4fb4c6cdcce94895c47" },
+    { 102400, "bc3e3d41a1146b069abffad3c0d44860cf664390afce4d9661f7902e7943e085" },
+};
+
+//! The inputs of the test vectors repeat 0 to 250
+QByteArray testInput(int length)
+{
+    QByteArray input(length, Qt::Uninitialized);
+    for(int i = 0; i < length; i++)
+        input[i] = char(i % 251);
+    return input;
+}
+}
+
+class TestBlake3 : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+
+    void testVectors_data();
+    void testVectors();
+
+    void kernelsAgree_data();
+    void kernelsAgree();
+};
+
+void TestBlake3::cleanup()
+{
+    //whatever a test forced, the next one starts from the best kernel again
+    const auto all = kernels();
+    for(auto iter = all.crbegin(); iter != all.crend(); ++iter)
+        if(iter->supported)
+        {
+            blake3::setKernel(iter->hashMany, iter->degree);
+            break;
+        }
+}
+
+void TestBlake3::testVectors_data()
+{
+    QTest::addColumn<int>("kernel");
+    QTest::addColumn<int>("length");
+    QTest::addColumn<QByteArray>("hash");
+
+    const auto all = kernels();
+    for(int kernel = 0; kernel < all.size(); kernel++)
+        for(const auto &vector : testVectors)
+            QTest::newRow((QByteArray(all.at(kernel).name) + ' ' + QByteArray::number(vector.length)).constData())
+                    << kernel << vector.length << QByteArray(vector.hash);
+}
+
+void TestBlake3::testVectors()
+{
+    QFETCH(int, kernel);
+    QFETCH(int, length);
+    QFETCH(QByteArray, hash);
+
+    const auto used = kernels().at(kernel);
+    if(!used.supported)
+        QSKIP("the cpu does not support this kernel");
+    blake3::setKernel(used.hashMany, used.degree);
+
+    const auto input = testInput(length);
+
+    QCOMPARE(Blake3::hash(input).toHex(), hash);
+    //subtrees are hashed on threads of their own and only their roots combined
+    QCOMPARE(Blake3::hash(input, 4).toHex(), hash);
+
+    //updates that split blocks and chunks anywhere
+    for(const int step : { 1, 63, 64, 65, 1024, 1500 })
+    {
+        Blake3 hasher;
+        for(int pos = 0; pos < length; pos += step)
+            hasher.addData(input.constData() + pos, qMin(step, length - pos));
+        QCOMPARE(hasher.result().toHex(), hash);
+    }
+}
+
+void TestBlake3::kernelsAgree_data()
+{
+    QTest::addColumn<int>("kernel");
+
+    const auto all = kernels();
+    for(int kernel = 1; kernel < all.size(); kernel++)
+        QTest::newRow(all.at(kernel).name) << kernel;
+}
+
+//! Every input count and counter the tree can hand a kernel, against the portable one
+void TestBlake3::kernelsAgree()
+{
+    QFETCH(int, kernel);
+
+    const auto used = kernels().at(kernel);
+    if(!used.supported)
+        QSKIP("the cpu does not support this kernel");
+
+    const auto input = testInput(blake3::MaxSimdDegree * blake3::ChunkLength + 7);
+    const std::uint8_t *inputs[blake3::MaxSimdDegree];
+
+    for(std::size_t count = 1; count <= blake3::MaxSimdDegree; count++)
+    {
+        for(std::size_t i = 0; i < count; i++)
+            inputs[i] = reinterpret_cast<const std::uint8_t *>(input.constData()) + i * blake3::ChunkLength + (count % 8);
+
+        //chunks, with a counter that carries into the upper word
+        for(const std::uint64_t counter : { std::uint64_t(0), std::uint64_t(0xfffffffe) })
+        {
+            std::uint8_t expected[blake3::MaxSimdDegree * blake3::OutLength];
+            std::uint8_t actual[blake3::MaxSimdDegree * blake3::OutLength];
+            blake3::hashManyPortable(inputs, count, blake3::ChunkLength / blake3::BlockLength, blake3::iv, counter, true,
+                                     0, blake3::ChunkStart, blake3::ChunkEnd, expected);
+            used.hashMany(inputs, count, blake3::ChunkLength / blake3::BlockLength, blake3::iv, counter, true,
+                          0, blake3::ChunkStart, blake3::ChunkEnd, actual);
+            QVERIFY(std::memcmp(expected, actual, count * blake3::OutLength) == 0);
+        }
+
+        //parents
+        {
+            std::uint8_t expected[blake3::MaxSimdDegree * blake3::OutLength];
+            std::uint8_t actual[blake3::MaxSimdDegree * blake3::OutLength];
+            blake3::hashManyPortable(inputs, count, 1, blake3::iv, 0, false, blake3::Parent, 0, 0, expected);
+            used.hashMany(inputs, count, 1, blake3::iv, 0, false, blake3::Parent, 0, 0, actual);
+            QVERIFY(std::memcmp(expected, actual, count * blake3::OutLength) == 0);
+        }
+    }
+}
+
+QTEST_APPLESS_MAIN(TestBlake3)
+
+#include "tst_blake3.moc"
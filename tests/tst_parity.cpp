@@ -0,0 +1,229 @@
+#include <QtTest>
+
+#include <cstring>
+#include <random>
+
+#include "gf256.h"
+#include "gf256_p.h"
+#include "parity.h"
+
+namespace {
+struct Kernel
+{
+    const char *name;
+    gf256::MulAdd mulAdd;
+    bool supported;
+};
+
+//! Every kernel compiled in, the ones the cpu lacks are skipped
+QVector<Kernel> kernels()
+{
+    QVector<Kernel> kernels { { "portable", gf256::mulAddPortable, true } };
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    kernels.append(Kernel { "ssse3", gf256::mulAddSsse3, bool(__builtin_cpu_supports("ssse3")) });
+    kernels.append(Kernel { "avx2", gf256::mulAddAvx2, bool(__builtin_cpu_supports("avx2")) });
+#endif
+    return kernels;
+}
+
+//! Shift and add with the reduction by x^8 + x^4 + x^3 + x^2 + 1, nothing
+//! shared with the tables under test
+std::uint8_t referenceMul(std::uint8_t a, std::uint8_t b)
+{
+    unsigned product { 0 };
+    for(int bit = 0; bit < 8; bit++)
+        if(b & (1 << bit))
+            product ^= unsigned(a) << bit;
+    for(int bit = 14; bit >= 8; bit--)
+        if(product & (1u << bit))
+            product ^= 0x11Du << (bit - 8);
+    return std::uint8_t(product);
+}
+
+QByteArray randomBytes(std::mt19937 &random, int length)
+{
+    QByteArray bytes(length, Qt::Uninitialized);
+    for(auto &byte : bytes)
+        byte = char(random());
+    return bytes;
+}
+
+bool selectKernel(int kernel)
+{
+    const auto used = kernels().at(kernel);
+    if(!used.supported)
+        return false;
+    gf256::setKernel(used.mulAdd);
+    return true;
+}
+}
+
+class TestParity : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void cleanup();
+
+    void mul();
+    void inv();
+
+    void mulAdd_data();
+    void mulAdd();
+
+    void roundTrip_data();
+    void roundTrip();
+};
+
+void TestParity::cleanup()
+{
+    //whatever a test forced, the next one starts from the best kernel again
+    const auto all = kernels();
+    for(auto iter = all.crbegin(); iter != all.crend(); ++iter)
+        if(iter->supported)
+        {
+            gf256::setKernel(iter->mulAdd);
+            break;
+        }
+}
+
+void TestParity::mul()
+{
+    for(int a = 0; a < 256; a++)
+        for(int b = 0; b < 256; b++)
+            QCOMPARE(gf256::mul(std::uint8_t(a), std::uint8_t(b)), referenceMul(std::uint8_t(a), std::uint8_t(b)));
+}
+
+void TestParity::inv()
+{
+    for(int a = 1; a < 256; a++)
+        QCOMPARE(referenceMul(std::uint8_t(a), gf256::inv(std::uint8_t(a))), std::uint8_t(1));
+}
+
+void TestParity::mulAdd_data()
+{
+    QTest::addColumn<int>("kernel");
+
+    const auto all = kernels();
+    for(int kernel = 0; kernel < all.size(); kernel++)
+        QTest::newRow(all.at(kernel).name) << kernel;
+}
+
+//! Lengths around the 16 and 32 byte steps, so the tails are covered too
+void TestParity::mulAdd()
+{
+    QFETCH(int, kernel);
+
+    if(!selectKernel(kernel))
+        QSKIP("the cpu does not support this kernel");
+
+    std::mt19937 random(1);
+    for(const int length : { 0, 1, 15, 16, 17, 31, 32, 33, 63, 64, 65, 100, 1000 })
+        for(const int c : { 0, 1, 2, 0x1D, 0x80, 0xFF })
+        {
+            const auto src = randomBytes(random, length);
+            auto dst = randomBytes(random, length);
+
+            auto expected = dst;
+            for(int i = 0; i < length; i++)
+                expected[i] = char(std::uint8_t(expected.at(i)) ^ referenceMul(std::uint8_t(c), std::uint8_t(src.at(i))));
+
+            gf256::mulAdd(reinterpret_cast<std::uint8_t *>(dst.data()),
+                          reinterpret_cast<const std::uint8_t *>(src.constData()), std::uint8_t(c), std::size_t(length));
+            QCOMPARE(dst, expected);
+        }
+}
+
+void TestParity::roundTrip_data()
+{
+    QTest::addColumn<int>("kernel");
+    QTest::addColumn<int>("dataShards");
+    QTest::addColumn<int>("parityShards");
+
+    const auto all = kernels();
+    for(int kernel = 0; kernel < all.size(); kernel++)
+        for(const int dataShards : { 1, 2, 4, 10, parity::maxDataShards })
+            for(const int parityShards : { 1, 2, 3, 4, 8 })
+                QTest::newRow((QByteArray(all.at(kernel).name) + ' ' + QByteArray::number(dataShards) + '+'
+                               + QByteArray::number(parityShards)).constData())
+                        << kernel << dataShards << parityShards;
+}
+
+//! A stripe with a short last part loses every combination the parity can
+//! cover, and one part more
+void TestParity::roundTrip()
+{
+    QFETCH(int, kernel);
+    QFETCH(int, dataShards);
+    QFETCH(int, parityShards);
+
+    if(!selectKernel(kernel))
+        QSKIP("the cpu does not support this kernel");
+
+    std::mt19937 random(std::mt19937::result_type(dataShards * 1000 + parityShards));
+
+    const int length { 1000 + int(random() % 100) };
+    //a stripe of one part is as long as it, otherwise the last part is short
+    QVector<QByteArray> data;
+    for(int i = 0; i < dataShards; i++)
+        data.append(randomBytes(random, i && i == dataShards - 1 ? 1 + int(random() % length) : length));
+
+    QVector<QByteArray> parity(parityShards);
+    for(int i = 0; i < dataShards; i++)
+        parity::addShard(parity, i, data.at(i).constData(), data.at(i).size());
+
+    //the lost parts come back padded to the stripe
+    QVector<QByteArray> padded;
+    for(const auto &part : data)
+        padded.append(part + QByteArray(length - part.size(), '\0'));
+
+    for(const auto &shard : parity)
+        QCOMPARE(shard.size(), length);
+
+    for(int lost = 1; lost <= parityShards + 1 && lost <= dataShards + parityShards; lost++)
+    {
+        for(int attempt = 0; attempt < 8; attempt++)
+        {
+            auto shards = padded + parity;
+
+            //the first attempt loses the data parts from the short last one
+            //down, the others at random with at least one data part among them
+            QVector<int> order;
+            for(int i = dataShards - 1; i >= 0; i--)
+                order.append(i);
+            for(int j = 0; j < parityShards; j++)
+                order.append(dataShards + j);
+            if(attempt)
+            {
+                std::shuffle(order.begin(), order.end(), random);
+                if(order.first() >= dataShards)
+                    std::swap(order[0], order[order.indexOf(int(random() % dataShards))]);
+            }
+
+            for(int i = 0; i < lost; i++)
+                shards[order.at(i)].clear();
+
+            int lostData { 0 };
+            for(int i = 0; i < dataShards; i++)
+                if(shards.at(i).isEmpty())
+                    lostData++;
+
+            const auto restored = parity::reconstruct(shards, dataShards);
+            if(lost <= parityShards)
+            {
+                QVERIFY(restored);
+                QCOMPARE(shards.mid(0, dataShards), padded);
+            }
+            else if(lostData == lost)
+            {
+                //only data parts lost, one more than there is parity
+                QVERIFY(!restored);
+            }
+        }
+    }
+}
+
+QTEST_APPLESS_MAIN(TestParity)
+
+#include "tst_parity.moc"
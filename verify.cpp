@@ -0,0 +1,405 @@
+#include "verify.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QPair>
+#include <QVector>
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "bitmap.h"
+#include "compile.h"
+#include "compression.h"
+#include "digest.h"
+#include "manifest.h"
+#include "mappedbitmap.h"
+#include "metrics.h"
+#include "objectstore.h"
+#include "packs.h"
+#include "workstealingpool.h"
+
+namespace {
+struct PartCheck
+{
+    quint32 offset;
+    quint32 length;
+    //! part bitmaps hold exactly one part, packs many
+    bool whole;
+    DigestAlgorithm algorithm;
+    //! empty if the index predates part digests
+    QByteArray digest;
+    //! the file the part belongs to, for the report
+    QString file;
+    //! empty if the part is stored raw
+    QString codec;
+    //! index in the file's parts, -1 for a parity bitmap
+    int index { -1 };
+    //! the other parts referencing the same object, as file and index
+    QVector<QPair<QString, int>> sharers;
+};
+
+//! A damaged part of files with parity, run() tries to rebuild it for every
+//! file referencing it
+struct LostPart
+{
+    QVector<QPair<QString, int>> parts;
+    bool missing;
+};
+
+class TreeVerifier
+{
+public:
+    TreeVerifier(const QDir &rootDir, const VerifyOptions &options) :
+        m_options(options),
+        m_packs(rootDir.absoluteFilePath(QStringLiteral("__packs"))),
+        m_pool(qMax(1, options.jobs))
+    {
+    }
+
+    //! Reads the indexes on the pool as well, a big tree has as many of them as nodes
+    void collectIndex(const QDir &sourceDir)
+    {
+        m_pool.start([this, sourceDir](){ collectNode(sourceDir); });
+        m_pool.waitForDone();
+    }
+
+    void collectManifest(const Manifest &manifest, const ManifestNode &node, const QDir &sourceDir)
+    {
+        if(node.type == ManifestNode::File)
+        {
+            //the stripes are only in the index, and without them a lost part could not be rebuilt
+            if(node.flags & ManifestNode::HasParity)
+            {
+                collectNode(sourceDir);
+                return;
+            }
+
+            const auto parts = manifest.parts(node);
+            for(quint32 i = 0; i < node.partCount; i++)
+            {
+                const auto &part = parts[i];
+                if(part.flags & ManifestPart::IsZero)
+                    continue;
+
+                const auto algorithm = part.flags & ManifestPart::Blake3Digest ? DigestAlgorithm::Blake3 : DigestAlgorithm::Sha512;
+                PartCheck check { 0, part.length, true, algorithm, QByteArray(), sourceDir.absolutePath() };
+                if(part.flags & ManifestPart::HasDigest)
+                    check.digest = QByteArray(reinterpret_cast<const char *>(part.digest), sizeof(part.digest));
+                if(part.flags & ManifestPart::IsCompressed)
+                    check.codec = zlibCodec();
+
+                if(part.flags & ManifestPart::IsObject)
+                    addObject(manifest.name(part), check);
+                else if(part.flags & ManifestPart::IsPacked)
+                {
+                    check.offset = part.offset;
+                    check.whole = false;
+                    add(m_packs.filePath(manifest.name(part)), check);
+                }
+                else
+                    add(sourceDir.absoluteFilePath(manifest.name(part)), check);
+            }
+
+            return;
+        }
+
+        const auto children = manifest.children(node);
+        for(quint32 i = 0; i < node.childCount; i++)
+            collectManifest(manifest, children[i], QDir(sourceDir.absoluteFilePath(manifest.name(children[i]))));
+    }
+
+    bool run()
+    {
+        for(auto iter = m_bitmaps.constBegin(); iter != m_bitmaps.constEnd(); ++iter)
+        {
+            const auto path = iter.key();
+            const auto &checks = iter.value();
+            m_pool.start([this, path, &checks](){ checkBitmap(path, checks); });
+        }
+        m_pool.waitForDone();
+
+        //a damaged part only counts as such if the parity of its file cannot bring it back
+        CompileOptions compileOptions;
+        compileOptions.objectStore = m_options.objectStore;
+        compileOptions.packReader = &m_packs;
+        qint64 rebuilt = 0;
+        for(const auto &lost : m_lost)
+        {
+            //a shared object stays damaged on disk, every file has to get by without it
+            const auto rebuildable = std::all_of(lost.parts.constBegin(), lost.parts.constEnd(), [&](const QPair<QString, int> &part){
+                FileParts file;
+                QByteArray content;
+                return parseFileIndex(m_parityFiles.value(part.first), QDir(part.first), compileOptions, file) &&
+                       rebuildPart(file, part.second, compileOptions, content);
+            });
+
+            if(rebuildable)
+                rebuilt++;
+            else if(lost.missing)
+                m_missing++;
+            else
+                m_corrupt++;
+        }
+
+        qInfo().noquote() << QStringLiteral("verified %0 parts (%1 MB) in %2 bitmaps: %3 corrupt, %4 missing, %5 rebuilt from parity, %6 without digest, %7 broken indexes")
+                             .arg(qint64(m_verified))
+                             .arg(qint64(m_bytes) / 1000000)
+                             .arg(m_bitmaps.size())
+                             .arg(qint64(m_corrupt))
+                             .arg(qint64(m_missing))
+                             .arg(rebuilt)
+                             .arg(qint64(m_unverified))
+                             .arg(int(m_brokenIndexes));
+
+        return !m_corrupt && !m_missing && !m_brokenIndexes;
+    }
+
+private:
+    void collectNode(const QDir &sourceDir)
+    {
+        const auto indexPath = sourceDir.absoluteFilePath(QStringLiteral("__index.bmp"));
+        if(!QFile::exists(indexPath))
+        {
+            qWarning() << "missing index" << indexPath;
+            m_brokenIndexes++;
+            return;
+        }
+
+        QJsonObject jsonObject;
+        if(!readIndex(indexPath, jsonObject))
+        {
+            qWarning() << "broken index" << indexPath;
+            m_brokenIndexes++;
+            return;
+        }
+
+        const auto type = jsonObject.value(QStringLiteral("type")).toString();
+        if(type == QStringLiteral("directory"))
+        {
+            for(const auto &entryValue : jsonObject.value(QStringLiteral("entries")).toArray())
+            {
+                const QDir entryDir(sourceDir.absoluteFilePath(entryValue.toString()));
+                m_pool.start([this, entryDir](){ collectNode(entryDir); });
+            }
+        }
+        else if(type == QStringLiteral("file"))
+        {
+            const auto algorithm = indexDigestAlgorithm(jsonObject);
+            const auto parts = jsonObject.value(QStringLiteral("parts")).toArray();
+            for(int index = 0; index < parts.size(); index++)
+            {
+                const auto part = parts.at(index).toObject();
+
+                //holes are not stored, there is nothing to check
+                if(part.value(QStringLiteral("zero")).toBool())
+                    continue;
+
+                PartCheck check { 0, quint32(part.value(QStringLiteral("length")).toDouble()), true, algorithm,
+                                  QByteArray::fromHex(part.value(partDigestName(algorithm)).toString().toLatin1()),
+                                  sourceDir.absolutePath(), part.value(QStringLiteral("codec")).toString(), index };
+
+                if(part.contains(QStringLiteral("object")))
+                    addObject(part.value(QStringLiteral("object")).toString(), check);
+                else if(part.contains(QStringLiteral("pack")))
+                {
+                    check.offset = part.value(QStringLiteral("offset")).toDouble();
+                    check.whole = false;
+                    add(m_packs.filePath(part.value(QStringLiteral("pack")).toString()), check);
+                }
+                else
+                    add(sourceDir.absoluteFilePath(part.value(QStringLiteral("filename")).toString()), check);
+            }
+
+            const auto stripes = jsonObject.value(QStringLiteral("parity")).toArray();
+            if(!stripes.isEmpty())
+            {
+                std::lock_guard<std::mutex> lock(m_collectMutex);
+                m_parityFiles.insert(sourceDir.absolutePath(), jsonObject);
+            }
+
+            //the parity bitmaps are checked like parts, they are what a lost part is rebuilt from
+            for(const auto &stripeValue : stripes)
+            {
+                const auto stripe = stripeValue.toObject();
+                for(const auto &shardValue : stripe.value(QStringLiteral("shards")).toArray())
+                {
+                    const auto shard = shardValue.toObject();
+                    PartCheck check { 0, quint32(stripe.value(QStringLiteral("shardLength")).toDouble()), true, algorithm,
+                                      QByteArray::fromHex(shard.value(partDigestName(algorithm)).toString().toLatin1()),
+                                      sourceDir.absolutePath() };
+                    add(sourceDir.absoluteFilePath(shard.value(QStringLiteral("filename")).toString()), check);
+                }
+            }
+        }
+        else
+        {
+            qWarning() << "broken index" << indexPath << "unknown type" << type;
+            m_brokenIndexes++;
+        }
+    }
+
+    void add(const QString &path, const PartCheck &check)
+    {
+        std::lock_guard<std::mutex> lock(m_collectMutex);
+        m_bitmaps[path].append(check);
+    }
+
+    //! Objects shared by many files are only checked once, the first check
+    //! remembers the other parts referencing it
+    void addObject(const QString &digest, const PartCheck &check)
+    {
+        if(!m_options.objectStore)
+        {
+            qWarning() << "part of" << check.file << "references an object but there is no object store";
+            m_brokenIndexes++;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_collectMutex);
+        auto &checks = m_bitmaps[m_options.objectStore->filePath(digest)];
+        if(checks.isEmpty())
+            checks.append(check);
+        else
+            checks.first().sharers.append(qMakePair(check.file, check.index));
+    }
+
+    //! Counted right away unless every file referencing the part has parity
+    //! for it
+    void damaged(const PartCheck &check, bool missing)
+    {
+        auto parts = check.sharers;
+        parts.prepend(qMakePair(check.file, check.index));
+
+        if(std::all_of(parts.constBegin(), parts.constEnd(), [this](const QPair<QString, int> &part){
+            return part.second >= 0 && m_parityFiles.contains(part.first);
+        }))
+        {
+            std::lock_guard<std::mutex> lock(m_lostMutex);
+            m_lost.append(LostPart { parts, missing });
+            return;
+        }
+
+        if(missing)
+            m_missing++;
+        else
+            m_corrupt++;
+    }
+
+    void checkBitmap(const QString &path, const QVector<PartCheck> &checks)
+    {
+        if(!QFile::exists(path))
+        {
+            for(const auto &check : checks)
+            {
+                qWarning() << "missing part" << path << "of" << check.file;
+                damaged(check, true);
+            }
+            return;
+        }
+
+        MappedBitmap bitmap;
+        if(!bitmap.open(path))
+        {
+            for(const auto &check : checks)
+            {
+                qWarning() << "corrupt part" << path << "of" << check.file << "invalid bitmap";
+                damaged(check, false);
+            }
+            return;
+        }
+
+        for(const auto &check : checks)
+        {
+            QByteArray content;
+            if(!check.codec.isEmpty())
+            {
+                //decompressing checks the length
+                if(!measure(metrics.compressNsecs, [&](){ return decompressPart(check.codec, bitmap.content(), bitmap.contentLength(), check.length, content); }))
+                {
+                    qWarning() << "corrupt part" << path << "of" << check.file << "could not decompress";
+                    damaged(check, false);
+                    continue;
+                }
+            }
+            else if(check.whole ? bitmap.contentLength() != check.length :
+                                  quint64(check.offset) + check.length > bitmap.contentLength())
+            {
+                qWarning() << "corrupt part" << path << "of" << check.file << "length does not match";
+                damaged(check, false);
+                continue;
+            }
+            else
+                content = QByteArray::fromRawData(bitmap.content() + check.offset, check.length);
+
+            if(check.digest.isEmpty())
+            {
+                m_unverified++;
+                continue;
+            }
+
+            const auto digest = measure(metrics.hashNsecs, [&](){ return partDigest(check.algorithm, content); });
+            metrics.bytesRead += check.length;
+
+            if(digest != check.digest)
+            {
+                qWarning() << "corrupt part" << path << "of" << check.file << partDigestName(check.algorithm) << "mismatch";
+                damaged(check, false);
+                continue;
+            }
+
+            m_verified++;
+            m_bytes += check.length;
+        }
+    }
+
+    const VerifyOptions &m_options;
+    PackReader m_packs;
+    WorkStealingPool m_pool;
+
+    //! bitmap path -> parts stored in it, so every bitmap gets mapped once
+    QHash<QString, QVector<PartCheck>> m_bitmaps;
+    std::atomic<int> m_brokenIndexes { 0 };
+
+    //! file dir -> its index, only for files with parity
+    QHash<QString, QJsonObject> m_parityFiles;
+    //! guards m_bitmaps and m_parityFiles while the indexes are collected
+    std::mutex m_collectMutex;
+    QVector<LostPart> m_lost;
+    std::mutex m_lostMutex;
+
+    std::atomic<qint64> m_verified { 0 };
+    std::atomic<qint64> m_unverified { 0 };
+    std::atomic<qint64> m_corrupt { 0 };
+    std::atomic<qint64> m_missing { 0 };
+    std::atomic<qint64> m_bytes { 0 };
+};
+}
+
+bool verify(const QString &sourcePath, const VerifyOptions &options)
+{
+    if(!QFileInfo(sourcePath).isDir())
+    {
+        qWarning() << "source is not a dir";
+        return false;
+    }
+
+    const QDir sourceDir(sourcePath);
+
+    TreeVerifier verifier(sourceDir, options);
+    verifier.collectIndex(sourceDir);
+    return verifier.run();
+}
+
+bool verifyManifest(const Manifest &manifest, const QDir &sourceDir, const VerifyOptions &options)
+{
+    TreeVerifier verifier(sourceDir, options);
+    verifier.collectManifest(manifest, manifest.root(), sourceDir);
+    return verifier.run();
+}
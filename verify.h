@@ -0,0 +1,22 @@
+#pragma once
+
+class QDir;
+class QString;
+
+class Manifest;
+class ObjectStore;
+
+struct VerifyOptions
+{
+    int jobs { 1 };
+    const ObjectStore *objectStore { nullptr };
+};
+
+//! Checks every part bitmap of the tree spread to sourcePath against the digest
+//! its index recorded, without reassembling any file. Every bitmap is checked
+//! on its own, options.jobs at a time. Returns false if a part is missing or
+//! corrupt, unless the parity of its file rebuilds it.
+bool verify(const QString &sourcePath, const VerifyOptions &options);
+
+//! verify() with the parts taken from a __manifest.bmp instead of the indexes
+bool verifyManifest(const Manifest &manifest, const QDir &sourceDir, const VerifyOptions &options);
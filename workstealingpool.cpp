@@ -0,0 +1,136 @@
+#include "workstealingpool.h"
+
+#include <chrono>
+
+namespace {
+//! Failed steals in a row that only yield, after that a worker sleeps between them
+const int yieldingMisses { 16 };
+const std::chrono::microseconds missSleep { 100 };
+
+thread_local WorkStealingPool *currentPool { nullptr };
+thread_local int currentWorker { -1 };
+}
+
+WorkStealingPool::WorkStealingPool(int threadCount)
+{
+    if(threadCount < 1)
+        threadCount = 1;
+
+    for(int i = 0; i < threadCount; i++)
+        m_workers.emplace_back(new Worker);
+
+    for(int i = 0; i < threadCount; i++)
+        m_threads.emplace_back(&WorkStealingPool::run, this, i);
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wakeup.notify_all();
+
+    for(auto &thread : m_threads)
+        thread.join();
+}
+
+void WorkStealingPool::start(Task task)
+{
+    m_pending++;
+
+    const auto index = currentPool == this ? currentWorker : int(m_next++ % m_workers.size());
+
+    {
+        auto &worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queued++;
+    }
+    m_wakeup.notify_one();
+}
+
+void WorkStealingPool::waitForDone()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [this](){ return m_pending == 0; });
+}
+
+void WorkStealingPool::run(int index)
+{
+    currentPool = this;
+    currentWorker = index;
+
+    int misses = 0;
+
+    while(true)
+    {
+        Task task;
+        if(pop(index, task) || steal(index, task))
+        {
+            misses = 0;
+            m_queued--;
+            task();
+            task = nullptr;
+
+            if(--m_pending == 0)
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_done.notify_all();
+            }
+
+            continue;
+        }
+
+        //there are tasks, but their deques were locked or they were just taken,
+        //waiting would return right away and spin on the victims' locks
+        if(m_queued > 0)
+        {
+            if(++misses < yieldingMisses)
+                std::this_thread::yield();
+            else
+                std::this_thread::sleep_for(missSleep);
+            continue;
+        }
+        misses = 0;
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_wakeup.wait(lock, [this](){ return m_quit || m_queued > 0; });
+        if(m_quit && m_queued <= 0)
+            return;
+    }
+}
+
+bool WorkStealingPool::pop(int index, Task &task)
+{
+    auto &worker = *m_workers[index];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if(worker.tasks.empty())
+        return false;
+
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    return true;
+}
+
+bool WorkStealingPool::steal(int index, Task &task)
+{
+    const int count = m_workers.size();
+    for(int i = 1; i < count; i++)
+    {
+        auto &victim = *m_workers[(index + i) % count];
+        std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+        if(!lock.owns_lock() || victim.tasks.empty())
+            continue;
+
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! Thread pool where every worker owns a deque. Tasks started from a worker go
+//! to the back of its own deque and are popped LIFO (depth first, keeps the
+//! working set small), idle workers steal FIFO from the front of the others.
+class WorkStealingPool
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit WorkStealingPool(int threadCount);
+    ~WorkStealingPool();
+
+    void start(Task task);
+
+    //! Blocks until every started task, including the ones started by other
+    //! tasks, has finished.
+    void waitForDone();
+
+    int threadCount() const { return int(m_workers.size()); }
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void run(int index);
+    bool pop(int index, Task &task);
+    bool steal(int index, Task &task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wakeup;
+    std::condition_variable m_done;
+    std::atomic<int> m_queued { 0 };
+    std::atomic<int> m_pending { 0 };
+    std::atomic<unsigned int> m_next { 0 };
+    bool m_quit { false };
+};